@@ -0,0 +1,239 @@
+#include <QFile>
+#include <QDataStream>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define BITMASK_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define BITMASK_NEON
+#endif
+
+#include "BitMask.h"
+
+static int popcount32(quint32 v)
+{
+	v = v - ((v >> 1) & 0x55555555);
+	v = (v & 0x33333333) + ((v >> 2) & 0x33333333);
+	return (((v + (v >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24;
+}
+
+template<int CN>
+static void packMask(const cv::Mat& mask, BitMask& bits)
+{
+	const int colorChannels = (CN < 3) ? CN : 3; // Alpha of RGB32 is always set
+	for(int i = 0; i < mask.rows; i++)
+	{
+		const uchar *p = mask.ptr<uchar>(i);
+		uchar *out = bits.line(i);
+		for(int j = 0; j < mask.cols; j++, p += CN)
+		{
+			bool set = false;
+			for(int c = 0; c < colorChannels; c++)
+				set = set || p[c] != 0;
+			if(set)
+				out[j >> 3] |= 0x80 >> (j & 7);
+		}
+	}
+}
+
+BitMask::BitMask()
+	: nrows(0), ncols(0), stride(0) {}
+
+BitMask::BitMask(int rows, int cols)
+{
+	create(rows, cols);
+}
+
+BitMask::BitMask(const cv::Mat& mask)
+{
+	CV_Assert(mask.depth() == CV_8U && (mask.channels() == 1 || mask.channels() == 3 || mask.channels() == 4));
+	create(mask.rows, mask.cols);
+	switch(mask.channels())
+	{
+	case 1:
+		packMask<1>(mask, *this);
+		break;
+	case 4:
+		packMask<4>(mask, *this);
+		break;
+	default:
+		packMask<3>(mask, *this);
+	}
+}
+
+void BitMask::create(int rows, int cols)
+{
+	nrows = rows;
+	ncols = cols;
+	stride = (cols + 31) / 32;
+	words.assign(nrows * stride, 0);
+}
+
+int BitMask::area() const
+{
+	const size_t n = words.size();
+	size_t k = 0;
+	int total = 0;
+#if defined(BITMASK_SSE2)
+	// Per byte counts, summed by psadbw
+	const __m128i m1 = _mm_set1_epi8(0x55);
+	const __m128i m2 = _mm_set1_epi8(0x33);
+	const __m128i m4 = _mm_set1_epi8(0x0F);
+	__m128i sum = _mm_setzero_si128();
+	for(; k + 4 <= n; k += 4)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)&words[k]);
+		v = _mm_sub_epi8(v, _mm_and_si128(_mm_srli_epi64(v, 1), m1));
+		v = _mm_add_epi8(_mm_and_si128(v, m2), _mm_and_si128(_mm_srli_epi64(v, 2), m2));
+		v = _mm_and_si128(_mm_add_epi8(v, _mm_srli_epi64(v, 4)), m4);
+		sum = _mm_add_epi64(sum, _mm_sad_epu8(v, _mm_setzero_si128()));
+	}
+	total = _mm_cvtsi128_si32(sum) + _mm_cvtsi128_si32(_mm_srli_si128(sum, 8));
+#elif defined(BITMASK_NEON)
+	uint32x4_t sum = vdupq_n_u32(0);
+	for(; k + 4 <= n; k += 4)
+		sum = vaddq_u32(sum, vpaddlq_u16(vpaddlq_u8(vcntq_u8(vld1q_u8((const uint8_t*)&words[k])))));
+	total = vgetq_lane_u32(sum, 0) + vgetq_lane_u32(sum, 1) + vgetq_lane_u32(sum, 2) + vgetq_lane_u32(sum, 3);
+#endif
+	for(; k < n; k++)
+		total += popcount32(words[k]);
+	return total;
+}
+
+cv::Rect BitMask::boundingRect() const
+{
+	const int bytes = (ncols + 7) / 8;
+	int top = -1, bottom = -1, left = ncols, right = -1;
+	for(int i = 0; i < nrows; i++)
+	{
+		const quint32 *w = &words[i * stride];
+		int k = 0;
+		while(k < stride && w[k] == 0)
+			k++;
+		if(k == stride)
+			continue;
+		if(top < 0)
+			top = i;
+		bottom = i;
+		// Padding is zero, the first and the last non-zero bytes are inside the row
+		const uchar *b = line(i);
+		int first = 0, last = bytes - 1;
+		while(b[first] == 0)
+			first++;
+		while(b[last] == 0)
+			last--;
+		int bit = 0;
+		while(!(b[first] & (0x80 >> bit)))
+			bit++;
+		left = std::min(left, first * 8 + bit);
+		bit = 7;
+		while(!(b[last] & (0x80 >> bit)))
+			bit--;
+		right = std::max(right, last * 8 + bit);
+	}
+	if(top < 0)
+		return cv::Rect();
+	return cv::Rect(left, top, right - left + 1, bottom - top + 1);
+}
+
+void BitMask::clearBorder()
+{
+	if(empty())
+		return;
+	std::fill(words.begin(), words.begin() + stride, 0);
+	std::fill(words.end() - stride, words.end(), 0);
+	for(int i = 1; i < nrows - 1; i++)
+	{
+		set(i, 0, false);
+		set(i, ncols - 1, false);
+	}
+}
+
+void BitMask::invert()
+{
+	for(size_t k = 0; k < words.size(); k++)
+		words[k] = ~words[k];
+	clearPadding();
+}
+
+BitMask& BitMask::operator&=(const BitMask& other)
+{
+	CV_Assert(nrows == other.nrows && ncols == other.ncols);
+	for(size_t k = 0; k < words.size(); k++)
+		words[k] &= other.words[k];
+	return *this;
+}
+
+BitMask& BitMask::operator|=(const BitMask& other)
+{
+	CV_Assert(nrows == other.nrows && ncols == other.ncols);
+	for(size_t k = 0; k < words.size(); k++)
+		words[k] |= other.words[k];
+	return *this;
+}
+
+BitMask& BitMask::operator^=(const BitMask& other)
+{
+	CV_Assert(nrows == other.nrows && ncols == other.ncols);
+	for(size_t k = 0; k < words.size(); k++)
+		words[k] ^= other.words[k];
+	return *this;
+}
+
+cv::Mat BitMask::toMat() const
+{
+	cv::Mat mask = cv::Mat::zeros(nrows, ncols, CV_8UC1);
+	for(int i = 0; i < nrows; i++)
+	{
+		const uchar *b = line(i);
+		uchar *out = mask.ptr<uchar>(i);
+		for(int j = 0; j < ncols; j++)
+			if(b[j >> 3] & (0x80 >> (j & 7)))
+				out[j] = 255;
+	}
+	return mask;
+}
+
+// Bits past ncols stay zero so area and the word operations don't see them
+void BitMask::clearPadding()
+{
+	const int bytes = (ncols + 7) / 8;
+	const uchar lastMask = (ncols % 8) ? (uchar)(0xFF << (8 - ncols % 8)) : 0xFF;
+	for(int i = 0; i < nrows; i++)
+	{
+		uchar *b = line(i);
+		if(bytes > 0)
+			b[bytes - 1] &= lastMask;
+		for(int k = bytes; k < bytesPerLine(); k++)
+			b[k] = 0;
+	}
+}
+
+bool BitMask::saveBmp(const QString& fileName) const
+{
+	QFile file(fileName);
+	if(empty() || !file.open(QFile::WriteOnly))
+		return false;
+	const quint32 lineBytes = bytesPerLine();
+	const quint32 imageSize = lineBytes * nrows;
+	const quint32 offset = 14 + 40 + 2 * 4;
+	QDataStream out(&file);
+	out.setByteOrder(QDataStream::LittleEndian);
+	// BITMAPFILEHEADER
+	out << (quint8)'B' << (quint8)'M' << offset + imageSize << (quint16)0 << (quint16)0 << offset;
+	// BITMAPINFOHEADER, bottom-up rows, BI_RGB
+	out << (quint32)40 << (qint32)ncols << (qint32)nrows << (quint16)1 << (quint16)1 << (quint32)0
+		<< imageSize << (qint32)0 << (qint32)0 << (quint32)2 << (quint32)2;
+	// Palette 0 - black, 1 - white: set pixels are written as 0
+	out << (quint32)0x00000000 << (quint32)0x00FFFFFF;
+	std::vector<uchar> row(lineBytes);
+	for(int i = nrows - 1; i >= 0; i--)
+	{
+		const uchar *b = line(i);
+		for(quint32 k = 0; k < lineBytes; k++)
+			row[k] = ~b[k];
+		out.writeRawData((const char*)&row[0], lineBytes);
+	}
+	return out.status() == QDataStream::Ok;
+}
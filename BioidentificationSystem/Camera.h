@@ -19,10 +19,11 @@ public:
 		readFrameWarningSended(false) {}
 	bool isOpened() const
 		{ return cap.isOpened(); }
+	// Any thread: a copy of the current frame, which stays owned by the worker
 	cv::Mat getFrame() {
-		//frameMutex.lock();
+		frameMutex.lock();
 		cv::Mat retFrame = frame.clone();
-		//frameMutex.unlock();
+		frameMutex.unlock();
 		return retFrame;
 	}
 
@@ -38,20 +39,24 @@ protected:
 		return true;
 	}
 	bool takeFrame() {
-		//if(!frameMutex.tryLock())
-		//return true;
-		if(!cap.read(frame))
+		cv::Mat captured;
+		if(!cap.read(captured))
 		{
-			//frameMutex.unlock();
 			readFrameFails++;
 			if(readFrameFails == CRITICAL_READ_FRAME_FAILS)
 				return false;
 			return true;
 		}
-		//frameMutex.unlock();
+		setCurrentFrame(captured);
 		readFrameFails = 0;
 		return true;
 	}
+	// Worker thread: frame is only replaced under the lock getFrame copies it with
+	void setCurrentFrame(const cv::Mat& newFrame) {
+		frameMutex.lock();
+		frame = newFrame;
+		frameMutex.unlock();
+	}
 	void close() {
 		if(cap.isOpened())
 			cap.release();
@@ -0,0 +1,109 @@
+#include "Components.h"
+
+static int findRoot(std::vector<int>& parent, int x)
+{
+	while(parent[x] != x)
+	{
+		parent[x] = parent[parent[x]];
+		x = parent[x];
+	}
+	return x;
+}
+
+static int unite(std::vector<int>& parent, int a, int b)
+{
+	a = findRoot(parent, a);
+	b = findRoot(parent, b);
+	if(a < b)
+		parent[b] = a;
+	else
+		parent[a] = b;
+	return std::min(a, b);
+}
+
+int labelComponents(const cv::Mat& mask, cv::Mat& labels, std::vector<ComponentStats>& stats)
+{
+	CV_Assert(mask.type() == CV_8UC1);
+	labels = cv::Mat::zeros(mask.size(), CV_32SC1);
+	stats.clear();
+	if(mask.rows < 3 || mask.cols < 3)
+		return 0;
+
+	// Provisional labels with equivalences
+	std::vector<int> parent(1, 0);
+	for(int i = 1; i < mask.rows - 1; i++)
+	{
+		const uchar *m = mask.ptr<uchar>(i);
+		int *l = labels.ptr<int>(i);
+		const int *up = labels.ptr<int>(i - 1);
+		for(int j = 1; j < mask.cols - 1; j++)
+		{
+			if(!m[j])
+				continue;
+			int label = 0;
+			const int neighbours[4] = { l[j - 1], up[j - 1], up[j], up[j + 1] };
+			for(int n = 0; n < 4; n++)
+			{
+				if(!neighbours[n])
+					continue;
+				label = label ? unite(parent, label, neighbours[n]) : neighbours[n];
+			}
+			if(!label)
+			{
+				label = (int)parent.size();
+				parent.push_back(label);
+			}
+			l[j] = label;
+		}
+	}
+
+	// Compact roots to 1..N
+	std::vector<int> compact(parent.size(), 0);
+	int count = 0;
+	for(size_t k = 1; k < parent.size(); k++)
+	{
+		int root = findRoot(parent, (int)k);
+		if(root == (int)k)
+			compact[k] = ++count;
+	}
+	std::vector<cv::Vec4i> bounds(count, cv::Vec4i(mask.cols, mask.rows, -1, -1));
+	stats.resize(count);
+	for(int i = 1; i < mask.rows - 1; i++)
+	{
+		int *l = labels.ptr<int>(i);
+		for(int j = 1; j < mask.cols - 1; j++)
+		{
+			if(!l[j])
+				continue;
+			int label = compact[findRoot(parent, l[j])];
+			l[j] = label;
+			cv::Vec4i& b = bounds[label - 1];
+			b[0] = std::min(b[0], j);
+			b[1] = std::min(b[1], i);
+			b[2] = std::max(b[2], j);
+			b[3] = std::max(b[3], i);
+			stats[label - 1].area++;
+		}
+	}
+	for(int k = 0; k < count; k++)
+		stats[k].bbox = cv::Rect(bounds[k][0], bounds[k][1], bounds[k][2] - bounds[k][0] + 1, bounds[k][3] - bounds[k][1] + 1);
+	return count;
+}
+
+std::vector<cv::Point> componentContour(const cv::Mat& labels, int label, const cv::Rect& bbox)
+{
+	// 1-pixel zero frame, findContours ignores the image border
+	cv::Mat component = cv::Mat::zeros(bbox.height + 2, bbox.width + 2, CV_8UC1);
+	for(int i = 0; i < bbox.height; i++)
+	{
+		const int *l = labels.ptr<int>(bbox.y + i) + bbox.x;
+		uchar *c = component.ptr<uchar>(i + 1) + 1;
+		for(int j = 0; j < bbox.width; j++)
+			c[j] = (l[j] == label) ? 255 : 0;
+	}
+	std::vector<std::vector<cv::Point> > contours;
+	cv::findContours(component, contours, CV_RETR_EXTERNAL, CV_CHAIN_APPROX_NONE, bbox.tl() - cv::Point(1, 1));
+	if(contours.empty())
+		return std::vector<cv::Point>();
+	return contours[0];
+}
@@ -0,0 +1,22 @@
+#ifndef COMPONENTS_H
+#define COMPONENTS_H
+
+#include "general.h"
+
+struct ComponentStats
+{
+	ComponentStats()
+		: area(0) {}
+	cv::Rect bbox;
+	int area;
+};
+
+// 8-connected components of a binary mask (non-zero = foreground) in one labeling pass.
+// labels: CV_32SC1, 0 - background, component k has label k + 1 and stats[k].
+// Like findContours, the 1-pixel image border is treated as background and mask is not modified.
+int labelComponents(const cv::Mat& mask, cv::Mat& labels, std::vector<ComponentStats>& stats);
+
+// Outer contour of one component, traced only inside its bounding box. Points are in image coordinates.
+std::vector<cv::Point> componentContour(const cv::Mat& labels, int label, const cv::Rect& bbox);
+
+#endif // COMPONENTS_H
@@ -0,0 +1,126 @@
+#include <QDir>
+#include <QFileInfo>
+#include <QtConcurrentMap>
+
+#include "Enrollment.h"
+#include "Components.h"
+#include "HandShape.h"
+#include "SkinColorModel.h"
+
+Enrollment::Enrollment(QObject *parent)
+	: QObject(parent),
+	elapsedMs(0)
+{
+	watcher = new QFutureWatcher<void>(this);
+	connect(watcher, SIGNAL(progressValueChanged(int)), this, SLOT(encoded()));
+	connect(watcher, SIGNAL(finished()), this, SLOT(encoded()));
+}
+
+Enrollment::~Enrollment()
+{
+	watcher->waitForFinished();
+}
+
+int Enrollment::start(const QString& dir, const EnrollmentParams& params)
+{
+	if(isRunning())
+		return 0;
+	this->params = params;
+	items.clear();
+	QDir photoDir(dir);
+	// Identity per subdirectory, then loose photos named by identity
+	QStringList identities = photoDir.entryList(QDir::Dirs | QDir::NoDotAndDotDot, QDir::Name);
+	foreach(const QString& identity, identities)
+	{
+		QDir identityDir(photoDir.filePath(identity));
+		foreach(const QString& photo, identityDir.entryList(IMAGE_FORMAT, QDir::Files | QDir::Readable, QDir::Name))
+		{
+			EnrollmentItem item;
+			item.identity = identity;
+			item.fileName = identityDir.filePath(photo);
+			items.push_back(item);
+		}
+	}
+	foreach(const QString& photo, photoDir.entryList(IMAGE_FORMAT, QDir::Files | QDir::Readable, QDir::Name))
+	{
+		EnrollmentItem item;
+		item.identity = QFileInfo(photo).completeBaseName();
+		item.fileName = photoDir.filePath(photo);
+		items.push_back(item);
+	}
+	if(items.empty())
+		return 0;
+	for(size_t k = 0; k < items.size(); k++)
+	{
+		items[k].params = &this->params;
+		items[k].workDir = HANDS_COMPARE_DIR + ENROLLMENT_WORK_DIR + QString::number(k) + "/";
+	}
+	timer.start();
+	watcher->setFuture(QtConcurrent::map(items, &Enrollment::encode));
+	return (int)items.size();
+}
+
+double Enrollment::throughput() const
+{
+	return (elapsedMs > 0) ? items.size() * 1000.0 / elapsedMs : 0;
+}
+
+void Enrollment::encoded()
+{
+	if(watcher->isFinished())
+	{
+		elapsedMs = timer.elapsed();
+		QDir(HANDS_COMPARE_DIR).rmdir(ENROLLMENT_WORK_DIR);
+		emit finished();
+	} else
+		emit progress(watcher->progressValue(), watcher->progressMaximum());
+}
+
+void Enrollment::encode(EnrollmentItem& item)
+{
+	const EnrollmentParams& params = *item.params;
+	cv::Mat image = loadImage(item.fileName);
+	if(image.data == NULL || image.type() != CV_8UC3)
+	{
+		item.error = "can't read image";
+		return;
+	}
+
+	// PIXEL_RECOGNITION
+	cv::Mat skin = SkinColorModel::classifyImage(image, params.skinLut);
+
+	// HAND_RECOGNITION: the largest candidate is the hand
+	cv::Mat labels;
+	std::vector<ComponentStats> components;
+	labelComponents(skin, labels, components);
+	int hand = -1;
+	for(size_t k = 0; k < components.size(); k++)
+		if(components[k].bbox.width > MIN_WH && components[k].bbox.height > MIN_WH &&
+			(hand < 0 || components[k].area > components[hand].area))
+			hand = (int)k;
+	if(hand < 0)
+	{
+		item.error = "no hand found";
+		return;
+	}
+	std::vector<cv::Point> contour = componentContour(labels, hand + 1, components[hand].bbox);
+	if(params.bend)
+		contour = bendContour(contour, handCannyEdges(image, params.lowThreshold, params.ratio, params.aperture), params.cannyContourMergeEps);
+	cv::Mat applicant = handApplicant(contour, image.size());
+
+	QDir workDir(item.workDir);
+	if(!workDir.mkpath("."))
+	{
+		item.error = "can't create " + item.workDir;
+		return;
+	}
+	try {
+		item.seq = encodeHand(applicant, item.workDir);
+		item.mask = applicant;
+	} catch(std::exception &e) {
+		item.error = e.what();
+	}
+	foreach(const QString& entry, workDir.entryList(QDir::Files))
+		workDir.remove(entry);
+	workDir.rmdir(workDir.absolutePath());
+}
@@ -0,0 +1,72 @@
+#ifndef ENROLLMENT_H
+#define ENROLLMENT_H
+
+#include <QObject>
+#include <QFutureWatcher>
+#include <QTime>
+
+#include "general.h"
+#include "SequenceCompare.h"
+
+// Processing of one enrollment photo, as HAND_RECOGNITION does for a frame
+struct EnrollmentParams
+{
+	cv::Mat skinLut; // SkinColorModel LUT
+	int lowThreshold;
+	int ratio;
+	int aperture;
+	int cannyContourMergeEps;
+	bool bend;
+};
+
+struct EnrollmentItem
+{
+	QString identity;
+	QString fileName;
+	QString workDir; // Own BmpToSeq dir, so items are encoded in parallel
+	const EnrollmentParams *params;
+	cv::Mat mask; // Normalized hand, empty on failure
+	ShapeSequence seq;
+	QString error;
+};
+
+// Bulk enrollment of a photo directory: <dir>/<identity>/<photos> or <dir>/<identity>.<ext>.
+// Photos are segmented and encoded on the global thread pool, results are collected by the owner.
+class Enrollment : public QObject
+{
+	Q_OBJECT
+
+public:
+	Enrollment(QObject *parent = 0);
+	~Enrollment();
+
+	bool isRunning() const
+		{ return watcher->isRunning(); }
+	// Number of photos found, 0 - nothing to do
+	int start(const QString& dir, const EnrollmentParams& params);
+
+	const std::vector<EnrollmentItem>& getItems() const
+		{ return items; }
+	// Encoded photos per second, for the last run
+	double throughput() const;
+	int elapsed() const
+		{ return elapsedMs; }
+
+signals:
+	void progress(int done, int total);
+	void finished();
+
+private slots:
+	void encoded();
+
+private:
+	static void encode(EnrollmentItem& item);
+
+	QFutureWatcher<void> *watcher;
+	std::vector<EnrollmentItem> items;
+	EnrollmentParams params;
+	QTime timer;
+	int elapsedMs;
+};
+
+#endif // ENROLLMENT_H
@@ -0,0 +1,248 @@
+#include <time.h>
+#include <QFile>
+#include <QTextStream>
+#include <QTime>
+
+#include "FaceDetector.h"
+
+// Loaded cascades not in use by a detection
+class CascadePool
+{
+public:
+	~CascadePool()
+	{
+		for(size_t k = 0; k < idle.size(); k++)
+			delete idle[k];
+	}
+	cv::CascadeClassifier* take()
+	{
+		QMutexLocker locker(&mutex);
+		if(!idle.empty()) {
+			cv::CascadeClassifier *cascade = idle.back();
+			idle.pop_back();
+			return cascade;
+		}
+		locker.unlock();
+		cv::CascadeClassifier *cascade = new cv::CascadeClassifier();
+		cascade->load(FACE_CASCADE_NAME.toStdString());
+		return cascade;
+	}
+	void give(cv::CascadeClassifier *cascade)
+	{
+		QMutexLocker locker(&mutex);
+		idle.push_back(cascade);
+	}
+
+private:
+	QMutex mutex;
+	std::vector<cv::CascadeClassifier*> idle;
+};
+
+static CascadePool cascades;
+
+bool FaceDetector::detect(const cv::Mat& gray, std::vector<cv::Rect>& faces, cv::Size maxSize)
+{
+	faces.clear();
+	cv::CascadeClassifier *cascade = cascades.take();
+	bool loaded = !cascade->empty();
+	if(loaded) {
+		try {
+			cascade->detectMultiScale(gray, faces, 1.1, 2, 0|cv::CASCADE_SCALE_IMAGE, cv::Size(30, 30), maxSize);
+		} catch(cv::Exception& e) {
+			qDebug() << e.what();
+		}
+	}
+	cascades.give(cascade);
+	return loaded;
+}
+
+bool FaceDetector::detect(const cv::Mat& gray, const cv::Rect& roi, std::vector<cv::Rect>& faces)
+{
+	bool loaded = detect(gray(roi), faces);
+	for(size_t k = 0; k < faces.size(); k++)
+		faces[k] += roi.tl();
+	return loaded;
+}
+
+bool FaceDetector::detectBatch(const std::vector<cv::Mat>& images, const std::vector<cv::Rect>& rois,
+	std::vector<std::vector<cv::Rect> >& faces)
+{
+	faces.assign(images.size(), std::vector<cv::Rect>());
+	if(images.empty())
+		return true;
+	if(images.size() == 1)
+		return detect(images[0], rois[0], faces[0]);
+
+	// Shelves left to right, a new one when the row is full
+	std::vector<cv::Rect> tiles;
+	cv::Size largest(0, 0);
+	int mosaicWidth = FACE_BATCH_MOSAIC_WIDTH;
+	for(size_t k = 0; k < rois.size(); k++)
+	{
+		mosaicWidth = std::max(mosaicWidth, rois[k].width);
+		largest = cv::Size(std::max(largest.width, rois[k].width), std::max(largest.height, rois[k].height));
+	}
+	cv::Point position(0, 0);
+	int shelfHeight = 0;
+	for(size_t k = 0; k < rois.size(); k++)
+	{
+		if(position.x + rois[k].width > mosaicWidth) {
+			position = cv::Point(0, position.y + shelfHeight + FACE_BATCH_GAP);
+			shelfHeight = 0;
+		}
+		tiles.push_back(cv::Rect(position, rois[k].size()));
+		position.x += rois[k].width + FACE_BATCH_GAP;
+		shelfHeight = std::max(shelfHeight, rois[k].height);
+	}
+	cv::Mat mosaic = cv::Mat::zeros(position.y + shelfHeight, mosaicWidth, CV_8UC1);
+	for(size_t k = 0; k < rois.size(); k++)
+		images[k](rois[k]).copyTo(mosaic(tiles[k]));
+
+	std::vector<cv::Rect> detected;
+	if(!detect(mosaic, detected, largest))
+		return false;
+	for(size_t d = 0; d < detected.size(); d++)
+		for(size_t k = 0; k < tiles.size(); k++)
+			if((detected[d] & tiles[k]) == detected[d]) {
+				faces[k].push_back(detected[d] - tiles[k].tl() + rois[k].tl());
+				break;
+			}
+	return true;
+}
+
+bool FaceBatcher::detect(const cv::Mat& gray, const cv::Rect& roi, std::vector<cv::Rect>& faces)
+{
+	Request request;
+	request.gray = &gray;
+	request.roi = roi;
+	request.loaded = false;
+	request.taken = false;
+	request.done = false;
+	QTime waited;
+	waited.start();
+	mutex.lock();
+	pending.push_back(&request);
+	while(!request.done)
+	{
+		int left = FACE_BATCH_WAIT - waited.elapsed();
+		if(!request.taken && ((int)pending.size() >= expected || left <= 0)) {
+			// Takes whatever is pending, this request among them, detects without the lock
+			std::vector<Request*> batch;
+			batch.swap(pending);
+			for(size_t k = 0; k < batch.size(); k++)
+				batch[k]->taken = true;
+			mutex.unlock();
+			run(batch);
+			mutex.lock();
+			for(size_t k = 0; k < batch.size(); k++)
+				batch[k]->done = true;
+			batchDone.wakeAll();
+		} else if(request.taken)
+			batchDone.wait(&mutex);
+		else
+			batchDone.wait(&mutex, left);
+	}
+	mutex.unlock();
+	faces = request.faces;
+	return request.loaded;
+}
+
+void FaceBatcher::run(std::vector<Request*>& batch)
+{
+	std::vector<cv::Mat> images;
+	std::vector<cv::Rect> rois;
+	for(size_t k = 0; k < batch.size(); k++)
+	{
+		images.push_back(*batch[k]->gray);
+		rois.push_back(batch[k]->roi);
+	}
+	std::vector<std::vector<cv::Rect> > faces;
+	bool loaded = FaceDetector::detectBatch(images, rois, faces);
+	for(size_t k = 0; k < batch.size(); k++)
+	{
+		batch[k]->faces = faces[k];
+		batch[k]->loaded = loaded;
+	}
+}
+
+// Faces of found without one overlapping by FACE_TRACK_OVERLAP in other
+static int unmatchedFaces(const std::vector<cv::Rect>& found, const std::vector<cv::Rect>& other)
+{
+	int unmatched = 0;
+	for(size_t i = 0; i < found.size(); i++)
+	{
+		bool matched = false;
+		for(size_t j = 0; j < other.size() && !matched; j++)
+		{
+			double intersection = (found[i] & other[j]).area();
+			matched = intersection / (found[i].area() + other[j].area() - intersection) >= FACE_TRACK_OVERLAP;
+		}
+		if(!matched)
+			unmatched++;
+	}
+	return unmatched;
+}
+
+int benchmarkFaceBatching(const QString& videoName, int frames, int batch)
+{
+	cv::VideoCapture capture(videoName.toStdString());
+	if(!capture.isOpened())
+		return -1;
+	batch = std::max(1, batch);
+	std::vector<cv::Mat> images;
+	std::vector<cv::Rect> rois;
+	int read = 0, passes = 0, separateFaces = 0, batchedFaces = 0, differing = 0;
+	clock_t separateTicks = 0, batchedTicks = 0;
+	cv::Mat frame;
+	while(read < frames && capture.read(frame))
+	{
+		read++;
+		cv::Mat gray;
+		toGray(frame, gray);
+		cv::equalizeHist(gray, gray);
+		// ROIs around the faces of the whole frame, as a stream tracks them
+		std::vector<cv::Rect> tracked;
+		FaceDetector::detect(gray, tracked);
+		for(size_t k = 0; k < tracked.size(); k++)
+		{
+			int dx = cvRound(tracked[k].width * FACE_ROI_MARGIN);
+			int dy = cvRound(tracked[k].height * FACE_ROI_MARGIN);
+			images.push_back(gray);
+			rois.push_back(cv::Rect(tracked[k].x - dx, tracked[k].y - dy, tracked[k].width + 2*dx, tracked[k].height + 2*dy) &
+				cv::Rect(0, 0, gray.cols, gray.rows));
+		}
+		if(read % batch != 0 || rois.empty())
+			continue;
+
+		std::vector<std::vector<cv::Rect> > separate(rois.size()), batched;
+		clock_t startTime = clock();
+		for(size_t k = 0; k < rois.size(); k++)
+			FaceDetector::detect(images[k], rois[k], separate[k]);
+		separateTicks += clock() - startTime;
+		startTime = clock();
+		FaceDetector::detectBatch(images, rois, batched);
+		batchedTicks += clock() - startTime;
+		passes++;
+		for(size_t k = 0; k < rois.size(); k++)
+		{
+			separateFaces += (int)separate[k].size();
+			batchedFaces += (int)batched[k].size();
+			differing += unmatchedFaces(separate[k], batched[k]) + unmatchedFaces(batched[k], separate[k]);
+		}
+		images.clear();
+		rois.clear();
+	}
+
+	QFile reportFile(FACE_BATCH_REPORT);
+	if(reportFile.open(QFile::WriteOnly | QFile::Text))
+	{
+		QTextStream out(&reportFile);
+		out << videoName << ", " << read << " frames, batches of " << batch << " frames, " << passes << " batches\n";
+		out << "separate passes: " << QString::number(1000.f * separateTicks / CLOCKS_PER_SEC, 'f', 2) << " ms, "
+			<< separateFaces << " faces\n";
+		out << "batched: " << QString::number(1000.f * batchedTicks / CLOCKS_PER_SEC, 'f', 2) << " ms, "
+			<< batchedFaces << " faces\n";
+		out << "faces found one way only: " << differing << "\n";
+	}
+	return differing;
+}
@@ -0,0 +1,63 @@
+#ifndef FACEDETECTOR_H
+#define FACEDETECTOR_H
+
+#include <QMutex>
+#include <QWaitCondition>
+
+#include "general.h"
+
+// Haar face detection from any thread. cv::CascadeClassifier keeps scratch buffers
+// and isn't thread safe, so a detection takes a loaded FACE_CASCADE_NAME for itself
+// from a process-wide pool; cascades are loaded once and outlive the threads using them.
+// Images are equalized gray frames.
+class FaceDetector
+{
+public:
+	// false if the cascade can't be loaded. Faces larger than maxSize aren't searched for.
+	static bool detect(const cv::Mat& gray, std::vector<cv::Rect>& faces, cv::Size maxSize = cv::Size());
+	// Only inside roi, faces are in gray coordinates
+	static bool detect(const cv::Mat& gray, const cv::Rect& roi, std::vector<cv::Rect>& faces);
+	// One detectMultiScale over a mosaic of the ROIs, so the pyramid is built once for all of them,
+	// up to the scale of the largest ROI as separate passes go. faces[k] are in coordinates of
+	// images[k], only faces wholly inside their tile are kept.
+	static bool detectBatch(const std::vector<cv::Mat>& images, const std::vector<cv::Rect>& rois,
+		std::vector<std::vector<cv::Rect> >& faces);
+};
+
+// Batches ROI detections of frames processed at the same time (FACE_BATCHING). A caller waits up to
+// FACE_BATCH_WAIT ms for others; the one that fills the batch, or times out while its request
+// is still pending, runs it for all. Callers of a running batch wait for it to finish.
+class FaceBatcher
+{
+public:
+	FaceBatcher()
+		: expected(1) {}
+	// Callers expected at once, usually the streams in flight
+	void setExpected(int expected)
+		{ this->expected = std::max(1, expected); }
+	bool detect(const cv::Mat& gray, const cv::Rect& roi, std::vector<cv::Rect>& faces);
+
+private:
+	struct Request
+	{
+		const cv::Mat *gray;
+		cv::Rect roi;
+		std::vector<cv::Rect> faces;
+		bool loaded;
+		bool taken; // In a running batch
+		bool done;
+	};
+	static void run(std::vector<Request*>& batch);
+
+	QMutex mutex;
+	QWaitCondition batchDone;
+	std::vector<Request*> pending;
+	int expected;
+};
+
+// Tracked face ROIs of up to frames video frames, in groups of batch frames as streams in flight
+// would have them: separate passes against detectBatch. Writes times and the faces found by
+// one and not the other to FACE_BATCH_REPORT. Returns those faces, -1 if the video can't be opened.
+int benchmarkFaceBatching(const QString& videoName, int frames, int batch);
+
+#endif // FACEDETECTOR_H
@@ -0,0 +1,257 @@
+#include <QDateTime>
+#include <QCoreApplication>
+#include <QAtomicInt>
+
+#include "FrameRing.h"
+
+static const quint32 FRAME_RING_MAGIC = 0x32464850; // "PHF2", with reader heartbeats
+
+static QString wakeupKey(const QString& name, int reader)
+{
+	return name + "-wake" + QString::number(reader);
+}
+
+static FrameSlot* slotAt(FrameRingHeader *header, quint32 sequence)
+{
+	char *slots = (char*)header + sizeof(FrameRingHeader);
+	return (FrameSlot*)(slots + ((sequence - 1) % header->slotCount) * (sizeof(FrameSlot) + header->slotBytes));
+}
+
+static quint32 heartbeatNow()
+{
+	return (quint32)QDateTime::currentMSecsSinceEpoch();
+}
+
+// Clears the bits of readers silent for FRAME_RING_READER_TIMEOUT, under the QSharedMemory lock
+static void reclaimReaders(FrameRingHeader *header)
+{
+	quint32 now = heartbeatNow();
+	for(int k = 0; k < FRAME_RING_READERS; k++)
+		if((header->readers & (1u << k)) && now - header->heartbeats[k] > (quint32)FRAME_RING_READER_TIMEOUT)
+			header->readers &= ~(1u << k);
+}
+
+// First free bit, beating, -1 if there is none. Under the QSharedMemory lock.
+static int takeReader(FrameRingHeader *header, quint32 token)
+{
+	for(int k = 0; k < FRAME_RING_READERS; k++)
+		if(!(header->readers & (1u << k))) {
+			header->heartbeats[k] = heartbeatNow();
+			header->owners[k] = token;
+			header->readers |= 1u << k;
+			return k;
+		}
+	return -1;
+}
+
+static bool holdsReader(FrameRingHeader *header, int reader, quint32 token)
+{
+	return (header->readers & (1u << reader)) && header->owners[reader] == token;
+}
+
+static QAtomicInt readerCount;
+
+FrameRingWriter::FrameRingWriter()
+	: sequence(0)
+{
+}
+
+FrameRingWriter::~FrameRingWriter()
+{
+	close();
+}
+
+bool FrameRingWriter::create(const QString& name, int slotBytes, int slotCount)
+{
+	close();
+	slotBytes = (slotBytes + 15) & ~15;
+	memory.setKey(name);
+	if(!memory.create(sizeof(FrameRingHeader) + slotCount * (sizeof(FrameSlot) + slotBytes)))
+		return false;
+	memory.lock();
+	FrameRingHeader *header = (FrameRingHeader*)memory.data();
+	memset(header, 0, sizeof(FrameRingHeader));
+	header->slotCount = slotCount;
+	header->slotBytes = slotBytes;
+	for(int k = 1; k <= slotCount; k++)
+		slotAt(header, k)->sequence = 0;
+	header->magic = FRAME_RING_MAGIC;
+	memory.unlock();
+	for(int k = 0; k < FRAME_RING_READERS; k++)
+		wakeups.push_back(new QSystemSemaphore(wakeupKey(name, k), 0, QSystemSemaphore::Create));
+	sequence = 0;
+	return true;
+}
+
+void FrameRingWriter::close()
+{
+	for(size_t k = 0; k < wakeups.size(); k++)
+		delete wakeups[k];
+	wakeups.clear();
+	if(memory.isAttached())
+		memory.detach();
+}
+
+bool FrameRingWriter::write(const cv::Mat& frame)
+{
+	if(!memory.isAttached())
+		return false;
+	FrameRingHeader *header = (FrameRingHeader*)memory.data();
+	size_t rowBytes = frame.cols * frame.elemSize();
+	if(rowBytes * frame.rows > header->slotBytes)
+		return false;
+	if(++sequence == 0)
+		sequence = 1;
+	FrameSlot *slot = slotAt(header, sequence);
+	slot->sequence = 0;
+	uchar *pixels = (uchar*)slot + sizeof(FrameSlot);
+	for(int i = 0; i < frame.rows; i++)
+		memcpy(pixels + i * rowBytes, frame.ptr(i), rowBytes);
+	slot->rows = frame.rows;
+	slot->cols = frame.cols;
+	slot->type = frame.type();
+	slot->timestamp = QDateTime::currentMSecsSinceEpoch();
+	slot->sequence = sequence;
+	header->published = sequence;
+
+	memory.lock();
+	reclaimReaders(header);
+	quint32 readers = header->readers;
+	memory.unlock();
+	for(int k = 0; k < FRAME_RING_READERS; k++)
+		if(readers & (1u << k))
+			wakeups[k]->release();
+	return true;
+}
+
+FrameRingReader::FrameRingReader()
+	: wakeup(NULL), token(0), reader(-1), last(0), woken(false), received(0), skipped(0), torn(0)
+{
+}
+
+FrameRingReader::~FrameRingReader()
+{
+	detach();
+}
+
+bool FrameRingReader::attach(const QString& name)
+{
+	detach();
+	memory.setKey(name);
+	if(!memory.attach())
+		return false;
+	memory.lock();
+	FrameRingHeader *header = this->header();
+	if(header->magic == FRAME_RING_MAGIC) {
+		reclaimReaders(header);
+		token = ((quint32)QCoreApplication::applicationPid() << 8) ^ (quint32)readerCount.fetchAndAddOrdered(1);
+		reader = takeReader(header, token);
+	}
+	last = header->published;
+	memory.unlock();
+	if(reader < 0)
+	{
+		memory.detach();
+		return false;
+	}
+	wakeupMutex.lock();
+	wakeup = new QSystemSemaphore(wakeupKey(name, reader), 0, QSystemSemaphore::Open);
+	wakeupMutex.unlock();
+	this->name = name;
+	woken = false;
+	received = skipped = torn = 0;
+	return true;
+}
+
+void FrameRingReader::detach()
+{
+	if(!memory.isAttached())
+		return;
+	if(reader >= 0)
+	{
+		// Not if it was reclaimed and someone else took it meanwhile
+		memory.lock();
+		if(holdsReader(header(), reader, token))
+			header()->readers &= ~(1u << reader);
+		memory.unlock();
+		reader = -1;
+	}
+	wakeupMutex.lock();
+	delete wakeup;
+	wakeup = NULL;
+	wakeupMutex.unlock();
+	memory.detach();
+}
+
+FrameSlot* FrameRingReader::slot(quint32 sequence) const
+{
+	return slotAt(header(), sequence);
+}
+
+bool FrameRingReader::keepAlive()
+{
+	FrameRingHeader *header = this->header();
+	if(holdsReader(header, reader, token)) {
+		header->heartbeats[reader] = heartbeatNow();
+		return true;
+	}
+	// Silent too long (a debugger, a long stall): the bit was reclaimed, its wakeup may be someone else's
+	memory.lock();
+	int taken = takeReader(header, token);
+	memory.unlock();
+	if(taken < 0)
+		return false;
+	QSystemSemaphore *renewed = new QSystemSemaphore(wakeupKey(name, taken), 0, QSystemSemaphore::Open);
+	wakeupMutex.lock();
+	delete wakeup;
+	wakeup = renewed;
+	wakeupMutex.unlock();
+	reader = taken;
+	return true;
+}
+
+bool FrameRingReader::next(cv::Mat& frame)
+{
+	if(!isAttached())
+		return false;
+	while(!woken)
+	{
+		if(!keepAlive())
+			return false;
+		quint32 published = header()->published;
+		if(published != 0 && published != last)
+		{
+			FrameSlot *newest = slot(published);
+			// Header read while the producer already reuses the slot: take the next one
+			if(newest->sequence != published)
+				continue;
+			int rows = newest->rows, cols = newest->cols, type = newest->type;
+			if(rows <= 0 || cols <= 0 || (qint64)rows * cols * CV_ELEM_SIZE(type) > header()->slotBytes)
+				return false;
+			cv::Mat copied = cv::Mat(rows, cols, type, (uchar*)newest + sizeof(FrameSlot)).clone();
+			// Overwritten while being copied: the copy may be torn
+			if(newest->sequence != published) {
+				torn++;
+				continue;
+			}
+			if(last != 0)
+				skipped += published - last - 1;
+			last = published;
+			received++;
+			frame = copied;
+			return true;
+		}
+		wakeup->acquire();
+	}
+	woken = false;
+	return false;
+}
+
+void FrameRingReader::wake()
+{
+	woken = true;
+	wakeupMutex.lock();
+	if(wakeup != NULL)
+		wakeup->release();
+	wakeupMutex.unlock();
+}
@@ -0,0 +1,101 @@
+#ifndef FRAMERING_H
+#define FRAMERING_H
+
+#include <QSharedMemory>
+#include <QSystemSemaphore>
+#include <QMutex>
+
+#include "general.h"
+
+// Frames of a local producer in shared memory: FrameRingHeader, then slotCount slots of
+// FrameSlot + pixels. Slot of sequence s is (s - 1) % slotCount, sequence 0 - being written.
+// Every attached reader has its own system semaphore the producer releases per frame and
+// a heartbeat; the producer and attaching readers reclaim the bits of readers that stopped
+// beating (crashed), a reader found reclaimed takes a bit again on its next frame.
+// Fields written by one side and read by the other are volatile, which MSVC
+// compiles to release stores and acquire loads.
+struct FrameRingHeader
+{
+	quint32 magic;
+	quint32 slotCount;
+	quint32 slotBytes; // Pixel bytes of a slot, 16 aligned
+	volatile quint32 readers; // Bit per attached reader, changed under the QSharedMemory lock
+	volatile quint32 published; // Newest complete frame, 0 - none yet
+	quint32 reserved[3];
+	volatile quint32 heartbeats[FRAME_RING_READERS]; // Low 32 bits of ms since epoch, per reader bit
+	volatile quint32 owners[FRAME_RING_READERS]; // Token of the reader holding the bit
+};
+
+struct FrameSlot
+{
+	volatile quint32 sequence;
+	qint32 rows;
+	qint32 cols;
+	qint32 type;
+	qint64 timestamp; // ms since epoch
+	quint32 reserved[2];
+};
+
+class FrameRingWriter
+{
+public:
+	FrameRingWriter();
+	~FrameRingWriter();
+	bool create(const QString& name, int slotBytes, int slotCount = FRAME_RING_SLOTS);
+	void close();
+	// Copies frame into the next slot and wakes the readers, false if it doesn't fit
+	bool write(const cv::Mat& frame);
+	QString errorString() const
+		{ return memory.errorString(); }
+
+private:
+	QSharedMemory memory;
+	std::vector<QSystemSemaphore*> wakeups;
+	quint32 sequence;
+};
+
+class FrameRingReader
+{
+public:
+	FrameRingReader();
+	~FrameRingReader();
+	bool attach(const QString& name);
+	void detach();
+	bool isAttached() const
+		{ return wakeup != NULL; }
+	// Waits for a frame newer than the last one and copies it out of its slot; a copy the
+	// producer overwrote meanwhile is dropped for the next frame.
+	// Returns false after wake() or if the ring is broken.
+	bool next(cv::Mat& frame);
+	// Any thread: a blocked or the next next() returns false
+	void wake();
+	int frames() const
+		{ return received; }
+	// Frames the reader was too slow for
+	int dropped() const
+		{ return skipped; }
+	// Frames the producer overwrote while the reader copied them
+	int overwritten() const
+		{ return torn; }
+
+private:
+	FrameRingHeader* header() const
+		{ return (FrameRingHeader*)memory.data(); }
+	FrameSlot* slot(quint32 sequence) const;
+	// Beats, takes a bit again if it was reclaimed meanwhile, false if none is free
+	bool keepAlive();
+
+	QSharedMemory memory;
+	QSystemSemaphore *wakeup;
+	QMutex wakeupMutex; // wake() against detach(), next() runs on the detaching thread
+	QString name;
+	quint32 token; // Process id and reader number, tells a reclaimed bit from a held one
+	int reader;
+	quint32 last;
+	volatile bool woken;
+	int received;
+	int skipped;
+	int torn;
+};
+
+#endif // FRAMERING_H
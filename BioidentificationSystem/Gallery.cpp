@@ -0,0 +1,222 @@
+#include <QDir>
+#include <QFileInfo>
+
+#include "Gallery.h"
+
+std::vector<float> handDescriptor(const cv::Mat& mask)
+{
+	std::vector<float> descriptor(HAND_DESCRIPTOR_SIZE, 0.f);
+	cv::Mat gray;
+	if(mask.channels() == 3)
+		cv::cvtColor(mask, gray, CV_BGR2GRAY);
+	else
+		gray = mask.clone();
+	std::vector<std::vector<cv::Point> > contours;
+	cv::findContours(gray.clone(), contours, CV_RETR_EXTERNAL, CV_CHAIN_APPROX_NONE);
+	if(contours.empty())
+		return descriptor;
+	int largest = 0;
+	for(size_t k = 1; k < contours.size(); k++)
+		if(contours[k].size() > contours[largest].size())
+			largest = (int)k;
+	cv::Rect bbox = cv::boundingRect(contours[largest]);
+
+	// Fingers: convexity defects deeper than a fifth of the hand height
+	int fingers = 0;
+	if(contours[largest].size() > 3)
+	{
+		std::vector<int> hull;
+		std::vector<cv::Vec4i> defects;
+		cv::convexHull(contours[largest], hull, false, false);
+		if(hull.size() > 3)
+			cv::convexityDefects(contours[largest], hull, defects);
+		foreach(const cv::Vec4i& defect, defects)
+			if(defect[3] / 256.0 > bbox.height * 0.2)
+				fingers++;
+		fingers = std::min(fingers + 1, 5);
+	}
+
+	cv::Moments moments = cv::moments(gray, true);
+	double hu[7];
+	cv::HuMoments(moments, hu);
+	descriptor[0] = (float)(moments.m00 / bbox.area());
+	descriptor[1] = (float)bbox.width / bbox.height;
+	descriptor[2] = fingers / 5.f;
+	for(int k = 0; k < 7; k++)
+		descriptor[3 + k] = (hu[k] == 0) ? 0.f : (float)(-(hu[k] > 0 ? 1 : -1) * log10(fabs(hu[k])) / 10);
+	return descriptor;
+}
+
+Gallery::Gallery()
+	: indexed(false) {}
+
+int Gallery::load(const QString& dir)
+{
+	descriptors.release();
+	resetIndex();
+	if(!QDir(dir).exists() || !store.open(dir, HAND_DESCRIPTOR_SIZE))
+		return 0;
+	flannName = QDir(dir).filePath(GALLERY_FLANN_NAME);
+	if(store.size() == 0) {
+		// A saved descriptor index belongs to a previous log
+		QFile::remove(flannName);
+		import(dir);
+	}
+	// The store's mapped table, no record is read
+	descriptors = store.descriptors();
+	return size();
+}
+
+int Gallery::import(const QString& dir)
+{
+	QDir galleryDir(dir);
+	QStringList seqFiles = galleryDir.entryList(QStringList() << "*.seq", QDir::Files | QDir::Readable, QDir::Name);
+	int imported = 0;
+	foreach(const QString& seqFile, seqFiles)
+	{
+		QString identity = QFileInfo(seqFile).completeBaseName();
+		ShapeSequence seq;
+		cv::Mat mask = loadImage(galleryDir.filePath(identity + ".bmp"));
+		if(mask.data == NULL || !loadSequence(galleryDir.filePath(seqFile), seq))
+			continue;
+		if(add(identity, seq, mask))
+			imported++;
+	}
+	store.flush();
+	return imported;
+}
+
+bool Gallery::add(const QString& identity, const ShapeSequence& seq, const cv::Mat& mask)
+{
+	std::vector<float> descriptor = handDescriptor(mask);
+	cv::Mat gray, thumbnail;
+	if(mask.channels() == 3)
+		cv::cvtColor(mask, gray, CV_BGR2GRAY);
+	else
+		gray = mask;
+	double scale = std::min(1.0, (double)GALLERY_THUMB_SIZE / std::max(gray.cols, gray.rows));
+	cv::resize(gray, thumbnail, cv::Size(), scale, scale, cv::INTER_AREA);
+	// The store's table is remapped after the append, its rows are taken over first
+	if(descriptors.refcount == NULL)
+		descriptors = descriptors.clone();
+	if(!store.append(identity, seq, descriptor, thumbnail))
+		return false;
+	// Records other processes appended come before this one
+	if(!store.prepareRead())
+		return false;
+	int known = descriptors.rows;
+	descriptors.resize(store.size());
+	for(int k = known; k < store.size(); k++)
+		store.descriptor(k, descriptors.ptr<float>(k), HAND_DESCRIPTOR_SIZE);
+	resetIndex();
+	return true;
+}
+
+void Gallery::resetIndex()
+{
+	QMutexLocker locker(&indexMutex);
+	index.release();
+	indexed = false;
+}
+
+void Gallery::buildIndex() const
+{
+	QMutexLocker locker(&indexMutex);
+	if(indexed)
+		return;
+	if(size() > GALLERY_KNN)
+	{
+		// Records are only appended: a saved index of as many rows was built on these descriptors
+		index = new cv::flann::Index();
+		bool loaded = false;
+		if(QFile::exists(flannName))
+		{
+			try {
+				loaded = index->load(descriptors, flannName.toStdString());
+			} catch(...) {}
+		}
+		if(!loaded)
+		{
+			index = new cv::flann::Index(descriptors, cv::flann::KDTreeIndexParams(4));
+			QString saving = flannName + ".tmp";
+			index->save(saving.toStdString());
+			QFile::remove(flannName);
+			QFile::rename(saving, flannName);
+		}
+	}
+	indexed = true;
+}
+
+static bool byLowerBound(const std::pair<double, int>& a, const std::pair<double, int>& b)
+{
+	return a.first < b.first;
+}
+
+GalleryMatch Gallery::identify(const ShapeSequence& seq, const std::vector<float>& descriptor, double threshold,
+	const QString& workDir, GalleryScratch& scratch) const
+{
+	GalleryMatch best;
+	scratch.candidates = scratch.compared = 0;
+	if(empty())
+		return best;
+
+	// Coarse: nearest descriptors, whole gallery while it's small.
+	// Searches only read the index, they run concurrently once it's built.
+	std::vector<int> nearest;
+	buildIndex();
+	if(!index.empty())
+	{
+		cv::Mat query = cv::Mat(descriptor).reshape(1, 1);
+		std::vector<float> dists;
+		index->knnSearch(query, nearest, dists, GALLERY_KNN, cv::flann::SearchParams(32));
+	} else {
+		nearest.resize(size());
+		for(int k = 0; k < size(); k++)
+			nearest[k] = k;
+	}
+	scratch.candidates = (int)nearest.size();
+
+	// Lower bound: every element of length difference costs MULCT in SequenceComparator.
+	// StringCompare.exe isn't known to normalize the same way, it compares every candidate.
+	std::vector<std::pair<double, int> > bounds;
+	bounds.reserve(nearest.size());
+	foreach(int k, nearest)
+	{
+		int length = store.sequenceLength(k);
+		double lowerBound = SEQ_COMPARE_IN_PROCESS ? MULCT * std::abs(seq.length - length) / std::max(std::max(seq.length, length), 1) : 0;
+		if(lowerBound <= threshold)
+			bounds.push_back(std::make_pair(lowerBound, k));
+	}
+	std::stable_sort(bounds.begin(), bounds.end(), byLowerBound);
+
+	// Fine: exact comparison, bounded by the best match so far.
+	// The tool compares files: the hand is written once, every candidate as the etalon,
+	// both as the .seq text BmpToSeq.exe wrote when there is one.
+	QDir dir(workDir);
+	if(!SEQ_COMPARE_IN_PROCESS && !bounds.empty() && !saveSequence(dir.filePath(HAND_SEQ_NAME), seq))
+		throw std::exception((QString("Writing ") + HAND_SEQ_NAME + " failed.").toAscii().data());
+	double bound = threshold;
+	for(size_t k = 0; k < bounds.size() && bounds[k].first <= bound; k++)
+	{
+		int record = bounds[k].second;
+		store.sequence(record, scratch.candidate);
+		double dissimilarity;
+		if(SEQ_COMPARE_IN_PROCESS)
+			dissimilarity = scratch.comparator.compare(seq, scratch.candidate, bound);
+		else {
+			scratch.candidate.source = store.sequenceSource(record);
+			if(!saveSequence(dir.filePath(ETALON_SEQ_NAME), scratch.candidate))
+				throw std::exception((QString("Writing ") + ETALON_SEQ_NAME + " failed.").toAscii().data());
+			dissimilarity = stringCompare(workDir);
+		}
+		scratch.compared++;
+		if(dissimilarity <= bound && dissimilarity < best.dissimilarity)
+		{
+			best.index = record;
+			best.identity = store.identity(record);
+			best.dissimilarity = dissimilarity;
+			bound = dissimilarity;
+		}
+	}
+	return best;
+}
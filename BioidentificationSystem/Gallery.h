@@ -0,0 +1,80 @@
+#ifndef GALLERY_H
+#define GALLERY_H
+
+#include <QMutex>
+
+#include "opencv2/flann/miniflann.hpp"
+
+#include "general.h"
+#include "SequenceCompare.h"
+#include "GalleryStore.h"
+
+// Global shape descriptor of a hand mask: area ratio, aspect, finger count, log Hu moments
+const int HAND_DESCRIPTOR_SIZE = 10;
+std::vector<float> handDescriptor(const cv::Mat& mask);
+
+struct GalleryMatch
+{
+	GalleryMatch()
+		: index(-1), dissimilarity(DBL_MAX) {}
+	QString identity;
+	int index; // -1 - nothing under the threshold
+	double dissimilarity;
+};
+
+// Per-thread state of Gallery::identify: DP rows of the comparator, the candidate being read
+struct GalleryScratch
+{
+	GalleryScratch()
+		: candidates(0), compared(0) {}
+	SequenceComparator comparator;
+	ShapeSequence candidate;
+	// Last identify: index candidates, exact comparisons
+	int candidates;
+	int compared;
+};
+
+// Enrolled hands, searched coarse to fine:
+// descriptor k-NN index -> sequence length lower bound -> exact comparison
+// (the bound and early termination only when in process).
+// Backed by the GalleryStore in the gallery dir, descriptors are its mapped table until the first add.
+// identify runs on any number of threads at once, each with its own scratch;
+// load and add don't run concurrently with it.
+class Gallery
+{
+public:
+	Gallery();
+
+	// Opens the store, loose <identity>.seq with <identity>.bmp files are imported into an empty one
+	int load(const QString& dir);
+	bool add(const QString& identity, const ShapeSequence& seq, const cv::Mat& mask);
+	// Loaded from GALLERY_FLANN_NAME or built and saved there on the first identify,
+	// so opening a large gallery costs the store's index read only
+	void buildIndex() const;
+
+	int size() const
+		{ return descriptors.rows; }
+	bool empty() const
+		{ return descriptors.rows == 0; }
+	GalleryStore& getStore()
+		{ return store; }
+
+	// Exact comparison is StringCompare.exe unless SEQ_COMPARE_IN_PROCESS: hand.seq and etalon.seq
+	// in workDir are overwritten, one dir per thread. Throws std::exception if the tool fails.
+	GalleryMatch identify(const ShapeSequence& seq, const std::vector<float>& descriptor, double threshold,
+		const QString& workDir, GalleryScratch& scratch) const;
+
+private:
+	int import(const QString& dir);
+	void resetIndex();
+
+	GalleryStore store;
+	cv::Mat descriptors; // CV_32FC1, one row per store record
+	QString flannName;
+	// Built once by the first identify under indexMutex, then only searched
+	mutable QMutex indexMutex;
+	mutable cv::Ptr<cv::flann::Index> index;
+	mutable bool indexed;
+};
+
+#endif // GALLERY_H
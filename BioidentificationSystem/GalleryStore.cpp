@@ -0,0 +1,429 @@
+#include <QDir>
+
+#include <windows.h>
+#include <io.h>
+
+#include "GalleryStore.h"
+
+static const quint32 LOG_MAGIC = 0x4c474850; // "PHGL"
+static const quint32 INDEX_MAGIC = 0x49474850; // "PHGI"
+static const quint32 RECORD_MAGIC = 0x44434552; // "RECD"
+static const quint32 TABLE_MAGIC = 0x44474850; // "PHGD"
+static const quint32 STORE_VERSION = 2;
+static const quint32 STORE_VERSION_NO_SOURCE = 1; // Records without the .seq text, read as version 2 ones
+
+struct LogHeader
+{
+	quint32 magic;
+	quint32 version;
+	quint32 headerSize;
+	quint32 reserved;
+};
+
+// Followed by one row of descriptorSize floats per record, in log order
+struct TableHeader
+{
+	quint32 magic;
+	quint32 version;
+	quint32 descriptorSize;
+	quint32 reserved;
+};
+
+struct IndexHeader
+{
+	quint32 magic;
+	quint32 version;
+	quint64 logSize; // Log size the index was written for, stale index is rebuilt
+	quint32 count;
+	quint32 reserved;
+};
+
+// Followed by features (double, dims x length), descriptor (float), identity (UTF-8),
+// thumbnail (uchar, width x height), .seq text as BmpToSeq.exe wrote it, padded to 8 bytes
+struct GalleryRecord
+{
+	quint32 magic;
+	quint32 size;
+	quint32 identityBytes;
+	qint32 length;
+	qint32 dims;
+	qint32 descriptorSize;
+	qint16 thumbWidth;
+	qint16 thumbHeight;
+	quint32 sourceBytes; // 0 - version 1 record or a sequence not read from a file
+};
+
+// Exclusive lock between processes sharing the gallery (GUI, identification service) while the
+// log or its index change. A byte far past any log end is locked, so reads through the mapping
+// are never blocked. Released by the destructor.
+class LogLock
+{
+public:
+	LogLock(QFile& file)
+		: handle((HANDLE)_get_osfhandle(file.handle()))
+	{
+		ZeroMemory(&overlapped, sizeof(overlapped));
+		overlapped.OffsetHigh = 0x7FFFFFFF;
+		locked = LockFileEx(handle, LOCKFILE_EXCLUSIVE_LOCK, 0, 1, 0, &overlapped) != 0;
+	}
+	~LogLock()
+	{
+		if(locked)
+			UnlockFileEx(handle, 0, 1, 0, &overlapped);
+	}
+
+private:
+	HANDLE handle;
+	OVERLAPPED overlapped;
+	bool locked;
+};
+
+static quint32 recordSize(quint32 identityBytes, int length, int dims, int descriptorSize, int thumbArea, quint32 sourceBytes)
+{
+	quint32 size = sizeof(GalleryRecord) + sizeof(double) * length * dims + sizeof(float) * descriptorSize + identityBytes + thumbArea + sourceBytes;
+	return (size + 7) & ~7u;
+}
+
+static const float* recordDescriptor(const GalleryRecord *header)
+{
+	return (const float*)((const char*)(header + 1) + sizeof(double) * header->length * header->dims);
+}
+
+GalleryStore::GalleryStore()
+	: data(NULL),
+	logSize(0),
+	indexDirty(false),
+	tableData(NULL),
+	descriptorSize(0) {}
+
+GalleryStore::~GalleryStore()
+{
+	close();
+}
+
+bool GalleryStore::open(const QString& dir, int descriptorSize)
+{
+	close();
+	this->descriptorSize = descriptorSize;
+	QDir storeDir(dir);
+	if(!storeDir.exists() && !storeDir.mkpath("."))
+		return false;
+	log.setFileName(storeDir.filePath(GALLERY_DB_NAME));
+	table.setFileName(storeDir.filePath(GALLERY_TABLE_NAME));
+	indexName = storeDir.filePath(GALLERY_INDEX_NAME);
+	if(!log.open(QIODevice::ReadWrite) || !table.open(QIODevice::ReadWrite))
+	{
+		log.close();
+		table.close();
+		return false;
+	}
+	LogLock lock(log);
+	if(log.size() < (qint64)sizeof(LogHeader))
+	{
+		LogHeader header = { LOG_MAGIC, STORE_VERSION, sizeof(LogHeader), 0 };
+		log.resize(0);
+		log.write((const char*)&header, sizeof(header));
+		log.flush();
+	}
+	if(!map())
+	{
+		close();
+		return false;
+	}
+	const LogHeader *header = (const LogHeader*)data;
+	if(header->magic != LOG_MAGIC || (header->version != STORE_VERSION && header->version != STORE_VERSION_NO_SOURCE))
+	{
+		close();
+		return false;
+	}
+	if(header->version == STORE_VERSION_NO_SOURCE)
+	{
+		// Records with sources would look torn to a version 1 reader
+		LogHeader upgraded = *header;
+		upgraded.version = STORE_VERSION;
+		if(!log.seek(0) || log.write((const char*)&upgraded, sizeof(upgraded)) != sizeof(upgraded) || !log.flush())
+		{
+			close();
+			return false;
+		}
+	}
+	if(!readIndex())
+		scanLog(sizeof(LogHeader));
+	if(!openTable() || !fillTable() || !mapTable())
+	{
+		// Nothing to write back, flush would take the lock again
+		indexDirty = false;
+		close();
+		return false;
+	}
+	return true;
+}
+
+void GalleryStore::close()
+{
+	if(!log.isOpen())
+		return;
+	flush();
+	unmap();
+	log.close();
+	table.close();
+	offsets.clear();
+	logSize = 0;
+}
+
+bool GalleryStore::map()
+{
+	if(data != NULL)
+		return true;
+	data = log.map(0, log.size());
+	return data != NULL;
+}
+
+// Both mappings, the table's rows end where the log's records did
+void GalleryStore::unmap()
+{
+	if(tableData != NULL)
+		table.unmap(tableData);
+	tableData = NULL;
+	if(data == NULL)
+		return;
+	log.unmap(data);
+	data = NULL;
+}
+
+qint64 GalleryStore::rowBytes() const
+{
+	return sizeof(float) * descriptorSize;
+}
+
+// Under the lock: a table that doesn't start with a valid header is started again
+bool GalleryStore::openTable()
+{
+	TableHeader header;
+	if(table.size() >= (qint64)sizeof(TableHeader) && table.seek(0) &&
+		table.read((char*)&header, sizeof(header)) == sizeof(header) &&
+		header.magic == TABLE_MAGIC && header.version == STORE_VERSION && (int)header.descriptorSize == descriptorSize)
+		return true;
+	TableHeader fresh = { TABLE_MAGIC, STORE_VERSION, (quint32)descriptorSize, 0 };
+	return table.resize(0) && table.seek(0) && table.write((const char*)&fresh, sizeof(fresh)) == sizeof(fresh) && table.flush();
+}
+
+// Under the lock with the log mapped: rows of records whose writer stopped before the table
+// are taken from the records. Rows past the records are left to be overwritten.
+bool GalleryStore::fillTable()
+{
+	qint64 rows = (table.size() - (qint64)sizeof(TableHeader)) / std::max(rowBytes(), (qint64)1);
+	for(int k = (int)rows; k < size(); k++)
+		if(!writeRow(k, record(k)))
+			return false;
+	return table.flush();
+}
+
+bool GalleryStore::writeRow(int k, const GalleryRecord *header)
+{
+	std::vector<float> row(descriptorSize, 0.f);
+	const float *stored = recordDescriptor(header);
+	std::copy(stored, stored + std::min(descriptorSize, (int)header->descriptorSize), row.begin());
+	return table.seek(sizeof(TableHeader) + k * rowBytes()) &&
+		(rowBytes() == 0 || table.write((const char*)&row[0], rowBytes()) == rowBytes());
+}
+
+bool GalleryStore::mapTable()
+{
+	if(tableData != NULL || size() == 0 || rowBytes() == 0)
+		return true;
+	tableData = table.map(0, sizeof(TableHeader) + size() * rowBytes());
+	return tableData != NULL;
+}
+
+bool GalleryStore::readIndex()
+{
+	QFile index(indexName);
+	if(!index.open(QIODevice::ReadOnly) || index.size() < (qint64)sizeof(IndexHeader))
+		return false;
+	uchar *indexData = index.map(0, index.size());
+	if(indexData == NULL)
+		return false;
+	const IndexHeader *header = (const IndexHeader*)indexData;
+	bool valid = header->magic == INDEX_MAGIC && header->version == STORE_VERSION &&
+		(qint64)header->logSize == log.size() &&
+		index.size() >= (qint64)(sizeof(IndexHeader) + header->count * sizeof(quint64));
+	if(valid)
+	{
+		const quint64 *indexOffsets = (const quint64*)(indexData + sizeof(IndexHeader));
+		offsets.assign(indexOffsets, indexOffsets + header->count);
+		logSize = header->logSize;
+	}
+	index.unmap(indexData);
+	return valid;
+}
+
+// Index is missing or stale, or other processes appended: walk the records from offset on,
+// a torn tail is cut off on next append
+bool GalleryStore::scanLog(qint64 offset)
+{
+	// Called under the lock right after map(), the mapping covers the whole log
+	qint64 size = log.size();
+	while(offset + (qint64)sizeof(GalleryRecord) <= size)
+	{
+		const GalleryRecord *header = (const GalleryRecord*)(data + offset);
+		if(header->magic != RECORD_MAGIC || header->size < sizeof(GalleryRecord) || offset + header->size > size ||
+			header->size != recordSize(header->identityBytes, header->length, header->dims, header->descriptorSize, header->thumbWidth * header->thumbHeight, header->sourceBytes))
+			break;
+		offsets.push_back(offset);
+		offset += header->size;
+	}
+	logSize = offset;
+	indexDirty = true;
+	return offset == size;
+}
+
+// Under the lock: picks up the records other processes appended since the last look
+void GalleryStore::sync()
+{
+	if(log.size() <= logSize)
+		return;
+	unmap();
+	if(map()) {
+		scanLog(logSize);
+		fillTable();
+	}
+}
+
+bool GalleryStore::flush()
+{
+	if(!indexDirty || !log.isOpen())
+		return true;
+	LogLock lock(log);
+	log.flush();
+	sync();
+	QFile index(indexName);
+	if(!index.open(QIODevice::WriteOnly | QIODevice::Truncate))
+		return false;
+	IndexHeader header = { INDEX_MAGIC, STORE_VERSION, (quint64)logSize, (quint32)offsets.size(), 0 };
+	index.write((const char*)&header, sizeof(header));
+	if(!offsets.empty())
+		index.write((const char*)&offsets[0], offsets.size() * sizeof(quint64));
+	indexDirty = false;
+	return true;
+}
+
+bool GalleryStore::append(const QString& identity, const ShapeSequence& seq, const std::vector<float>& descriptor, const cv::Mat& thumbnail)
+{
+	if(!log.isOpen())
+		return false;
+	CV_Assert(thumbnail.empty() || thumbnail.type() == CV_8UC1);
+	QByteArray name = identity.toUtf8();
+	GalleryRecord header;
+	header.magic = RECORD_MAGIC;
+	header.identityBytes = name.size();
+	header.length = seq.length;
+	header.dims = seq.dims;
+	header.descriptorSize = (int)descriptor.size();
+	header.thumbWidth = (qint16)thumbnail.cols;
+	header.thumbHeight = (qint16)thumbnail.rows;
+	header.sourceBytes = seq.source.size();
+	header.size = recordSize(header.identityBytes, header.length, header.dims, header.descriptorSize, thumbnail.cols * thumbnail.rows, header.sourceBytes);
+
+	QByteArray buffer(header.size, 0);
+	char *out = buffer.data();
+	memcpy(out, &header, sizeof(header));
+	out += sizeof(header);
+	if(!seq.features.empty())
+		memcpy(out, &seq.features[0], sizeof(double) * seq.features.size());
+	out += sizeof(double) * header.length * header.dims;
+	if(!descriptor.empty())
+		memcpy(out, &descriptor[0], sizeof(float) * descriptor.size());
+	out += sizeof(float) * header.descriptorSize;
+	memcpy(out, name.constData(), name.size());
+	out += name.size();
+	for(int row = 0; row < thumbnail.rows; row++, out += thumbnail.cols)
+		memcpy(out, thumbnail.ptr(row), thumbnail.cols);
+	memcpy(out, seq.source.constData(), seq.source.size());
+
+	// One writer at a time; records of others are kept, only a torn tail is cut off
+	LogLock lock(log);
+	sync();
+	// Remapped by prepareRead
+	unmap();
+	if(log.size() != logSize)
+		log.resize(logSize);
+	if(!log.seek(logSize) || log.write(buffer) != buffer.size() || !log.flush())
+		return false;
+	offsets.push_back(logSize);
+	logSize += buffer.size();
+	indexDirty = true;
+	// A missing row is filled from the record by the next open or sync
+	return writeRow(size() - 1, (const GalleryRecord*)buffer.constData()) && table.flush();
+}
+
+bool GalleryStore::prepareRead()
+{
+	if(data != NULL)
+		return true;
+	log.flush();
+	return map() && mapTable();
+}
+
+const GalleryRecord* GalleryStore::record(int k) const
+{
+	CV_Assert(data != NULL);
+	return (const GalleryRecord*)(data + offsets[k]);
+}
+
+QString GalleryStore::identity(int k) const
+{
+	const GalleryRecord *header = record(k);
+	const char *name = (const char*)(header + 1) + sizeof(double) * header->length * header->dims + sizeof(float) * header->descriptorSize;
+	return QString::fromUtf8(name, header->identityBytes);
+}
+
+int GalleryStore::sequenceLength(int k) const
+{
+	return record(k)->length;
+}
+
+void GalleryStore::sequence(int k, ShapeSequence& seq) const
+{
+	const GalleryRecord *header = record(k);
+	const double *features = (const double*)(header + 1);
+	seq.length = header->length;
+	seq.dims = header->dims;
+	seq.features.assign(features, features + header->length * header->dims);
+	seq.source.clear();
+}
+
+QByteArray GalleryStore::sequenceSource(int k) const
+{
+	const GalleryRecord *header = record(k);
+	const char *source = (const char*)(header + 1) + sizeof(double) * header->length * header->dims +
+		sizeof(float) * header->descriptorSize + header->identityBytes + header->thumbWidth * header->thumbHeight;
+	return QByteArray(source, header->sourceBytes);
+}
+
+void GalleryStore::descriptor(int k, float *values, int size) const
+{
+	CV_Assert(tableData != NULL);
+	const float *stored = (const float*)(tableData + sizeof(TableHeader)) + k * descriptorSize;
+	int n = std::min(size, descriptorSize);
+	std::copy(stored, stored + n, values);
+	std::fill(values + n, values + size, 0.f);
+}
+
+cv::Mat GalleryStore::descriptors() const
+{
+	if(tableData == NULL)
+		return cv::Mat(0, descriptorSize, CV_32FC1);
+	return cv::Mat(size(), descriptorSize, CV_32FC1, tableData + sizeof(TableHeader));
+}
+
+cv::Mat GalleryStore::thumbnail(int k) const
+{
+	const GalleryRecord *header = record(k);
+	if(header->thumbWidth == 0 || header->thumbHeight == 0)
+		return cv::Mat();
+	const uchar *pixels = (const uchar*)(header + 1) + sizeof(double) * header->length * header->dims +
+		sizeof(float) * header->descriptorSize + header->identityBytes;
+	// The mapping goes away on the next append
+	return cv::Mat(header->thumbHeight, header->thumbWidth, CV_8UC1, (void*)pixels).clone();
+}
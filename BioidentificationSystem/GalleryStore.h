@@ -0,0 +1,79 @@
+#ifndef GALLERYSTORE_H
+#define GALLERYSTORE_H
+
+#include <QFile>
+
+#include "general.h"
+#include "SequenceCompare.h"
+
+struct GalleryRecord;
+
+// Enrollment database: append-only log of records (identity, encoded sequence,
+// descriptor, thumbnail, the sequence's .seq text) in GALLERY_DB_NAME, an offset index in
+// GALLERY_INDEX_NAME and the descriptors again as one append-only table in GALLERY_TABLE_NAME.
+// Log and table are memory-mapped for reading, so opening costs the index read only, the
+// descriptors are used in place without touching the records, and the pages are shared
+// between processes through the page cache.
+// Native (little-endian) byte order. One identity may have several records (samples).
+// Processes sharing the dir append under an exclusive file lock and pick up each other's records;
+// size() grows by those on append and flush.
+class GalleryStore
+{
+public:
+	GalleryStore();
+	~GalleryStore();
+
+	// Creates the database in dir if there is none. Descriptors are tabled as descriptorSize
+	// floats, longer ones are cut, shorter ones padded with zeros.
+	bool open(const QString& dir, int descriptorSize);
+	void close();
+	bool isOpen() const
+		{ return log.isOpen(); }
+	int size() const
+		{ return (int)offsets.size(); }
+
+	bool append(const QString& identity, const ShapeSequence& seq, const std::vector<float>& descriptor, const cv::Mat& thumbnail);
+	// Writes the index, done by close too
+	bool flush();
+	// Maps the log again after appends, before records are read
+	bool prepareRead();
+
+	// Records are read from the mapping, any number of threads at once while nothing is appended
+	QString identity(int k) const;
+	int sequenceLength(int k) const;
+	// Features only, source is left empty
+	void sequence(int k, ShapeSequence& seq) const;
+	// .seq text of the record, empty if it has none
+	QByteArray sequenceSource(int k) const;
+	// Copies at most size values, zeros the rest
+	void descriptor(int k, float *values, int size) const;
+	// size() x descriptorSize CV_32FC1 header over the mapped table, valid until the next append
+	cv::Mat descriptors() const;
+	// CV_8UC1 copy
+	cv::Mat thumbnail(int k) const;
+
+private:
+	const GalleryRecord* record(int k) const;
+	bool map();
+	void unmap();
+	qint64 rowBytes() const;
+	bool openTable();
+	bool fillTable();
+	bool writeRow(int k, const GalleryRecord *header);
+	bool mapTable();
+	bool readIndex();
+	bool scanLog(qint64 offset);
+	void sync();
+
+	QFile log;
+	QFile table;
+	QString indexName;
+	uchar *data; // Mapped log, NULL after append until prepareRead
+	uchar *tableData; // Mapped table rows of the records, as data
+	qint64 logSize; // End of the last complete record
+	std::vector<quint64> offsets;
+	bool indexDirty;
+	int descriptorSize;
+};
+
+#endif // GALLERYSTORE_H
@@ -0,0 +1,329 @@
+#include "HandShape.h"
+
+static cv::Mat blurredGray(const cv::Mat& frame)
+{
+	cv::Mat frameGray;
+	toGray(frame, frameGray);
+	cv::blur(frameGray, frameGray, cv::Size(3,3));
+	return frameGray;
+}
+
+cv::Mat handCannyEdges(const cv::Mat& frame, int lowThreshold, int ratio, int aperture)
+{
+	cv::Mat edges;
+	cv::Canny(blurredGray(frame), edges, lowThreshold, lowThreshold*ratio, aperture);
+	return edges;
+}
+
+std::vector<cv::Rect> cannyGates(const std::vector<cv::Rect>& candidates, int eps, cv::Size frameSize)
+{
+	cv::Rect frameRect(cv::Point(0, 0), frameSize);
+	std::vector<cv::Rect> gates;
+	for(size_t k = 0; k < candidates.size(); k++)
+		gates.push_back(cv::Rect(candidates[k].x - eps, candidates[k].y - eps, candidates[k].width + 2*eps, candidates[k].height + 2*eps) & frameRect);
+	// Join until no two overlap, so no pixel is computed twice
+	bool joined = true;
+	while(joined)
+	{
+		joined = false;
+		for(size_t i = 0; i < gates.size() && !joined; i++)
+			for(size_t j = i + 1; j < gates.size() && !joined; j++)
+				if((gates[i] & gates[j]).area() > 0) {
+					gates[i] = gates[i] | gates[j];
+					gates.erase(gates.begin() + j);
+					joined = true;
+				}
+	}
+	return gates;
+}
+
+static void pushCandidate(const cv::Mat& candidates, cv::Mat& reached, std::vector<cv::Point>& stack, cv::Point p)
+{
+	if(candidates.at<uchar>(p) == 0 || reached.at<uchar>(p) != 0)
+		return;
+	reached.at<uchar>(p) = 255;
+	stack.push_back(p);
+}
+
+// Whether a chain of hysteresis candidates connects the gate to an open side of trusted,
+// the sides not on the frame border, beyond which the chain may pick up a strong pixel the halo doesn't see.
+// open: top, bottom, left, right.
+static bool chainLeavesTrusted(const cv::Mat& candidates, const cv::Rect& trusted, const cv::Rect& gate, const bool open[4])
+{
+	cv::Mat reached = cv::Mat::zeros(candidates.size(), CV_8UC1);
+	std::vector<cv::Point> stack;
+	const int bottom = trusted.y + trusted.height - 1, right = trusted.x + trusted.width - 1;
+	for(int j = trusted.x; j <= right; j++) {
+		if(open[0])
+			pushCandidate(candidates, reached, stack, cv::Point(j, trusted.y));
+		if(open[1])
+			pushCandidate(candidates, reached, stack, cv::Point(j, bottom));
+	}
+	for(int i = trusted.y; i <= bottom; i++) {
+		if(open[2])
+			pushCandidate(candidates, reached, stack, cv::Point(trusted.x, i));
+		if(open[3])
+			pushCandidate(candidates, reached, stack, cv::Point(right, i));
+	}
+	while(!stack.empty())
+	{
+		cv::Point p = stack.back();
+		stack.pop_back();
+		if(gate.contains(p))
+			return true;
+		for(int di = -1; di <= 1; di++)
+			for(int dj = -1; dj <= 1; dj++) {
+				cv::Point q(p.x + dj, p.y + di);
+				if(trusted.contains(q))
+					pushCandidate(candidates, reached, stack, q);
+			}
+	}
+	return false;
+}
+
+// The halo starts at CANNY_GATE_HALO and doubles while a candidate chain runs from the gate out of
+// the part of it computed exactly, so inside the gate the map is the full frame one bit for bit.
+cv::Mat gatedCannyEdges(const cv::Mat& frame, const std::vector<cv::Rect>& gates, int lowThreshold, int ratio, int aperture)
+{
+	cv::Mat edges = cv::Mat::zeros(frame.size(), CV_8UC1);
+	cv::Rect frameRect(0, 0, frame.cols, frame.rows);
+	// Canny pixels depend on this far around them: 3x3 blur, Sobel aperture, non-maximum suppression
+	const int reach = 1 + aperture / 2 + 1;
+	for(size_t k = 0; k < gates.size(); k++)
+	{
+		cv::Rect halo;
+		cv::Mat gateEdges;
+		for(int pad = std::max(CANNY_GATE_HALO, reach + 1); ; pad *= 2)
+		{
+			halo = cv::Rect(gates[k].x - pad, gates[k].y - pad, gates[k].width + 2*pad, gates[k].height + 2*pad) & frameRect;
+			cv::Mat gray = blurredGray(frame(halo));
+			cv::Canny(gray, gateEdges, lowThreshold, lowThreshold*ratio, aperture);
+			if(halo == frameRect)
+				break;
+			// Both thresholds low: every pixel above it after suppression, the pixels hysteresis may join
+			cv::Mat candidates;
+			cv::Canny(gray, candidates, lowThreshold, lowThreshold, aperture);
+			bool open[4] = { halo.y > 0, halo.br().y < frame.rows, halo.x > 0, halo.br().x < frame.cols };
+			int top = open[0] ? reach : 0, left = open[2] ? reach : 0;
+			cv::Rect trusted(left, top, halo.width - left - (open[3] ? reach : 0), halo.height - top - (open[1] ? reach : 0));
+			if(!chainLeavesTrusted(candidates, trusted, cv::Rect(gates[k].tl() - halo.tl(), gates[k].size()), open))
+				break;
+		}
+		gateEdges(cv::Rect(gates[k].tl() - halo.tl(), gates[k].size())).copyTo(edges(gates[k]));
+	}
+	return edges;
+}
+
+static void mergeLogic(const cv::Mat& cannyEdges, int eps, const std::vector<cv::Point>& contour_poly, std::vector<cv::Point>& mergedContour,  int point, cv::Point& prevAssignedP)
+{
+	if(cannyEdges.at<uchar>(contour_poly[point]) > 0) {
+		prevAssignedP = contour_poly[point];
+		return;
+	}
+	cv::Point nearestCannyP = nearestCannyPoint(cannyEdges, eps, contour_poly[point], prevAssignedP);
+	if(nearestCannyP == cv::Point(-1, -1)) {
+		prevAssignedP = contour_poly[point];
+	} else {
+		mergedContour[point] = nearestCannyP;
+		prevAssignedP = nearestCannyP;
+	}
+}
+
+cv::Point nearestCannyPoint(const cv::Mat& cannyEdges, int eps, cv::Point contourPoint, cv::Point prevCanny)
+{
+	cv::Point nearestPoint(-1, -1);
+	std::vector<cv::Point> nearCannyPixels;
+	for(int j = 1; j <= eps; j++)
+	{
+		if( ((contourPoint.x - j) < 0) || ((contourPoint.x + j) >= cannyEdges.cols) ||  
+			((contourPoint.y - j) < 0) || ((contourPoint.y + j) >= cannyEdges.rows) ) // Check screen boundaries
+			break;
+		cv::Point point(contourPoint.x - j, contourPoint.y - j);
+		for(int k = 0; k < (2 * j); k++, point.x++) // From top-left corner to top-right corner
+			if( cannyEdges.at<uchar>(point) > 0 )
+				nearCannyPixels.push_back(cv::Point(point));
+		for(int k = 0; k < (2 * j); k++, point.y++) // From top-right corner to bottom-right corner
+			if( cannyEdges.at<uchar>(point) > 0 )
+				nearCannyPixels.push_back(cv::Point(point));
+		for(int k = 0; k < (2 * j); k++, point.x--) // From bottom-right corner to bottom-left corner
+			if( cannyEdges.at<uchar>(point) > 0 )
+				nearCannyPixels.push_back(cv::Point(point));
+		for(int k = 0; k < (2 * j); k++, point.y--) // From bottom-left corner to top-left corner
+			if( cannyEdges.at<uchar>(point) > 0 )
+				nearCannyPixels.push_back(cv::Point(point));
+		// Find nearest Canny pixel
+		if(nearCannyPixels.size())
+		{
+			if(prevCanny == cv::Point(-1, -1)) {
+				nearestPoint = nearCannyPixels[0];
+				for(int k = 1; k < nearCannyPixels.size(); k++)
+					if( (abs(contourPoint.x - nearCannyPixels[k].x) < abs(contourPoint.x - nearestPoint.x)) ||
+						(abs(contourPoint.y - nearCannyPixels[k].y) < abs(contourPoint.y - nearestPoint.y)) )
+						nearestPoint = nearCannyPixels[k];
+				break;
+			} else {
+				if(nearestPoint == cv::Point(-1, -1))
+					nearestPoint = nearCannyPixels[0];
+				for(int k = 0; k < nearCannyPixels.size(); k++) {
+					if(nearCannyPixels[k] == prevCanny)
+						continue;
+					if( (abs(nearCannyPixels[k].x - contourPoint.x) + abs(nearCannyPixels[k].y - contourPoint.y) + abs(nearCannyPixels[k].x - prevCanny.x) + abs(nearCannyPixels[k].y - prevCanny.y)) < 
+						(abs(nearestPoint.x - contourPoint.x) + abs(nearestPoint.y - contourPoint.y) + abs(nearestPoint.x - prevCanny.x) + abs(nearestPoint.y - prevCanny.y)) )
+						nearestPoint = nearCannyPixels[k];
+				}
+			}
+		}
+	}
+	return nearestPoint;
+}
+
+std::vector<cv::Point> bendContour(const std::vector<cv::Point>& contour, const cv::Mat& cannyEdges, int eps)
+{
+	std::vector<cv::Point> mergedContour = contour;
+	int startPoint = 0;
+	cv::Point assignedPoint(-1, -1);
+	// Find start point
+	for(int point = 0; point < contour.size(); point++) {
+		if(cannyEdges.at<uchar>(contour[point]) > 0) {
+			startPoint = point;
+			assignedPoint = contour[point];
+			break;
+		}
+		cv::Point nearestCannyP = nearestCannyPoint(cannyEdges, eps, contour[point]);
+		if(nearestCannyP == cv::Point(-1, -1))
+			continue;
+		if(assignedPoint == cv::Point(-1, -1)) {
+			startPoint = point;
+			assignedPoint = nearestCannyP;
+		} else {
+			if( (abs(nearestCannyP.x - contour[point].x) + abs(nearestCannyP.y - contour[point].y)) < 
+				(abs(assignedPoint.x - contour[startPoint].x) + abs(assignedPoint.y - contour[startPoint].y)) ) 
+			{
+					startPoint = point;
+					assignedPoint = nearestCannyP;
+			}
+		}
+	}
+	// Bypass contour
+	if(assignedPoint != cv::Point(-1, -1)) {
+		cv::Point prevAssignedP = assignedPoint;
+		for(int point = startPoint+1; point < contour.size(); point++) {
+			mergeLogic(cannyEdges, eps, contour, mergedContour, point, prevAssignedP);
+		}
+		prevAssignedP = assignedPoint;
+		for(int point = startPoint-1; point >= 0; point--) {
+			mergeLogic(cannyEdges, eps, contour, mergedContour, point, prevAssignedP);
+		}
+	}
+	return mergedContour;
+}
+
+BentContour bentContour(const std::vector<cv::Point>& contour, const std::vector<cv::Point>& merged)
+{
+	BentContour bent;
+	bent.contour = contour;
+	bent.merged = merged;
+	bent.bbox = cv::boundingRect(cv::Mat(contour));
+	bent.index = cv::Mat(bent.bbox.size(), CV_32SC1, cv::Scalar(-1));
+	for(int k = 0; k < (int)contour.size(); k++)
+		bent.index.at<int>(contour[k] - bent.bbox.tl()) = k;
+	return bent;
+}
+
+const BentContour* matchingBend(const std::vector<BentContour>& bends, const std::vector<cv::Point>& contour)
+{
+	cv::Rect rect = cv::boundingRect(cv::Mat(contour));
+	const BentContour *best = NULL;
+	double bestOverlap = INCREMENTAL_BEND_OVERLAP;
+	for(size_t k = 0; k < bends.size(); k++) {
+		double intersection = (rect & bends[k].bbox).area();
+		double overlap = intersection / (rect.area() + bends[k].bbox.area() - intersection);
+		if(overlap >= bestOverlap) {
+			bestOverlap = overlap;
+			best = &bends[k];
+		}
+	}
+	return best;
+}
+
+// Any edge pixel on the rings 1..radius around p, scanned as nearestCannyPoint does
+static bool edgeWithin(const cv::Mat& cannyEdges, cv::Point p, int radius)
+{
+	for(int j = 1; j <= radius; j++)
+	{
+		if(p.x - j < 0 || p.x + j >= cannyEdges.cols || p.y - j < 0 || p.y + j >= cannyEdges.rows)
+			break;
+		const uchar *top = cannyEdges.ptr<uchar>(p.y - j);
+		const uchar *bottom = cannyEdges.ptr<uchar>(p.y + j);
+		for(int x = p.x - j; x <= p.x + j; x++)
+			if(top[x] > 0 || bottom[x] > 0)
+				return true;
+		for(int y = p.y - j + 1; y < p.y + j; y++)
+			if(cannyEdges.at<uchar>(y, p.x - j) > 0 || cannyEdges.at<uchar>(y, p.x + j) > 0)
+				return true;
+	}
+	return false;
+}
+
+std::vector<cv::Point> bendContourIncremental(const std::vector<cv::Point>& contour, const cv::Mat& cannyEdges, int eps, const BentContour& previous)
+{
+	int n = (int)contour.size();
+	std::vector<cv::Point> mergedContour = contour;
+	std::vector<bool> reused(n, false);
+	int reusedCount = 0;
+	for(int k = 0; k < n; k++)
+	{
+		if(!previous.bbox.contains(contour[k]))
+			continue;
+		int prev = previous.index.at<int>(contour[k] - previous.bbox.tl());
+		if(prev < 0)
+			continue;
+		const cv::Point& snapped = previous.merged[prev];
+		bool onEdge = cannyEdges.at<uchar>(contour[k]) > 0;
+		if(snapped == contour[k]) {
+			// Left in place for lack of an edge: one may have appeared within eps since
+			if(!onEdge && edgeWithin(cannyEdges, contour[k], eps))
+				continue;
+		} else {
+			// Snapped point gone, the point itself is on an edge now, or a nearer edge appeared
+			int ring = std::max(std::abs(snapped.x - contour[k].x), std::abs(snapped.y - contour[k].y));
+			if(cannyEdges.at<uchar>(snapped) == 0 || onEdge || edgeWithin(cannyEdges, contour[k], ring - 1))
+				continue;
+		}
+		mergedContour[k] = snapped;
+		reused[k] = true;
+		reusedCount++;
+	}
+	if(reusedCount == 0 || reusedCount < n * INCREMENTAL_BEND_MIN_REUSE)
+		return bendContour(contour, cannyEdges, eps);
+
+	// Moved segments are walked forward from the reused point before them, as the full bending does
+	int start = 0;
+	while(!reused[start])
+		start++;
+	cv::Point prevAssignedP = mergedContour[start];
+	for(int step = 1; step <= n; step++)
+	{
+		int point = (start + step) % n;
+		if(reused[point])
+			prevAssignedP = mergedContour[point];
+		else
+			mergeLogic(cannyEdges, eps, contour, mergedContour, point, prevAssignedP);
+	}
+	return mergedContour;
+}
+
+cv::Mat handApplicant(const std::vector<cv::Point>& contour, cv::Size frameSize)
+{
+	std::vector<std::vector<cv::Point>> contours(1, contour);
+	cv::Rect boundRect = cv::boundingRect(cv::Mat(contour));
+	cv::Mat applicant = cv::Mat::zeros(frameSize, CV_8UC1);
+	cv::drawContours(applicant, contours, 0, cv::Scalar(255), -1);
+	applicant = applicant(boundRect).clone();
+	cv::Mat applicantClone = applicant.clone();
+	std::vector<std::vector<cv::Point>> applicantContours;
+	cv::findContours(applicantClone, applicantContours, CV_RETR_EXTERNAL, CV_CHAIN_APPROX_NONE);
+	cv::drawContours(applicant, applicantContours, -1, cv::Scalar(255), -1);
+	onePixelBorder(applicant);
+	return applicant;
+}
@@ -0,0 +1,44 @@
+#ifndef HANDSHAPE_H
+#define HANDSHAPE_H
+
+#include "general.h"
+
+// Blurred grayscale Canny, as the CANNY state
+cv::Mat handCannyEdges(const cv::Mat& frame, int lowThreshold, int ratio, int aperture);
+// Candidate boxes grown by the merge eps, overlapping ones joined, clipped to the frame
+std::vector<cv::Rect> cannyGates(const std::vector<cv::Rect>& candidates, int eps, cv::Size frameSize);
+// handCannyEdges inside the gates only, zero elsewhere. Each gate is computed with a border grown
+// from CANNY_GATE_HALO until it holds every hysteresis chain reaching the gate, so inside the gates
+// the map is the full frame one.
+cv::Mat gatedCannyEdges(const cv::Mat& frame, const std::vector<cv::Rect>& gates, int lowThreshold, int ratio, int aperture);
+
+// Nearest Canny pixel within eps of contourPoint, (-1, -1) if none.
+// With prevCanny set, the pixel closest to both points is taken.
+cv::Point nearestCannyPoint(const cv::Mat& cannyEdges, int eps, cv::Point contourPoint, cv::Point prevCanny = cv::Point(-1, -1));
+
+// Contour points moved to the nearby Canny edges, walking both ways from the best anchored point
+std::vector<cv::Point> bendContour(const std::vector<cv::Point>& contour, const cv::Mat& cannyEdges, int eps);
+
+// Bending of one candidate, kept for the next frame
+struct BentContour
+{
+	std::vector<cv::Point> contour;
+	std::vector<cv::Point> merged;
+	cv::Rect bbox;
+	cv::Mat index; // CV_32SC1 over bbox, contour point -> its index, -1 elsewhere
+};
+BentContour bentContour(const std::vector<cv::Point>& contour, const std::vector<cv::Point>& merged);
+// Last frame's candidate at the same place: largest bounding box overlap of at least
+// INCREMENTAL_BEND_OVERLAP, NULL if there is none
+const BentContour* matchingBend(const std::vector<BentContour>& bends, const std::vector<cv::Point>& contour);
+
+// bendContour reusing previous: contour points it also had keep their snapped points
+// while these are still on an edge and no nearer edge appeared within eps, only the segments
+// that moved or changed are re-snapped.
+// Falls back to the full bending if less than INCREMENTAL_BEND_MIN_REUSE is reusable.
+std::vector<cv::Point> bendContourIncremental(const std::vector<cv::Point>& contour, const cv::Mat& cannyEdges, int eps, const BentContour& previous);
+
+// Filled contour cropped to its bounding box with a black 1-pixel border, the BmpToSeq input
+cv::Mat handApplicant(const std::vector<cv::Point>& contour, cv::Size frameSize);
+
+#endif // HANDSHAPE_H
@@ -0,0 +1,160 @@
+#include <QDir>
+
+#include "HandStages.h"
+#include "TiledStages.h"
+
+void trackFaces(std::vector<FaceTrack>& faces, const std::vector<cv::Rect>& detected, int& nextId)
+{
+	for(size_t k = 0; k < faces.size(); k++)
+		faces[k].misses++;
+	foreach(const cv::Rect& rect, detected)
+	{
+		int best = -1;
+		double bestOverlap = FACE_TRACK_OVERLAP;
+		for(size_t k = 0; k < faces.size(); k++)
+		{
+			if(faces[k].misses == 0)
+				continue;
+			double intersection = (rect & faces[k].rect).area();
+			double overlap = intersection / (rect.area() + faces[k].rect.area() - intersection);
+			if(overlap >= bestOverlap) {
+				bestOverlap = overlap;
+				best = (int)k;
+			}
+		}
+		if(best < 0) {
+			faces.push_back(FaceTrack());
+			best = (int)faces.size() - 1;
+			faces[best].id = nextId++;
+		}
+		faces[best].rect = rect;
+		faces[best].misses = 0;
+	}
+	for(size_t k = faces.size(); k > 0; k--)
+		if(faces[k - 1].misses > FACE_TRACK_MISSES)
+			faces.erase(faces.begin() + (k - 1));
+}
+
+std::vector<cv::Rect> visibleFaces(const std::vector<FaceTrack>& faces)
+{
+	std::vector<cv::Rect> visible;
+	for(size_t k = 0; k < faces.size(); k++)
+		if(faces[k].misses == 0)
+			visible.push_back(faces[k].rect);
+	return visible;
+}
+
+void sampleFaceSkin(FaceTrack& track)
+{
+	if(track.misses > 0 || track.face.empty())
+		return;
+	track.skinColor = track.face(faceSkinRect()).clone();
+	track.skinModel.update(track.skinColor);
+}
+
+cv::Mat trackedSkinLut(const std::vector<FaceTrack>& faces)
+{
+	cv::Mat lut;
+	for(size_t k = 0; k < faces.size(); k++)
+	{
+		if(!faces[k].skinModel.hasClassifierLut())
+			continue;
+		if(lut.empty())
+			lut = faces[k].skinModel.getLut().clone();
+		else
+			cv::bitwise_or(lut, faces[k].skinModel.getLut(), lut);
+	}
+	return lut;
+}
+
+// Hand size window is relative to the face of the nearest person
+bool HandFilter::operator()(const cv::Rect& box) const
+{
+	if( (box.width <= MIN_WH) || (box.height <= MIN_WH) )
+		return false;
+	if(anySize)
+		return true;
+	const cv::Rect *nearest = NULL;
+	double nearestDist = 0;
+	cv::Point center(box.x + box.width / 2, box.y + box.height / 2);
+	for(size_t k = 0; k < faces.size(); k++)
+	{
+		cv::Point faceCenter(faces[k].x + faces[k].width / 2, faces[k].y + faces[k].height / 2);
+		double dist = cv::norm(center - faceCenter);
+		if(nearest == NULL || dist < nearestDist) {
+			nearest = &faces[k];
+			nearestDist = dist;
+		}
+	}
+	return (nearest != NULL) &&
+		(box.width > (nearest->width * 0.5)) && (box.height > (nearest->height * 0.5)) &&
+		(box.width < (nearest->width * topHandThres)) && (box.height < (nearest->height * topHandThres));
+}
+
+void skinStage(const cv::Mat& frame, const cv::Mat& lut, const std::vector<cv::Rect>& faces, const CannyParams& canny,
+	cv::Mat& skin, cv::Mat *edges)
+{
+	if(TILED_PROCESSING && !GATED_CANNY && edges != NULL)
+		tiledSkinAndEdges(frame, lut, canny.lowThreshold, canny.ratio, canny.aperture, skin, *edges);
+	else
+		skin = SkinColorModel::classifyImage(frame, lut);
+	cv::Rect frameRect(0, 0, frame.cols, frame.rows);
+	for(size_t k = 0; k < faces.size(); k++)
+	{
+		cv::Rect face = faces[k] & frameRect;
+		if(face.area() > 0)
+			skin(face).setTo(cv::Scalar(0));
+	}
+}
+
+void candidateStage(const cv::Mat& skin, const HandFilter& filter, HandCandidates& candidates)
+{
+	labelComponents(skin, candidates.labels, candidates.components);
+	candidates.kept.clear();
+	candidates.boxes.clear();
+	for(size_t k = 0; k < candidates.components.size(); k++)
+	{
+		if(!filter(candidates.components[k].bbox))
+			continue;
+		candidates.kept.push_back((int)k);
+		candidates.boxes.push_back(candidates.components[k].bbox);
+	}
+}
+
+cv::Mat cannyStage(const cv::Mat& frame, const std::vector<cv::Rect>& candidateBoxes, const CannyParams& canny, int mergeEps)
+{
+	if(GATED_CANNY)
+		return gatedCannyEdges(frame, cannyGates(candidateBoxes, mergeEps, frame.size()), canny.lowThreshold, canny.ratio, canny.aperture);
+	return handCannyEdges(frame, canny.lowThreshold, canny.ratio, canny.aperture);
+}
+
+std::vector<cv::Point> bendStage(const std::vector<cv::Point>& contour, const cv::Mat& edges, int mergeEps,
+	const BentContour *previous)
+{
+	if(previous != NULL)
+		return bendContourIncremental(contour, edges, mergeEps, *previous);
+	return bendContour(contour, edges, mergeEps);
+}
+
+GalleryMatch identifyStage(const cv::Mat& applicant, const Gallery& gallery, const ShapeSequence& etalon, double threshold,
+	const QString& workDir, GalleryScratch& scratch)
+{
+	ShapeSequence hand = encodeHand(applicant, workDir);
+	if(!gallery.empty())
+	{
+		// Not in workDir itself, the tool's etalon.seq is overwritten by every candidate
+		QString matchDir = QDir(workDir).filePath(GALLERY_MATCH_DIR);
+		if(!SEQ_COMPARE_IN_PROCESS)
+			QDir().mkpath(matchDir);
+		return gallery.identify(hand, handDescriptor(applicant), threshold, matchDir, scratch);
+	}
+	GalleryMatch match;
+	match.identity = "etalon";
+	if(SEQ_COMPARE_IN_PROCESS) {
+		if(etalon.empty())
+			throw std::exception((QString("No gallery and no ") + ETALON_SEQ_NAME + " to compare with.").toAscii().data());
+		match.dissimilarity = scratch.comparator.compare(etalon, hand);
+	} else
+		match.dissimilarity = stringCompare(workDir);
+	return match;
+}
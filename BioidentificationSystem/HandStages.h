@@ -0,0 +1,90 @@
+#ifndef HANDSTAGES_H
+#define HANDSTAGES_H
+
+#include "general.h"
+#include "Components.h"
+#include "HandShape.h"
+#include "Gallery.h"
+#include "SkinColorModel.h"
+
+// Hand recognition stages shared by the state machine (ImageProcessor) and the headless
+// pipelines (Recognizer of the service, Stream), so they find the same hands.
+
+struct FaceTrack
+{
+	FaceTrack()
+		: id(0), misses(0), training(false), trained(false) {}
+	int id;
+	cv::Rect rect;
+	cv::Mat face; // FACE_WIDTH x FACE_HEIGHT
+	cv::Mat skinColor;
+	SkinColorModel skinModel;
+	int misses; // Frames since last detection, 0 - visible in current frame
+	bool training; // Classifier is being trained in background
+	bool trained; // Classifier trained for the current skin model
+};
+
+// Continues tracks by overlap, so every person keeps their skin model between frames.
+// New faces get ids from nextId, tracks lost for FACE_TRACK_MISSES frames are dropped.
+void trackFaces(std::vector<FaceTrack>& faces, const std::vector<cv::Rect>& detected, int& nextId);
+std::vector<cv::Rect> visibleFaces(const std::vector<FaceTrack>& faces);
+// Skin patch of a visible track's face added to its model
+void sampleFaceSkin(FaceTrack& track);
+// Union of the tracks' classifier LUTs, empty until the first one is ready
+cv::Mat trackedSkinLut(const std::vector<FaceTrack>& faces);
+
+struct CannyParams
+{
+	CannyParams(int lowThreshold = LOW_THRESHOLD, int ratio = RATIO, int aperture = APERTURE)
+		: lowThreshold(lowThreshold), ratio(ratio), aperture(aperture) {}
+	int lowThreshold;
+	int ratio;
+	int aperture;
+};
+
+// Which skin components may be hands: the size window relative to the nearest face,
+// or any component above MIN_WH when no faces are known (photos).
+struct HandFilter
+{
+	HandFilter()
+		: topHandThres(TOP_HAND_THRES), anySize(true) {}
+	explicit HandFilter(const std::vector<cv::Rect>& faces, int topHandThres = TOP_HAND_THRES)
+		: faces(faces), topHandThres(topHandThres), anySize(false) {}
+	bool operator()(const cv::Rect& box) const;
+
+	std::vector<cv::Rect> faces; // Visible in the frame, they are skin but never hands
+	int topHandThres;
+	bool anySize;
+};
+
+// Skin components that passed the filter, labelled once for the Canny gates and the contours
+struct HandCandidates
+{
+	cv::Mat labels;
+	std::vector<ComponentStats> components;
+	std::vector<int> kept; // Indices into components
+	std::vector<cv::Rect> boxes; // Of the kept components
+
+	size_t size() const
+		{ return kept.size(); }
+	std::vector<cv::Point> contour(size_t c) const
+		{ return componentContour(labels, kept[c] + 1, components[kept[c]].bbox); }
+};
+
+// Skin of frame under lut with the faces cleared. With TILED_PROCESSING and without GATED_CANNY
+// the edges come from the same pass if edges is given, otherwise they are left to cannyStage.
+void skinStage(const cv::Mat& frame, const cv::Mat& lut, const std::vector<cv::Rect>& faces, const CannyParams& canny,
+	cv::Mat& skin, cv::Mat *edges = NULL);
+void candidateStage(const cv::Mat& skin, const HandFilter& filter, HandCandidates& candidates);
+// Around the candidates with GATED_CANNY, over the whole frame otherwise
+cv::Mat cannyStage(const cv::Mat& frame, const std::vector<cv::Rect>& candidateBoxes, const CannyParams& canny, int mergeEps);
+// Contour snapped to the edges, reusing previous frame's bending if there is one
+std::vector<cv::Point> bendStage(const std::vector<cv::Point>& contour, const cv::Mat& edges, int mergeEps,
+	const BentContour *previous = NULL);
+// Gallery if it isn't empty, the etalon otherwise. The hand is encoded in workDir, which
+// holds etalon.seq for StringCompare.exe unless SEQ_COMPARE_IN_PROCESS; gallery candidates
+// are compared in its GALLERY_MATCH_DIR. Throws std::exception if a tool fails.
+GalleryMatch identifyStage(const cv::Mat& applicant, const Gallery& gallery, const ShapeSequence& etalon, double threshold,
+	const QString& workDir, GalleryScratch& scratch);
+
+#endif // HANDSTAGES_H
@@ -0,0 +1,291 @@
+#include <QRunnable>
+#include <QFutureInterface>
+#include <QThreadStorage>
+#include <QDir>
+#include <QFileInfo>
+
+#include "IdentificationService.h"
+
+// Recognizer per service pool thread, each with its own BmpToSeq dir
+static QThreadStorage<Recognizer*> recognizers;
+static QAtomicInt recognizerCount;
+
+static Recognizer* threadRecognizer()
+{
+	if(!recognizers.hasLocalData())
+		recognizers.setLocalData(new Recognizer(HANDS_COMPARE_DIR + SERVICE_WORK_DIR +
+			QString::number(recognizerCount.fetchAndAddOrdered(1)) + "/"));
+	return recognizers.localData();
+}
+
+// process() on the service pool, watched through its future as a QtConcurrent::run one would be
+class IdentificationService::Task : public QRunnable, public QFutureInterface<ServiceResponse>
+{
+public:
+	Task(const Job& job)
+		: job(job) {}
+	QFuture<ServiceResponse> start(QThreadPool *pool)
+	{
+		setRunnable(this);
+		reportStarted();
+		QFuture<ServiceResponse> started = future();
+		pool->start(this);
+		return started;
+	}
+	void run()
+	{
+		if(!isCanceled())
+			reportResult(IdentificationService::process(job));
+		reportFinished();
+	}
+
+private:
+	Job job;
+};
+
+QByteArray encodeResponse(const ServiceResponse& response)
+{
+	ServiceResponseHeader header;
+	header.magic = SERVICE_RESPONSE_MAGIC;
+	header.id = response.id;
+	header.status = response.status;
+	header.handCount = (quint32)response.hands.size();
+	header.queueMs = response.queueMs;
+	header.skinMs = response.timings.skin;
+	header.cannyMs = response.timings.canny;
+	header.bendMs = response.timings.bend;
+	header.matchMs = response.timings.match;
+	header.totalMs = response.timings.total;
+	QByteArray data((const char*)&header, sizeof(header));
+	for(size_t k = 0; k < response.hands.size(); k++)
+	{
+		const HandResult& result = response.hands[k];
+		QByteArray identity = result.identity.toUtf8();
+		ServiceHand hand;
+		hand.dissimilarity = result.dissimilarity;
+		hand.x = result.bbox.x;
+		hand.y = result.bbox.y;
+		hand.width = result.bbox.width;
+		hand.height = result.bbox.height;
+		hand.matched = result.matched ? 1 : 0;
+		hand.identityBytes = identity.size();
+		data.append((const char*)&hand, sizeof(hand));
+		data.append(identity);
+	}
+	return data;
+}
+
+int decodeResponse(const QByteArray& data, ServiceResponse& response)
+{
+	if(data.size() < (int)sizeof(ServiceResponseHeader))
+		return 0;
+	ServiceResponseHeader header;
+	memcpy(&header, data.constData(), sizeof(header));
+	if(header.magic != SERVICE_RESPONSE_MAGIC)
+		return -1;
+	int position = sizeof(header);
+	std::vector<HandResult> hands;
+	for(quint32 k = 0; k < header.handCount; k++)
+	{
+		if(data.size() < position + (int)sizeof(ServiceHand))
+			return 0;
+		ServiceHand hand;
+		memcpy(&hand, data.constData() + position, sizeof(hand));
+		position += sizeof(hand);
+		if(data.size() < position + (int)hand.identityBytes)
+			return 0;
+		HandResult result;
+		result.identity = QString::fromUtf8(data.constData() + position, hand.identityBytes);
+		result.dissimilarity = hand.dissimilarity;
+		result.bbox = cv::Rect(hand.x, hand.y, hand.width, hand.height);
+		result.matched = hand.matched != 0;
+		hands.push_back(result);
+		position += hand.identityBytes;
+	}
+	response.id = header.id;
+	response.status = header.status;
+	response.queueMs = header.queueMs;
+	response.timings.skin = header.skinMs;
+	response.timings.canny = header.cannyMs;
+	response.timings.bend = header.bendMs;
+	response.timings.match = header.matchMs;
+	response.timings.total = header.totalMs;
+	response.hands = hands;
+	return position;
+}
+
+IdentificationService::IdentificationService(QObject *parent)
+	: QObject(parent)
+{
+	pool.setExpiryTimeout(-1);
+	server = new QLocalServer(this);
+	connect(server, SIGNAL(newConnection()), this, SLOT(newConnection()));
+
+	cv::Mat testImage, testMask;
+	if(loadSkinTest(testImage, testMask))
+		defaultLut = trainSkinLut(binColors(maskedSkin(testImage, testMask)));
+}
+
+IdentificationService::~IdentificationService()
+{
+	server->close();
+	foreach(QFutureWatcher<ServiceResponse> *watcher, pending.keys())
+		watcher->waitForFinished();
+}
+
+bool IdentificationService::listen(const QString& name)
+{
+	// A crashed instance may leave the socket behind
+	QLocalServer::removeServer(name);
+	return server->listen(name);
+}
+
+void IdentificationService::newConnection()
+{
+	while(QLocalSocket *socket = server->nextPendingConnection())
+	{
+		// At most one whole request is buffered, the rest waits in the pipe
+		socket->setReadBufferSize(sizeof(ServiceRequestHeader) + SERVICE_MAX_PAYLOAD);
+		connections.append(socket);
+		connect(socket, SIGNAL(readyRead()), this, SLOT(readRequests()));
+		connect(socket, SIGNAL(disconnected()), this, SLOT(disconnected()));
+		readRequests(socket);
+	}
+}
+
+void IdentificationService::readRequests()
+{
+	QLocalSocket *socket = qobject_cast<QLocalSocket*>(sender());
+	if(socket != NULL)
+		readRequests(socket);
+}
+
+// Takes whole requests while there is room in the pool. Beyond SERVICE_MAX_PENDING the data
+// stays in the socket, so a client that keeps writing blocks until requestDone reads again.
+void IdentificationService::readRequests(QLocalSocket *socket)
+{
+	while(pending.size() < SERVICE_MAX_PENDING && socket->bytesAvailable() >= (qint64)sizeof(ServiceRequestHeader))
+	{
+		Job job;
+		socket->peek((char*)&job.header, sizeof(job.header));
+		if(job.header.magic != SERVICE_REQUEST_MAGIC || job.header.payloadSize > (quint32)SERVICE_MAX_PAYLOAD)
+		{
+			ServiceResponse response;
+			response.id = job.header.id;
+			response.status = STATUS_BAD_REQUEST;
+			socket->write(encodeResponse(response));
+			socket->disconnectFromServer();
+			return;
+		}
+		if(socket->bytesAvailable() < (qint64)(sizeof(job.header) + job.header.payloadSize))
+			return;
+		socket->read(sizeof(job.header));
+		job.payload = socket->read(job.header.payloadSize);
+		job.defaultLut = defaultLut;
+		job.queued.start();
+
+		QFutureWatcher<ServiceResponse> *watcher = new QFutureWatcher<ServiceResponse>(this);
+		connect(watcher, SIGNAL(finished()), this, SLOT(requestDone()));
+		pending.insert(watcher, socket);
+		watcher->setFuture((new Task(job))->start(&pool));
+	}
+}
+
+void IdentificationService::requestDone()
+{
+	QFutureWatcher<ServiceResponse> *watcher = static_cast<QFutureWatcher<ServiceResponse>*>(sender());
+	QPointer<QLocalSocket> socket = pending.take(watcher);
+	if(!socket.isNull() && socket->state() == QLocalSocket::ConnectedState)
+		socket->write(encodeResponse(watcher->result()));
+	watcher->deleteLater();
+	foreach(QLocalSocket *connection, connections)
+		readRequests(connection);
+}
+
+void IdentificationService::disconnected()
+{
+	QLocalSocket *socket = qobject_cast<QLocalSocket*>(sender());
+	if(socket == NULL)
+		return;
+	connections.removeAll(socket);
+	socket->deleteLater();
+}
+
+ServiceResponse IdentificationService::process(const Job& job)
+{
+	ServiceResponse response;
+	response.id = job.header.id;
+	response.queueMs = (float)job.queued.elapsed();
+
+	cv::Mat frame;
+	if(job.header.kind == REQUEST_PATH) {
+		frame = loadImage(QString::fromUtf8(job.payload.constData(), job.payload.size()));
+	} else if(job.header.kind == REQUEST_FRAME && job.payload.size() >= 2 * (int)sizeof(qint32)) {
+		qint32 size[2];
+		memcpy(size, job.payload.constData(), sizeof(size));
+		const qint64 pixels = (qint64)size[0] * size[1];
+		const qint64 bytes = job.payload.size() - (int)sizeof(size);
+		if(size[0] <= 0 || size[1] <= 0 || (bytes != pixels * 3 && bytes != pixels * 4))
+		{
+			response.status = STATUS_BAD_REQUEST;
+			return response;
+		}
+		// Wraps the payload, the pipeline only reads the frame and takes BGRA as is
+		frame = cv::Mat(size[0], size[1], (bytes == pixels * 3) ? CV_8UC3 : CV_8UC4, (void*)(job.payload.constData() + sizeof(size)));
+	} else {
+		response.status = STATUS_BAD_REQUEST;
+		return response;
+	}
+	if(frame.data == NULL || (frame.type() != CV_8UC3 && frame.type() != CV_8UC4))
+	{
+		response.status = STATUS_NO_IMAGE;
+		return response;
+	}
+
+	cv::Mat lut = job.defaultLut;
+	if(job.header.skinWidth > 0 && job.header.skinHeight > 0)
+	{
+		cv::Rect skinRect = cv::Rect(job.header.skinX, job.header.skinY, job.header.skinWidth, job.header.skinHeight) &
+			cv::Rect(0, 0, frame.cols, frame.rows);
+		lut = (skinRect.area() > 0) ? trainSkinLut(binColors(frame(skinRect))) : cv::Mat();
+	}
+	if(lut.empty())
+	{
+		response.status = STATUS_NO_SKIN_MODEL;
+		return response;
+	}
+
+	try {
+		response.hands = threadRecognizer()->recognize(frame, lut, response.timings);
+		response.status = STATUS_OK;
+	} catch(std::exception&) {
+		response.status = STATUS_FAILED;
+	}
+	return response;
+}
+
+bool queryService(const QString& imagePath, ServiceResponse& response, const QString& name)
+{
+	QLocalSocket socket;
+	socket.connectToServer(name);
+	if(!socket.waitForConnected(SERVICE_TIMEOUT))
+		return false;
+	QByteArray path = QFileInfo(imagePath).absoluteFilePath().toUtf8();
+	ServiceRequestHeader header;
+	header.magic = SERVICE_REQUEST_MAGIC;
+	header.id = 1;
+	header.kind = REQUEST_PATH;
+	header.skinX = header.skinY = header.skinWidth = header.skinHeight = 0;
+	header.payloadSize = path.size();
+	socket.write((const char*)&header, sizeof(header));
+	socket.write(path);
+	QByteArray data;
+	int used = 0;
+	while(used == 0 && socket.waitForReadyRead(SERVICE_TIMEOUT))
+	{
+		data.append(socket.readAll());
+		used = decodeResponse(data, response);
+	}
+	socket.disconnectFromServer();
+	return used > 0;
+}
@@ -0,0 +1,122 @@
+#ifndef IDENTIFICATIONSERVICE_H
+#define IDENTIFICATIONSERVICE_H
+
+#include <QObject>
+#include <QHash>
+#include <QPointer>
+#include <QTime>
+#include <QFutureWatcher>
+#include <QThreadPool>
+#include <QtNetwork/QLocalServer>
+#include <QtNetwork/QLocalSocket>
+
+#include "general.h"
+#include "Recognizer.h"
+
+// Binary protocol over a local socket, native byte order.
+// Request: ServiceRequestHeader + payload, response: ServiceResponseHeader + handCount x (ServiceHand + identity UTF-8).
+// Responses carry the request id and may come out of order, requests of one connection run concurrently.
+const quint32 SERVICE_REQUEST_MAGIC = 0x51524850; // "PHRQ"
+const quint32 SERVICE_RESPONSE_MAGIC = 0x53524850; // "PHRS"
+
+enum ServiceRequestKind
+{
+	REQUEST_FRAME, // payload: qint32 rows, cols, then rows * cols BGR or BGRA pixels
+	REQUEST_PATH // payload: UTF-8 image path readable by the service
+};
+
+enum ServiceStatus
+{
+	STATUS_OK,
+	STATUS_BAD_REQUEST,
+	STATUS_NO_IMAGE,
+	STATUS_NO_SKIN_MODEL, // No skin rect given and the service has no default model
+	STATUS_FAILED
+};
+
+struct ServiceRequestHeader
+{
+	quint32 magic;
+	quint32 id;
+	quint32 kind;
+	qint32 skinX, skinY, skinWidth, skinHeight; // Skin patch to train on, width 0 - default model
+	quint32 payloadSize;
+};
+
+struct ServiceResponseHeader
+{
+	quint32 magic;
+	quint32 id;
+	qint32 status;
+	quint32 handCount;
+	float queueMs, skinMs, cannyMs, bendMs, matchMs, totalMs;
+};
+
+struct ServiceHand
+{
+	double dissimilarity;
+	qint32 x, y, width, height;
+	quint32 matched;
+	quint32 identityBytes;
+};
+
+struct ServiceResponse
+{
+	ServiceResponse()
+		: id(0), status(STATUS_FAILED), queueMs(0) {}
+	quint32 id;
+	int status;
+	float queueMs;
+	RecognitionTimings timings;
+	std::vector<HandResult> hands;
+};
+
+QByteArray encodeResponse(const ServiceResponse& response);
+// Returns bytes used, 0 if data doesn't hold a whole response yet, -1 if it's broken
+int decodeResponse(const QByteArray& data, ServiceResponse& response);
+
+// Headless identification daemon: reads requests, runs Recognizer on its own thread pool
+// (one per worker thread) and writes typed results back.
+class IdentificationService : public QObject
+{
+	Q_OBJECT
+
+public:
+	IdentificationService(QObject *parent = 0);
+	~IdentificationService();
+	bool listen(const QString& name = SERVICE_NAME);
+	QString errorString() const
+		{ return server->errorString(); }
+	bool hasDefaultSkinModel() const
+		{ return !defaultLut.empty(); }
+
+private slots:
+	void newConnection();
+	void readRequests();
+	void disconnected();
+	void requestDone();
+
+private:
+	struct Job
+	{
+		ServiceRequestHeader header;
+		QByteArray payload;
+		cv::Mat defaultLut;
+		QTime queued;
+	};
+	class Task;
+	void readRequests(QLocalSocket *socket);
+	static ServiceResponse process(const Job& job);
+
+	// Threads never expire: each keeps its Recognizer, work dir and gallery view
+	QThreadPool pool;
+	QLocalServer *server;
+	cv::Mat defaultLut; // Trained on the SKIN_TEST_DIR image, may be empty
+	QList<QLocalSocket*> connections;
+	QHash<QFutureWatcher<ServiceResponse>*, QPointer<QLocalSocket> > pending;
+};
+
+// Blocking local client, for --query and tests
+bool queryService(const QString& imagePath, ServiceResponse& response, const QString& name = SERVICE_NAME);
+
+#endif // IDENTIFICATIONSERVICE_H
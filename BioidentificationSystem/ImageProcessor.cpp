@@ -1,10 +1,17 @@
 #include <time.h>
 #include <QMetaType>
+#include <QtConcurrentRun>
+#include <QDir>
+#include <QTextStream>
+#include <QDateTime>
 
 #include "ImageProcessor.h"
+#include "Scheduler.h"
 
 ImageProcessor::ImageProcessor(QObject *parent)
 	: Camera(parent),
+	stageCache(INPUT_COUNT, STAGE_COUNT),
+	nextFaceId(0),
 	pixelClassifierTrained(false),
 	isPhotoMode(false),
 	photoProcessingMode(false)
@@ -15,27 +22,124 @@ ImageProcessor::ImageProcessor(QObject *parent)
 	aperture = APERTURE;
 	cannyContourMergeEps = CANNY_CONTOUR_MERGE_EPS;
 	handThreshold = HAND_THRESHOLD / 100.0;
+	galleryLoaded = false;
+	matchThreshold = 0;
+	bendedContours = false;
+	previousBendEps = cannyContourMergeEps;
+	declareStages();
 	approxPoly = APPROX_POLY;
 	topHandThres = TOP_HAND_THRES;
 	qRegisterMetaType<ImageProcessor::States>("ImageProcessor::States");
+	loadSkinTest(skinTestImage, skinTestMask);
+	enrollment = new Enrollment(this);
+	connect(enrollment, SIGNAL(progress(int, int)), this, SLOT(enrollmentProgress(int, int)));
+	connect(enrollment, SIGNAL(finished()), this, SLOT(enrollmentFinished()));
+}
+
+ImageProcessor::~ImageProcessor()
+{
+	for(int k = 0; k < trainWatchers.size(); k++)
+		trainWatchers[k]->waitForFinished();
+}
+
+bool ImageProcessor::isTrainingPixelClassifier()
+{
+	for(int k = 0; k < trainWatchers.size(); k++)
+		if(trainWatchers[k]->isRunning())
+			return true;
+	return false;
 }
 
 void ImageProcessor::imageProcState(bool state)
 {
 	if(state){
-		logFile = fopen(logFileName, "w");
+		openLog();
 		stop = false;
 		startState = GET_FRAME;
 		pixelClassifierTrained = false;
 		isPhotoMode = true;
 		processImage(OPEN_CAM);
 	} else {
-		fclose(logFile);
 		cv::destroyAllWindows();
 		processImage(CLOSE_CAM);
 	}
 }
 
+// log.txt of this run, one left open by a run that didn't close is closed first
+void ImageProcessor::openLog()
+{
+	if(logFile != NULL)
+		fclose(logFile);
+	logFile = fopen(logFileName, "w");
+}
+
+void ImageProcessor::setPhotoProcessingMode(bool mode)
+{
+	if(photoProcessingMode == mode)
+		return;
+	photoProcessingMode = mode;
+	stageCache.touch(INPUT_PHOTO_MODE);
+}
+
+void ImageProcessor::processPhoto(const cv::Mat& photo, const cv::Rect& skinRect)
+{
+	pendingPhotoMutex.lock();
+	pendingPhoto = photo.clone();
+	pendingSkinColor = photo(skinRect).clone();
+	pendingSkinRect = skinRect;
+	pendingPhotoMutex.unlock();
+	QMetaObject::invokeMethod(this, "startPhotoProcessing", Qt::QueuedConnection);
+}
+
+void ImageProcessor::startPhotoProcessing()
+{
+	pendingPhotoMutex.lock();
+	setFrame(pendingPhoto);
+	// A still photo has nothing in common with the bends of the last frame
+	previousBends.clear();
+	setSkinColor(pendingSkinColor);
+	setSkinColorRect(pendingSkinRect);
+	pendingPhoto.release();
+	pendingSkinColor.release();
+	pendingPhotoMutex.unlock();
+	setPhotoProcessingMode(true);
+	stop = false;
+	startState = TRAIN_PIXEL_CLASSIFIER;
+	processImage(TRAIN_PIXEL_CLASSIFIER);
+}
+
+void ImageProcessor::stopPhotoProcessing()
+{
+	// Polled by the states, as the camera switch does
+	stop = true;
+	QMetaObject::invokeMethod(this, "endPhotoProcessing", Qt::QueuedConnection);
+}
+
+void ImageProcessor::endPhotoProcessing()
+{
+	setPhotoProcessingMode(false);
+}
+
+void ImageProcessor::setSkinSample(const cv::Mat& photo, const cv::Rect& skinRect)
+{
+	pendingPhotoMutex.lock();
+	pendingSkinColor = photo(skinRect).clone();
+	pendingSkinRect = skinRect;
+	pendingPhotoMutex.unlock();
+	QMetaObject::invokeMethod(this, "takeSkinSample", Qt::QueuedConnection);
+}
+
+void ImageProcessor::takeSkinSample()
+{
+	pendingPhotoMutex.lock();
+	if(!pendingSkinColor.empty()) {
+		setSkinColor(pendingSkinColor);
+		setSkinColorRect(pendingSkinRect);
+		pendingSkinColor.release();
+	}
+	pendingPhotoMutex.unlock();
+}
+
 void ImageProcessor::setPhotoMode(bool mode)
 {
 	isPhotoMode = mode;
@@ -52,12 +156,15 @@ void ImageProcessor::takePhoto()
 	emit photoTaken();
 }
 
-cv::Rect ImageProcessor::getFaceRect()
+std::vector<cv::Rect> ImageProcessor::getFaceRects()
 {
+	std::vector<cv::Rect> rects;
 	faceSkinRectMutex.lock();
-	cv::Rect rect = faceRect;
+	for(size_t k = 0; k < faces.size(); k++)
+		if(faces[k].misses == 0)
+			rects.push_back(faces[k].rect);
 	faceSkinRectMutex.unlock();
-	return rect;
+	return rects;
 }
 
 cv::Rect ImageProcessor::getSkinRect()
@@ -133,6 +240,19 @@ void ImageProcessor::processImage(ImageProcessor::States state)
 		stop = true;
 		nextState = STOP;
 		Camera::close();
+		if(player.isOpen()) {
+			emit postMessage(QString("Replay finished: %1 frames in %2 s.").arg(replayFrames).arg(replayTimer.elapsed() / 1000.0, 0, 'f', 1));
+			player.close();
+		}
+		if(ring.isAttached()) {
+			emit postMessage(QString("Shared frames: %1 processed, %2 dropped, %3 overwritten while copied.")
+				.arg(ring.frames()).arg(ring.dropped()).arg(ring.overwritten()));
+			ring.detach();
+		}
+		if(logFile != NULL) {
+			fclose(logFile);
+			logFile = NULL;
+		}
 		emit closed();
 		break;
 	case OPEN_CAM:
@@ -148,13 +268,14 @@ void ImageProcessor::processImage(ImageProcessor::States state)
 		break;
 	case GET_FRAME:
 		allStartTime = startTime = clock();
-		if(!Camera::isOpened()) {
+		if(!Camera::isOpened() && !player.isOpen() && !ring.isAttached()) {
 			stop = true;
 			nextState = STOP;
-		} else if(!Camera::takeFrame()) {
-			emit error("Can't read frame.", QMessageBox::Warning);
+		} else if(!takeFrame()) {
+			if(!player.isOpen() && !ring.isAttached())
+				emit error("Can't read frame.", QMessageBox::Warning);
 			nextState = CLOSE_CAM;
-		} else if(!stop && isPhotoMode) {
+		} else if(!stop && isPhotoMode && !player.isOpen()) {
 			emit stateCompleted(GET_FRAME);
 			nextState = GET_FRAME;
 		} else if(!stop) {
@@ -175,7 +296,6 @@ void ImageProcessor::processImage(ImageProcessor::States state)
 		} else if(face.data == NULL) {
 			if(!stop && !isPhotoMode)
 				emit postMessage("Face has been LOST.");
-			pixelClassifierTrained = false;
 			nextState = GET_FRAME;
 		} else {
 			if(!stop && !isPhotoMode)
@@ -194,10 +314,15 @@ void ImageProcessor::processImage(ImageProcessor::States state)
 		getSkinColor();
 		if(!stop && !isPhotoMode)
 			emit stateCompleted(GET_SKIN_COLOR);
-		if(!pixelClassifierTrained)
-			nextState = TRAIN_PIXEL_CLASSIFIER;
-		else
-			nextState = PIXEL_RECOGNITION;
+		nextState = PIXEL_RECOGNITION;
+		for(size_t k = 0; k < faces.size(); k++) {
+			// Retrain requested or drifted too far for per-frame updates
+			if(!pixelClassifierTrained || faces[k].skinModel.drifted())
+				faces[k].trained = false;
+			if(!faces[k].trained && !faces[k].training && faces[k].misses == 0)
+				nextState = TRAIN_PIXEL_CLASSIFIER;
+		}
+		pixelClassifierTrained = true;
 		if(DEBUG)
 			writeTime("GET_SKIN_COLOR", ((float)(clock()-startTime))/CLOCKS_PER_SEC);
 		break;
@@ -207,11 +332,9 @@ void ImageProcessor::processImage(ImageProcessor::States state)
 			nextState = STOP;
 			break;
 		}
-		if(!trainPixelClassifier()) {
-			emit error("Training pixel classifier failed.", QMessageBox::Critical);
-			nextState = CLOSE_CAM;
-		} else 
-			nextState = PIXEL_RECOGNITION;
+		// Faces still training are skipped, they get their model when it is ready
+		trainPixelClassifier();
+		nextState = PIXEL_RECOGNITION;
 		if(DEBUG)
 			writeTime("TRAIN_PIXEL_CLASSIFIER", ((float)(clock()-startTime))/CLOCKS_PER_SEC);
 		break;
@@ -223,7 +346,11 @@ void ImageProcessor::processImage(ImageProcessor::States state)
 		}
 		if(ADVANCED_OUTPUT)
 			cv::imshow("PIXEL_RECOGNITION", classifiedSkin);
-		pixelRecognition();
+		if(!pixelRecognition()) {
+			// First model is not ready yet
+			nextState = startState;
+			break;
+		}
 		if(!stop && !isPhotoMode)
 			emit stateCompleted(PIXEL_RECOGNITION);
 		nextState = CANNY;
@@ -279,27 +406,25 @@ void ImageProcessor::processImage(ImageProcessor::States state)
 
 bool ImageProcessor::findFace()
 {
-	if(faceCascade.empty() && !faceCascade.load(FACE_CASCADE_NAME.toStdString()))
+	std::vector<cv::Rect> detected;
+	cv::Mat frameGray;
+	toGray(frame, frameGray);
+	cv::equalizeHist(frameGray, frameGray);
+	if(!FaceDetector::detect(frameGray, detected))
 		return false;
-	try {
-		std::vector<cv::Rect> faces;
-		cv::Mat frameGray;
-		cv::cvtColor(frame, frameGray, cv::COLOR_BGR2GRAY);
-		cv::equalizeHist(frameGray, frameGray);
-		faceCascade.detectMultiScale(frameGray, faces, 1.1, 2, 0|cv::CASCADE_SCALE_IMAGE, cv::Size(30, 30));
-		faceSkinRectMutex.lock();
-		faceRect = cv::Rect();
-		face.release();
-		if(!faces.empty())
-		{
-			foreach(const cv::Rect& curFace, faces)
-				if(curFace.area() > faceRect.area())
-					faceRect = curFace;
-			face = frame(faceRect).clone();
-			cv::resize(face, face, cv::Size(FACE_WIDTH, FACE_HEIGHT));
+	faceSkinRectMutex.lock();
+	trackFaces(faces, detected, nextFaceId);
+	face.release();
+	cv::Rect largest;
+	for(size_t k = 0; k < faces.size(); k++)
+	{
+		if(faces[k].misses > 0)
+			continue;
+		cv::resize(frame(faces[k].rect), faces[k].face, cv::Size(FACE_WIDTH, FACE_HEIGHT));
+		if(faces[k].rect.area() > largest.area()) {
+			largest = faces[k].rect;
+			face = faces[k].face;
 		}
-	} catch(cv::Exception& e) {
-		qDebug() << e.what();
 	}
 	faceSkinRectMutex.unlock();
 	return true;
@@ -308,142 +433,278 @@ bool ImageProcessor::findFace()
 void ImageProcessor::getSkinColor()
 {
 	faceSkinRectMutex.lock();
-	skinRect = cv::Rect(cv::Point(FACE_WIDTH*0.3, FACE_HEIGHT*0.5), cv::Point(FACE_WIDTH*0.7, FACE_HEIGHT*0.64));
+	skinRect = faceSkinRect();
+	QtConcurrent::blockingMap(faces, sampleFaceSkin);
 	faceSkinRectMutex.unlock();
 	skinColor = face(skinRect).clone();
 }
 
 bool ImageProcessor::trainPixelClassifier()
 {
-	std::vector<Pixel> pixels;
-	for(int i = 0; i < skinColor.rows; i++)
-	{
-		for(int j = 0; j < skinColor.cols; j++)
-		{
-			cv::Vec3b bgrPixel = skinColor.at<cv::Vec3b>(i, j);
-			pixels.push_back(Pixel(bgrPixel.val[2], bgrPixel.val[1], bgrPixel.val[0]));
+	int started = 0;
+	if(photoProcessingMode) {
+		if(pixelClassifierTrained || isTrainingPixelClassifier())
+			return false;
+		// Single still photo, nothing to accumulate
+		skinModel.resetHistogram();
+		std::vector<ColorBin> bins = binColors(skinColor);
+		if(bins.empty())
+			return false;
+		// Trained or training, pixelClassifierReady resets it if training fails
+		pixelClassifierTrained = true;
+		startTraining(bins, -1);
+		started++;
+	} else {
+		// Replay applies the recorded models at the frames they were deployed at
+		if(player.isOpen())
+			return false;
+		for(size_t k = 0; k < faces.size(); k++) {
+			if(faces[k].trained || faces[k].training || faces[k].misses > 0)
+				continue;
+			std::vector<ColorBin> bins = faces[k].skinModel.bins();
+			if(bins.empty())
+				continue;
+			// trained is set when the model is ready, a failed training is retried
+			faces[k].training = true;
+			startTraining(bins, faces[k].id);
+			started++;
 		}
 	}
-	pixelClassifierTrained  = pixelClassifier.train(pixels, paramS, 1, 0.001);
-	if(!pixelClassifierTrained)
+	if(started == 0)
 		return false;
+	emit trainingStateChanged("Training pixel classifier...");
 	return true;
 }
 
-void ImageProcessor::pixelRecognition()
+void ImageProcessor::startTraining(const std::vector<ColorBin>& bins, int faceId)
+{
+	// Child of this, so it lives in WORKER thread with the processor
+	QFutureWatcher<TrainingResult> *watcher = new QFutureWatcher<TrainingResult>(this);
+	connect(watcher, SIGNAL(finished()), this, SLOT(pixelClassifierReady()));
+	trainWatchers.append(watcher);
+	watcher->setFuture(QtConcurrent::run(&ImageProcessor::trainClassifier, bins, paramS, faceId));
+}
+
+TrainingResult ImageProcessor::trainClassifier(std::vector<ColorBin> bins, int paramS, int faceId)
+{
+	TrainingResult result;
+	result.faceId = faceId;
+	clock_t trainStartTime = clock();
+	std::vector<Pixel> pixels = buildTrainingSet(bins);
+	PixelClassifier classifier;
+	if(!classifier.train(pixels, paramS, 1, 0.001))
+		return result;
+	result.lut = SkinColorModel::buildLut(classifier);
+	result.samples = (int)pixels.size();
+	result.time = ((float)(clock()-trainStartTime))/CLOCKS_PER_SEC;
+	return result;
+}
+
+void ImageProcessor::pixelClassifierReady()
+{
+	QFutureWatcher<TrainingResult> *watcher = static_cast<QFutureWatcher<TrainingResult>*>(sender());
+	if(!trainWatchers.removeOne(watcher))
+		return;
+	TrainingResult trained = watcher->result();
+	watcher->deleteLater();
+	if(trained.lut.empty()) {
+		for(size_t k = 0; k < faces.size(); k++)
+			if(faces[k].id == trained.faceId)
+				faces[k].training = false;
+		emit trainingStateChanged("Training pixel classifier failed.");
+		// Photo processing has no classifier: stop, the next run trains again
+		if(trained.faceId < 0) {
+			pixelClassifierTrained = false;
+			if(photoProcessingMode)
+				stop = true;
+			emit error("Training pixel classifier failed.", QMessageBox::Warning);
+		}
+		// Face stays untrained and is trained again while it is visible
+		return;
+	}
+	// A still photo has no next frame
+	if(photoProcessingMode)
+		deployModel(trained);
+	else
+		readyModels.push_back(trained);
+}
+
+// Models switch between frames, so a recorded session replays them at the same frame
+void ImageProcessor::deployReadyModels()
+{
+	for(size_t k = 0; k < readyModels.size(); k++)
+		deployModel(readyModels[k]);
+	readyModels.clear();
+}
+
+void ImageProcessor::deployModel(TrainingResult trained)
+{
+	FaceTrack *track = NULL;
+	for(size_t k = 0; k < faces.size(); k++)
+		if(faces[k].id == trained.faceId)
+			track = &faces[k];
+	// Face is gone, nothing to deploy the model to
+	if(trained.faceId >= 0 && track == NULL)
+		return;
+	recorder.model(trained.faceId, trained.lut);
+	stageCache.touch(INPUT_SKIN_LUT);
+	// Accuracy of what classifies frames: trained table OR observed colours
+	cv::Mat deployed;
+	if(track == NULL) {
+		skinModel.setClassifierLut(trained.lut);
+		deployed = skinModel.getLut();
+	} else {
+		track->training = false;
+		track->trained = true;
+		track->skinModel.setClassifierLut(trained.lut);
+		deployed = track->skinModel.getLut();
+	}
+	if(!skinTestImage.empty())
+		trained.accuracy = lutAccuracy(deployed, skinTestImage, skinTestMask);
+	QString state = player.isOpen() ? QString("Recorded pixel classifier applied.") :
+		QString("Pixel classifier trained in %1 s on %2 colours.").arg(trained.time, 0, 'f', 3).arg(trained.samples);
+	if(trained.accuracy >= 0)
+		state += QString(" Held-out accuracy: %1%.").arg(trained.accuracy * 100, 0, 'f', 1);
+	emit trainingStateChanged(state);
+	if(DEBUG) {
+		writeTime("PIXEL_CLASSIFIER_TRAINING", trained.time);
+		writeTime("PIXEL_CLASSIFIER_ACCURACY", trained.accuracy);
+	}
+}
+
+// Union of trained skin models, empty until the first one is ready
+cv::Mat ImageProcessor::skinLut()
 {
+	if(photoProcessingMode)
+		return skinModel.hasClassifierLut() ? skinModel.getLut() : cv::Mat();
+	return trackedSkinLut(faces);
+}
+
+bool ImageProcessor::pixelRecognition()
+{
+	cv::Mat lut = skinLut();
+	if(lut.empty())
+		return false;
+	if(stageCache.fresh(STAGE_PIXEL_RECOGNITION))
+		return true;
 	classifiedSkinMutex.lock();
 	colorizedFrame = frame.clone();
-	classifiedSkin = cv::Mat(frame.rows, frame.cols, CV_8UC1);
-	classifiedSkin.setTo(cv::Scalar(0));
-	#pragma omp parallel num_threads(OPENMP_THREADS)
-	{
-		#pragma omp for
-		for(int i = 0; i < frame.rows; i++)
-		{
-			for(int j = 0; j < frame.cols; j++)
-			{
-				cv::Vec3b bgrPixel = frame.at<cv::Vec3b>(i, j);
-				if(faceRect.contains(cv::Point(j, i)))
-					continue;
-				if( pixelClassifier.classify(Pixel(bgrPixel.val[2], bgrPixel.val[1], bgrPixel.val[0])) )
-				{
-					classifiedSkin.at<uchar>(i, j) = 255;
-					colorizedFrame.at<cv::Vec3b>(i, j) = cv::Vec3b(0, 255, 0);
-				}
-			}
-		}
+	// A tiled pass brings Canny along, doCanny finds it fresh
+	cv::Mat edges;
+	skinStage(frame, lut, handFilter().faces, cannyParams(), classifiedSkin, stageCache.fresh(STAGE_CANNY) ? NULL : &edges);
+	if(!edges.empty()) {
+		cannyEdgesMutex.lock();
+		cannyEdges = edges;
+		cannyEdgesMutex.unlock();
+		stageCache.computed(STAGE_CANNY);
 	}
+	colorizedFrame.setTo(cv::Scalar(0, 255, 0), classifiedSkin);
 	classifiedSkinMutex.unlock();
+	stageCache.computed(STAGE_PIXEL_RECOGNITION);
+	return true;
 }
 
 void ImageProcessor::doCanny()
 {
-	cv::Mat frameGray;
-	cv::cvtColor(frame, frameGray, cv::COLOR_BGR2GRAY);
-	cv::blur(frameGray, frameGray, cv::Size(3,3));
+	if(stageCache.fresh(STAGE_CANNY))
+		return;
+	std::vector<cv::Rect> gates;
+	if(GATED_CANNY)
+		gates = handCandidates().boxes;
+	cv::Mat edges = cannyStage(frame, gates, cannyParams(), cannyContourMergeEps);
 	cannyEdgesMutex.lock();
-	cv::Canny(frameGray, cannyEdges, lowThreshold, lowThreshold*ratio, aperture);
+	cannyEdges = edges;
 	cannyEdgesMutex.unlock();
+	stageCache.computed(STAGE_CANNY);
+}
+
+const HandCandidates& ImageProcessor::handCandidates()
+{
+	if(!stageCache.fresh(STAGE_CANDIDATES)) {
+		candidateStage(classifiedSkin, handFilter(), candidates);
+		stageCache.computed(STAGE_CANDIDATES);
+	}
+	return candidates;
+}
+
+void ImageProcessor::declareStages()
+{
+	// Photo mode picks the skin model (skinLut) and the candidates (handFilter)
+	stageCache.depends(STAGE_PIXEL_RECOGNITION, INPUT_FRAME);
+	stageCache.depends(STAGE_PIXEL_RECOGNITION, INPUT_SKIN_LUT);
+	stageCache.depends(STAGE_PIXEL_RECOGNITION, INPUT_PHOTO_MODE);
+	// The skin and the hand size window (topHandThres)
+	int candidateInputs[] = { INPUT_FRAME, INPUT_SKIN_LUT, INPUT_BEND_PARAMS, INPUT_PHOTO_MODE };
+	for(int k = 0; k < 4; k++)
+		stageCache.depends(STAGE_CANDIDATES, candidateInputs[k]);
+	stageCache.depends(STAGE_CANNY, INPUT_FRAME);
+	stageCache.depends(STAGE_CANNY, INPUT_CANNY_PARAMS);
+	if(GATED_CANNY) {
+		// Gates come from the skin candidates and the merge eps
+		stageCache.depends(STAGE_CANNY, INPUT_SKIN_LUT);
+		stageCache.depends(STAGE_CANNY, INPUT_BEND_PARAMS);
+		stageCache.depends(STAGE_CANNY, INPUT_PHOTO_MODE);
+	}
+	int bendInputs[] = { INPUT_FRAME, INPUT_SKIN_LUT, INPUT_CANNY_PARAMS, INPUT_BEND_PARAMS, INPUT_PHOTO_MODE };
+	for(int k = 0; k < 5; k++) {
+		stageCache.depends(STAGE_BEND, bendInputs[k]);
+		stageCache.depends(STAGE_MATCH, bendInputs[k]);
+	}
+	stageCache.depends(STAGE_MATCH, INPUT_GALLERY);
 }
 
+// Candidates and bending, matching and drawing are separate stages:
+// the threshold only redraws, merge eps re-bends and re-matches.
 bool ImageProcessor::handRecognition()
 {
 	recognizedHandMutex.lock();
-	cv::cvtColor(classifiedSkin, bended, CV_GRAY2RGB);
-	recognizedHand = frame.clone();
-	dissimilarityMeasure.clear();
-	std::vector<QString>().swap(dissimilarityMeasure);
-	std::vector<std::vector<cv::Point>> contours;
-	cv::findContours(classifiedSkin, contours, CV_RETR_EXTERNAL, CV_CHAIN_APPROX_NONE);
-	std::vector<std::vector<cv::Point>> mergedContours = contours;
-	for( int i = 0; i < contours.size(); i++ ) {
-		cv::Rect boundRect = cv::boundingRect(cv::Mat(contours[i]));
-		if( (boundRect.width > MIN_WH) && (boundRect.height > MIN_WH) && 
-			(photoProcessingMode ||
-			((boundRect.width > (faceRect.width * 0.5)) && (boundRect.height > (faceRect.height * 0.5)) &&
-			(boundRect.width < (faceRect.width * topHandThres)) && (boundRect.height < (faceRect.height * topHandThres))))) 
-		{
+	if(bendedContours != SHOW_CONTOURS)
+		stageCache.touch(INPUT_BEND_PARAMS);
+	if(!stageCache.fresh(STAGE_BEND))
+	{
+		cv::cvtColor(classifiedSkin, bended, CV_GRAY2RGB);
+		// Filter candidates on component stats, trace contours only for the survivors
+		const HandCandidates& candidates = handCandidates();
+		candidateContours.clear();
+		for(size_t c = 0; c < candidates.size(); c++)
+			candidateContours.push_back(candidates.contour(c));
+		mergedContours = candidateContours;
+		applicants.clear();
+		if(previousBendEps != cannyContourMergeEps)
+			previousBends.clear();
+		applicants.resize(candidateContours.size());
+		clock_t bendingStartTime = clock();
+		parallelFor(0, (int)candidateContours.size(), this, &ImageProcessor::bendCandidates, 1);
+		if(DEBUG)
+			writeTime("BENDING", ((float)(clock()-bendingStartTime))/CLOCKS_PER_SEC);
+		for( int i = 0; i < candidateContours.size(); i++ ) {
 			if(SHOW_CONTOURS)
 			{
-				clock_t bendingStartTime = clock();
-				int startPoint = 0;
-				cv::Point assignedPoint(-1, -1);
-				// Find start point
-				for(int point = 0; point < contours[i].size(); point++) {
-					if(cannyEdges.at<uchar>(contours[i][point]) > 0) {
-						startPoint = point;
-						assignedPoint = contours[i][point];
-						break;
-					}
-					cv::Point nearestCannyPoint = getNearestCannyPoint(contours[i][point]);
-					if(nearestCannyPoint == cv::Point(-1, -1))
-						continue;
-					if(assignedPoint == cv::Point(-1, -1)) {
-						startPoint = point;
-						assignedPoint = nearestCannyPoint;
-					} else {
-						if( (abs(nearestCannyPoint.x - contours[i][point].x) + abs(nearestCannyPoint.y - contours[i][point].y)) < 
-							(abs(assignedPoint.x - contours[i][startPoint].x) + abs(assignedPoint.y - contours[i][startPoint].y)) ) 
-						{
-								startPoint = point;
-								assignedPoint = nearestCannyPoint;
-						}
-					}
-				}
-				// Bypass contour
-				if(assignedPoint != cv::Point(-1, -1)) {
-					cv::Point prevAssignedP = assignedPoint;
-					for(int point = startPoint+1; point < contours[i].size(); point++) {
-						mergeLogic(contours[i], mergedContours[i], point, prevAssignedP);
-					}
-					prevAssignedP = assignedPoint;
-					for(int point = startPoint-1; point >= 0; point--) {
-						mergeLogic(contours[i], mergedContours[i], point, prevAssignedP);
-					}
-				}
-				
-				if(DEBUG) {
-					writeTime("BENDING", ((float)(clock()-bendingStartTime))/CLOCKS_PER_SEC);
-				}
-
 				// Contour filling. White color
 				cv::drawContours(bended, mergedContours, i, cv::Scalar(255, 255, 255), -1);
+				cv::drawContours(bended, candidateContours, i, cv::Scalar(0, 0, 255), 1);
+				cv::drawContours(bended, mergedContours, i, cv::Scalar(0, 255, 0), 1);
 			}
-			boundRect = cv::boundingRect(cv::Mat(mergedContours[i]));
-			cv::Mat applicant(bended.rows, bended.cols, CV_8UC3);
-			cv::drawContours(applicant, mergedContours, i, cv::Scalar(255, 255, 255), -1);
-			applicant = applicant(boundRect).clone();
-			cv::Mat applicantClone;
-			cv::cvtColor(applicant, applicantClone, CV_BGR2GRAY);
-			std::vector<std::vector<cv::Point>> applicantContours;
-			cv::findContours(applicantClone, applicantContours, CV_RETR_EXTERNAL, CV_CHAIN_APPROX_NONE);
-			cv::drawContours(applicant, applicantContours, -1, cv::Scalar(255, 255, 255), -1);
-			onePixelBorder(applicant);
-			QString result;
+		}
+		previousBends.clear();
+		if(SHOW_CONTOURS && INCREMENTAL_BENDING)
+			for(size_t i = 0; i < candidateContours.size(); i++)
+				previousBends.push_back(bentContour(candidateContours[i], mergedContours[i]));
+		previousBendEps = cannyContourMergeEps;
+		bendedContours = SHOW_CONTOURS;
+		stageCache.computed(STAGE_BEND);
+	}
+
+	// Gallery search is bounded by the threshold, exact only below the one it ran with
+	if(!gallery.empty() && handThreshold > matchThreshold)
+		stageCache.invalidate(STAGE_MATCH);
+	if(!stageCache.fresh(STAGE_MATCH))
+	{
+		matches.assign(applicants.size(), GalleryMatch());
+		for(size_t i = 0; i < applicants.size(); i++) {
 			try {
 				clock_t handRecStartTime = clock();
-				result = handRecCommands(applicant);
+				matches[i] = identifyHand(applicants[i]);
 				if(DEBUG) {
 					writeTime("HAND_REC_PROC", ((float)(clock()-handRecStartTime))/CLOCKS_PER_SEC);
 				}
@@ -452,81 +713,281 @@ bool ImageProcessor::handRecognition()
 				recognizedHandMutex.unlock();
 				return false;
 			}
-			if(SHOW_CONTOURS)
-			{
-				cv::drawContours(bended, contours, i, cv::Scalar(0, 0, 255), 1);
-				cv::drawContours(bended, mergedContours, i, cv::Scalar(0, 255, 0), 1);
-			}
-			if(result.toDouble() <= handThreshold) {
-				cv::drawContours(recognizedHand, mergedContours, i, cv::Scalar(0, 255, 255), 1);
-				cv::putText(recognizedHand, result.toStdString(), cv::Point(0, recognizedHand.rows-1), cv::FONT_HERSHEY_PLAIN, 2, cv::Scalar(0, 255, 255), 2);
-				dissimilarityMeasure.push_back(result);
-			}
+		}
+		matchThreshold = handThreshold;
+		stageCache.computed(STAGE_MATCH);
+	}
+
+	recognizedHand = frame.clone();
+	dissimilarityMeasure.clear();
+	std::vector<QString>().swap(dissimilarityMeasure);
+	for(size_t i = 0; i < matches.size(); i++) {
+		if(matches[i].dissimilarity <= handThreshold) {
+			QString result = matches[i].identity + ": " + QString::number(matches[i].dissimilarity);
+			cv::drawContours(recognizedHand, mergedContours, (int)i, cv::Scalar(0, 255, 255), 1);
+			cv::putText(recognizedHand, result.toStdString(), cv::Point(0, recognizedHand.rows-1), cv::FONT_HERSHEY_PLAIN, 2, cv::Scalar(0, 255, 255), 2);
+			dissimilarityMeasure.push_back(result);
 		}
 	}
 	recognizedHandMutex.unlock();
 	return true;
 }
 
-void ImageProcessor::mergeLogic(const std::vector<cv::Point>& contour_poly, std::vector<cv::Point>& mergedContour,  int point, cv::Point& prevAssignedP)
+// Camera or shared frame, recorded if a session is being recorded, or the next replayed one
+bool ImageProcessor::takeFrame()
 {
-	if(cannyEdges.at<uchar>(contour_poly[point]) > 0) {
-		prevAssignedP = contour_poly[point];
+	// Recorded before the frame they are used for
+	if(!player.isOpen())
+		deployReadyModels();
+	if(ring.isAttached()) {
+		// A copy of the slot, the producer may reuse it while the frame is processed
+		cv::Mat shared;
+		if(!ring.next(shared))
+			return false;
+		setCurrentFrame(shared);
+		stageCache.touch(INPUT_FRAME);
+		if(!isPhotoMode)
+			recorder.frame(frame);
+		return true;
+	}
+	if(!player.isOpen()) {
+		if(!Camera::takeFrame())
+			return false;
+		stageCache.touch(INPUT_FRAME);
+		if(!isPhotoMode)
+			recorder.frame(frame);
+		return true;
+	}
+	SessionRecord record;
+	while(player.read(record))
+	{
+		if(record.type == SESSION_FRAME) {
+			setCurrentFrame(record.frame);
+			stageCache.touch(INPUT_FRAME);
+			replayFrames++;
+			return true;
+		}
+		if(record.type == SESSION_PARAMETER)
+			applyParameter(record.parameter, record.value);
+		else if(record.type == SESSION_RETRAIN)
+			setPixelClassifierTrained(false);
+		else if(record.type == SESSION_MODEL) {
+			TrainingResult recorded;
+			recorded.faceId = record.parameter;
+			recorded.lut = record.frame;
+			deployModel(recorded);
+		}
+	}
+	return false;
+}
+
+void ImageProcessor::setRecording(bool recording)
+{
+	if(!recording) {
+		recorder.stop();
 		return;
 	}
-	cv::Point nearestCannyPoint = getNearestCannyPoint(contour_poly[point], prevAssignedP);
-	if(nearestCannyPoint == cv::Point(-1, -1)) {
-		prevAssignedP = contour_poly[point];
-	} else {
-		mergedContour[point] = nearestCannyPoint;
-		prevAssignedP = nearestCannyPoint;
+	QDir().mkpath(SESSION_PATH);
+	QString fileName = SESSION_PATH + QString::number(QDateTime::currentMSecsSinceEpoch()) + SESSION_EXTENSION;
+	if(!recorder.start(fileName)) {
+		emit error("Can't create session " + fileName, QMessageBox::Critical);
+		return;
 	}
+	// Face ids and models start over, as they do on replay
+	faces.clear();
+	nextFaceId = 0;
+	readyModels.clear();
+	recordParameters();
+	emit postMessage("Recording to " + fileName);
+}
+
+// Starting values, so replay doesn't depend on the replaying side
+void ImageProcessor::recordParameters()
+{
+	recorder.parameter(SESSION_PARAM_S, paramS);
+	recorder.parameter(SESSION_LOW_THRESHOLD, lowThreshold);
+	recorder.parameter(SESSION_RATIO, ratio);
+	recorder.parameter(SESSION_APERTURE, aperture);
+	recorder.parameter(SESSION_CANNY_CONTOUR_MERGE_EPS, cannyContourMergeEps);
+	recorder.parameter(SESSION_HAND_THRESHOLD, cvRound(handThreshold * 100));
+	recorder.parameter(SESSION_TOP_HAND_THRES, topHandThres);
+	recorder.parameter(SESSION_APPROX_POLY, cvRound(approxPoly * 10));
+	recorder.retrain();
 }
 
-cv::Point ImageProcessor::getNearestCannyPoint(cv::Point contourPoint, cv::Point prevCanny)
+void ImageProcessor::applyParameter(int parameter, int value)
 {
-	cv::Point nearestPoint(-1, -1);
-	std::vector<cv::Point> nearCannyPixels;
-	for(int j = 1; j <= cannyContourMergeEps; j++)
+	switch(parameter)
 	{
-		if( ((contourPoint.x - j) < 0) || ((contourPoint.x + j) >= cannyEdges.cols) ||  
-			((contourPoint.y - j) < 0) || ((contourPoint.y + j) >= cannyEdges.rows) ) // Check screen boundaries
-			break;
-		cv::Point point(contourPoint.x - j, contourPoint.y - j);
-		for(int k = 0; k < (2 * j); k++, point.x++) // From top-left corner to top-right corner
-			if( cannyEdges.at<uchar>(point) > 0 )
-				nearCannyPixels.push_back(cv::Point(point));
-		for(int k = 0; k < (2 * j); k++, point.y++) // From top-right corner to bottom-right corner
-			if( cannyEdges.at<uchar>(point) > 0 )
-				nearCannyPixels.push_back(cv::Point(point));
-		for(int k = 0; k < (2 * j); k++, point.x--) // From bottom-right corner to bottom-left corner
-			if( cannyEdges.at<uchar>(point) > 0 )
-				nearCannyPixels.push_back(cv::Point(point));
-		for(int k = 0; k < (2 * j); k++, point.y--) // From bottom-left corner to top-left corner
-			if( cannyEdges.at<uchar>(point) > 0 )
-				nearCannyPixels.push_back(cv::Point(point));
-		// Find nearest Canny pixel
-		if(nearCannyPixels.size())
+	case SESSION_PARAM_S:
+		setKernelParamS(value);
+		break;
+	case SESSION_LOW_THRESHOLD:
+		setLowThreshold(value);
+		break;
+	case SESSION_RATIO:
+		setRatio(value);
+		break;
+	case SESSION_APERTURE:
+		setAperture(value);
+		break;
+	case SESSION_CANNY_CONTOUR_MERGE_EPS:
+		setCannyContourMergeEps(value);
+		break;
+	case SESSION_HAND_THRESHOLD:
+		setHandThres(value);
+		break;
+	case SESSION_TOP_HAND_THRES:
+		setTopHandThres(value);
+		break;
+	case SESSION_APPROX_POLY:
+		setApproxPoly(value);
+		break;
+	}
+}
+
+// Frames go through the whole pipeline one by one, as fast as it runs
+void ImageProcessor::replaySession(const QString& fileName)
+{
+	if(Camera::isOpened() || player.isOpen()) {
+		emit error("Turn off camera before replay.", QMessageBox::Information);
+		return;
+	}
+	if(!player.open(fileName)) {
+		emit error("Can't open session " + fileName, QMessageBox::Critical);
+		return;
+	}
+	recorder.stop();
+	openLog();
+	stop = false;
+	startState = GET_FRAME;
+	pixelClassifierTrained = false;
+	faces.clear();
+	nextFaceId = 0;
+	readyModels.clear();
+	replayFrames = 0;
+	replayTimer.start();
+	emit opened();
+	processImage(GET_FRAME);
+}
+
+// Frames of a local producer (--publish) instead of the camera
+void ImageProcessor::attachFrameRing(const QString& name)
+{
+	if(Camera::isOpened() || player.isOpen() || ring.isAttached()) {
+		emit error("Turn off camera before attaching to shared frames.", QMessageBox::Information);
+		return;
+	}
+	if(!ring.attach(name)) {
+		emit error("Can't attach to shared frames " + name, QMessageBox::Critical);
+		return;
+	}
+	openLog();
+	stop = false;
+	startState = GET_FRAME;
+	pixelClassifierTrained = false;
+	faces.clear();
+	emit opened();
+	processImage(GET_FRAME);
+}
+
+// Enrolled gallery if there is one, single etalon otherwise
+GalleryMatch ImageProcessor::identifyHand(const cv::Mat& applicant)
+{
+	loadGallery();
+	return identifyStage(applicant, gallery, etalon, handThreshold, HANDS_COMPARE_DIR, galleryScratch);
+}
+
+void ImageProcessor::loadGallery()
+{
+	if(galleryLoaded)
+		return;
+	gallery.load(HANDS_COMPARE_DIR + GALLERY_DIR);
+	etalon = ShapeSequence();
+	if(gallery.empty())
+		loadSequence(HANDS_COMPARE_DIR + ETALON_SEQ_NAME, etalon);
+	galleryLoaded = true;
+}
+
+void ImageProcessor::enrollDirectory(const QString& dir)
+{
+	if(enrollment->isRunning()) {
+		emit error("Enrollment is already running.", QMessageBox::Warning);
+		return;
+	}
+	EnrollmentParams params;
+	params.skinLut = skinLut();
+	if(params.skinLut.empty()) {
+		emit error("Train the pixel classifier before enrollment.", QMessageBox::Warning);
+		return;
+	}
+	params.lowThreshold = lowThreshold;
+	params.ratio = ratio;
+	params.aperture = aperture;
+	params.cannyContourMergeEps = cannyContourMergeEps;
+	params.bend = SHOW_CONTOURS;
+	if(enrollment->start(dir, params) == 0)
+		emit error("No photos to enroll in " + dir, QMessageBox::Warning);
+}
+
+void ImageProcessor::enrollmentProgress(int done, int total)
+{
+	emit postMessage(QString("Enrolling: %1 of %2 photos.").arg(done).arg(total));
+}
+
+// Successful photos are written to the gallery at once, failures go to the report
+void ImageProcessor::enrollmentFinished()
+{
+	QDir().mkpath(HANDS_COMPARE_DIR + GALLERY_DIR);
+	galleryLoaded = false;
+	loadGallery();
+	const std::vector<EnrollmentItem>& items = enrollment->getItems();
+	QStringList failures;
+	int enrolled = 0;
+	for(size_t k = 0; k < items.size(); k++)
+	{
+		if(items[k].error.isEmpty() && !gallery.add(items[k].identity, items[k].seq, items[k].mask))
+			failures << items[k].fileName + ": can't write to the gallery";
+		else if(!items[k].error.isEmpty())
+			failures << items[k].fileName + ": " + items[k].error;
+		else
+			enrolled++;
+	}
+	gallery.getStore().flush();
+	stageCache.touch(INPUT_GALLERY);
+	QString summary = QString("Enrolled %1 of %2 photos in %3 s, %4 photos/s.")
+		.arg(enrolled).arg(items.size()).arg(enrollment->elapsed() / 1000.0, 0, 'f', 1).arg(enrollment->throughput(), 0, 'f', 1);
+	QFile reportFile(ENROLLMENT_REPORT);
+	if(reportFile.open(QFile::WriteOnly | QFile::Text))
+	{
+		QTextStream out(&reportFile);
+		foreach(const QString& line, failures)
+			out << line << "\n";
+		out << summary << "\n";
+	}
+	emit postMessage(summary);
+	if(!failures.isEmpty())
+		emit error(QString("%1 photos failed, see %2.").arg(failures.size()).arg(ENROLLMENT_REPORT), QMessageBox::Warning);
+}
+
+// Candidates of STAGE_BEND are independent, any number of them run at once
+void ImageProcessor::bendCandidates(const cv::Range& range)
+{
+	for(int i = range.start; i < range.end; i++)
+	{
+		if(SHOW_CONTOURS)
 		{
-			if(prevCanny == cv::Point(-1, -1)) {
-				nearestPoint = nearCannyPixels[0];
-				for(int k = 1; k < nearCannyPixels.size(); k++)
-					if( (abs(contourPoint.x - nearCannyPixels[k].x) < abs(contourPoint.x - nearestPoint.x)) ||
-						(abs(contourPoint.y - nearCannyPixels[k].y) < abs(contourPoint.y - nearestPoint.y)) )
-						nearestPoint = nearCannyPixels[k];
-				break;
-			} else {
-				if(nearestPoint == cv::Point(-1, -1))
-					nearestPoint = nearCannyPixels[0];
-				for(int k = 0; k < nearCannyPixels.size(); k++) {
-					if(nearCannyPixels[k] == prevCanny)
-						continue;
-					if( (abs(nearCannyPixels[k].x - contourPoint.x) + abs(nearCannyPixels[k].y - contourPoint.y) + abs(nearCannyPixels[k].x - prevCanny.x) + abs(nearCannyPixels[k].y - prevCanny.y)) < 
-						(abs(nearestPoint.x - contourPoint.x) + abs(nearestPoint.y - contourPoint.y) + abs(nearestPoint.x - prevCanny.x) + abs(nearestPoint.y - prevCanny.y)) )
-						nearestPoint = nearCannyPixels[k];
-				}
-			}
+			const BentContour *previous = INCREMENTAL_BENDING ? matchingBend(previousBends, candidateContours[i]) : NULL;
+			mergedContours[i] = bendStage(candidateContours[i], cannyEdges, cannyContourMergeEps, previous);
 		}
+		applicants[i] = handApplicant(mergedContours[i], classifiedSkin.size());
 	}
-	return nearestPoint;
-}
\ No newline at end of file
+}
+
+// Visible faces size the hands, photos have none
+HandFilter ImageProcessor::handFilter()
+{
+	if(photoProcessingMode)
+		return HandFilter();
+	return HandFilter(visibleFaces(faces), topHandThres);
+}
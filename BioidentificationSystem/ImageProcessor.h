@@ -2,9 +2,20 @@
 #define IMAGEPROCESSOR_H
 
 #include <time.h>
+#include <QFutureWatcher>
+#include <QList>
 
 #include "Camera.h"
 #include "PixelClassifier.h"
+#include "TrainingSet.h"
+#include "SkinColorModel.h"
+#include "Gallery.h"
+#include "Enrollment.h"
+#include "Session.h"
+#include "StageCache.h"
+#include "HandStages.h"
+#include "FrameRing.h"
+#include "FaceDetector.h"
 
 class ImageProcessor : public Camera
 {
@@ -12,6 +23,7 @@ class ImageProcessor : public Camera
 
 public:
 	ImageProcessor(QObject *parent = 0);
+	~ImageProcessor();
 
 	static enum States {
 		STOP,
@@ -41,7 +53,13 @@ public:
 	bool getPhotoMode()
 		{ return isPhotoMode; }
 
-	cv::Rect getFaceRect();
+	// Any thread: GET_FRAME waiting for a shared frame gives up
+	void wakeFrameRing()
+		{ ring.wake(); }
+
+	bool isTrainingPixelClassifier();
+
+	std::vector<cv::Rect> getFaceRects();
 	cv::Rect getSkinRect();
 	cv::Mat getFace();
 	cv::Mat getClassifiedSkin();
@@ -60,7 +78,7 @@ public:
 	bool findFace();
 	void getSkinColor();
 	bool trainPixelClassifier();
-	void pixelRecognition();
+	bool pixelRecognition();
 	void doCanny();
 	void morphologyDilation();
 	void mergePixelsAndCanny(bool horizontal);
@@ -68,14 +86,20 @@ public:
 	void morphologyOpening();
 	bool handRecognition();
 
-	void setPhotoProcessingMode(bool mode)
-		{ this->photoProcessingMode = mode; }
+	// Any thread: the photo and the skin rect are handed to WORKER thread, which starts
+	// photo processing from TRAIN_PIXEL_CLASSIFIER
+	void processPhoto(const cv::Mat& photo, const cv::Rect& skinRect);
+	// Any thread: stops photo processing, results stay readable
+	void stopPhotoProcessing();
+	// Any thread: new skin sample of the photo being processed
+	void setSkinSample(const cv::Mat& photo, const cv::Rect& skinRect);
 
 signals:
 	void photoTaken();
 	void stateCompleted(ImageProcessor::States state);
 	void postMessage(QString message);
 	void photoModeChanged();
+	void trainingStateChanged(QString state);
 
 public slots:
 	Q_INVOKABLE void processImage(ImageProcessor::States state);
@@ -83,37 +107,69 @@ public slots:
 	void imageProcState(bool state);
 	void takePhoto();
 	void setPhotoMode(bool mode);
+	void enrollDirectory(const QString& dir);
+	void setRecording(bool recording);
+	void replaySession(const QString& fileName);
+	void attachFrameRing(const QString& name);
 
-	void setFrame(const cv::Mat& frame)
-		{ this->frame = frame; faceRect = cv::Rect(); }
-	void setSkinColor(const cv::Mat& skinColor)
-		{ this->skinColor = skinColor; }
-	void setSkinColorRect(const cv::Rect& skinColorRect)
-		{ this->skinRect = skinColorRect; }
-	
 	void setKernelParamS(int paramS)
-		{ this->paramS = paramS; pixelClassifierTrained = false; }
+		{ this->paramS = paramS; pixelClassifierTrained = false; recorder.parameter(SESSION_PARAM_S, paramS); }
 	void setPixelClassifierTrained(bool pixelClassifierTrained = false)
-		{ this->pixelClassifierTrained = pixelClassifierTrained; }
+		{ this->pixelClassifierTrained = pixelClassifierTrained; if(!pixelClassifierTrained) recorder.retrain(); }
 
 	void setLowThreshold(int lowThreshold)
-		{ this->lowThreshold = lowThreshold; }
+		{ this->lowThreshold = lowThreshold; stageCache.touch(INPUT_CANNY_PARAMS); recorder.parameter(SESSION_LOW_THRESHOLD, lowThreshold); }
 	void setRatio(int ratio)
-		{ this->ratio = ratio; }
+		{ this->ratio = ratio; stageCache.touch(INPUT_CANNY_PARAMS); recorder.parameter(SESSION_RATIO, ratio); }
 	void setAperture(int aperture)
-		{ this->aperture = aperture; }
+		{ this->aperture = aperture; stageCache.touch(INPUT_CANNY_PARAMS); recorder.parameter(SESSION_APERTURE, aperture); }
 	void setCannyContourMergeEps(int cannyContourMergeEps)
-		{ this->cannyContourMergeEps = cannyContourMergeEps; }
+		{ this->cannyContourMergeEps = cannyContourMergeEps; stageCache.touch(INPUT_BEND_PARAMS); recorder.parameter(SESSION_CANNY_CONTOUR_MERGE_EPS, cannyContourMergeEps); }
 	void setHandThres(int handThreshold)
-		{ this->handThreshold = handThreshold / 100.0; }
+		{ this->handThreshold = handThreshold / 100.0; recorder.parameter(SESSION_HAND_THRESHOLD, handThreshold); }
 	void setTopHandThres(int topHandThres)
-		{ this->topHandThres = topHandThres; }
+		{ this->topHandThres = topHandThres; stageCache.touch(INPUT_BEND_PARAMS); recorder.parameter(SESSION_TOP_HAND_THRES, topHandThres); }
 	void setApproxPoly(int approxPoly)
-		{ this->approxPoly = approxPoly / 10.0; }
+		{ this->approxPoly = approxPoly / 10.0; stageCache.touch(INPUT_BEND_PARAMS); recorder.parameter(SESSION_APPROX_POLY, approxPoly); }
+
+private slots:
+	void pixelClassifierReady();
+	// Posted by processPhoto, stopPhotoProcessing, setSkinSample
+	void startPhotoProcessing();
+	void endPhotoProcessing();
+	void takeSkinSample();
+	void enrollmentProgress(int done, int total);
+	void enrollmentFinished();
 
 private:
-	cv::Point getNearestCannyPoint(cv::Point contourPoint, cv::Point prevCanny = cv::Point(-1, -1));
-	void mergeLogic(const std::vector<cv::Point>& contour_poly, std::vector<cv::Point>& mergedContour,  int point, cv::Point& prevAssignedP);
+	// Stage memoization: what stage outputs depend on
+	enum StageInputs {
+		INPUT_FRAME,
+		INPUT_SKIN_LUT,
+		INPUT_CANNY_PARAMS,
+		INPUT_BEND_PARAMS,
+		INPUT_GALLERY,
+		INPUT_PHOTO_MODE, // Photo processing or camera: which skin model and which candidates
+		INPUT_COUNT,
+	};
+	enum Stages {
+		STAGE_PIXEL_RECOGNITION,
+		STAGE_CANDIDATES,
+		STAGE_CANNY,
+		STAGE_BEND,
+		STAGE_MATCH,
+		STAGE_COUNT,
+	};
+	StageCache stageCache;
+	void declareStages();
+
+	void startTraining(const std::vector<ColorBin>& bins, int faceId);
+	void openLog();
+	static TrainingResult trainClassifier(std::vector<ColorBin> bins, int paramS, int faceId);
+	HandFilter handFilter();
+	CannyParams cannyParams()
+		{ return CannyParams(lowThreshold, ratio, aperture); }
+	cv::Mat skinLut();
 	clock_t startTime;
 	clock_t allStartTime;
 
@@ -124,25 +180,48 @@ private:
 	/* PHOTO_MODE &&  */
 	bool isPhotoMode;
 	bool photoProcessingMode;
+	void setPhotoProcessingMode(bool mode);
+	// Worker thread only
+	void setFrame(const cv::Mat& frame)
+		{ setCurrentFrame(frame); faces.clear(); stageCache.touch(INPUT_FRAME); }
+	void setSkinColor(const cv::Mat& skinColor)
+		{ this->skinColor = skinColor; pixelClassifierTrained = false; }
+	void setSkinColorRect(const cv::Rect& skinColorRect)
+		{ this->skinRect = skinColorRect; }
+	// Handed over by the GUI thread
+	QMutex pendingPhotoMutex;
+	cv::Mat pendingPhoto;
+	cv::Mat pendingSkinColor;
+	cv::Rect pendingSkinRect;
 
 	/* FIND_FACE_GET_SKIN_COLOR */
-	cv::CascadeClassifier faceCascade;
-	cv::Rect faceRect;
-	cv::Mat face;
+	std::vector<FaceTrack> faces;
+	int nextFaceId;
+	cv::Mat face; // Largest visible face, for display
 
 	/* GET_SKIN_COLOR */
 	cv::Rect skinRect;
 	cv::Mat skinColor;
+	SkinColorModel skinModel; // Photo processing, faces have their own
 	QMutex faceSkinRectMutex;
 
 	/* TRAIN_PIXEL_CLASSIFIER */
-	PixelClassifier pixelClassifier;
+	// Trained in background, one training per face at the same time, previous models classify meanwhile
+	QList<QFutureWatcher<TrainingResult>*> trainWatchers;
+	std::vector<TrainingResult> readyModels; // Deployed before the next frame
+	void deployReadyModels();
+	void deployModel(TrainingResult trained);
 	bool pixelClassifierTrained;
+	cv::Mat skinTestImage; // Held-out set, loaded once, empty if there is none
+	cv::Mat skinTestMask;
 
 	/* PIXEL_RECOGNITION */
 	cv::Mat colorizedFrame;
 	cv::Mat classifiedSkin;
 	QMutex classifiedSkinMutex;
+	// Labelled once per frame for the Canny gates and the bending
+	HandCandidates candidates;
+	const HandCandidates& handCandidates();
 	// Parameters
 	int paramS;
 
@@ -159,9 +238,39 @@ private:
 	int cannyContourMergeEps;
 
 	/* HAND_RECOGNITION */
+	// Outputs of STAGE_BEND and STAGE_MATCH, per candidate
+	std::vector<std::vector<cv::Point>> candidateContours;
+	std::vector<std::vector<cv::Point>> mergedContours;
+	std::vector<cv::Mat> applicants;
+	std::vector<GalleryMatch> matches;
+	double matchThreshold; // Gallery matches are exact up to it
+	bool bendedContours; // SHOW_CONTOURS of the STAGE_BEND output
+	// Last frame's bending, for INCREMENTAL_BENDING
+	std::vector<BentContour> previousBends;
+	int previousBendEps;
+	void bendCandidates(const cv::Range& range);
 	cv::Mat recognizedHand;
 	std::vector<QString> dissimilarityMeasure;
 	QMutex recognizedHandMutex;
+	Gallery gallery;
+	ShapeSequence etalon; // Compared in process when the gallery is empty
+	GalleryScratch galleryScratch;
+	bool galleryLoaded;
+	GalleryMatch identifyHand(const cv::Mat& applicant);
+	void loadGallery();
+
+	/* ENROLLMENT */
+	Enrollment *enrollment;
+
+	/* SESSION */
+	SessionRecorder recorder;
+	SessionPlayer player; // Open while replaying, replaces the camera
+	QTime replayTimer;
+	int replayFrames;
+	FrameRingReader ring; // Attached while processing shared frames, replaces the camera
+	bool takeFrame();
+	void recordParameters();
+	void applyParameter(int parameter, int value);
 	// Parameters
 	double handThreshold;
 	double approxPoly;
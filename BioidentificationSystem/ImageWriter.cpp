@@ -0,0 +1,49 @@
+#include <QtConcurrentRun>
+
+#include "ImageWriter.h"
+
+ImageWriter::ImageWriter(QObject *parent)
+	: QObject(parent),
+	draining(false) {}
+
+ImageWriter::~ImageWriter()
+{
+	drainFuture.waitForFinished();
+}
+
+QString ImageWriter::enqueue(cv::Mat& image, const QString& name, const QString& dir)
+{
+	Job job;
+	job.image = image;
+	job.fileName = imageFileName(name, dir);
+	image.release();
+	jobsMutex.lock();
+	jobs.enqueue(job);
+	if(!draining)
+	{
+		draining = true;
+		drainFuture = QtConcurrent::run(this, &ImageWriter::drain);
+	}
+	jobsMutex.unlock();
+	return job.fileName;
+}
+
+void ImageWriter::drain()
+{
+	forever
+	{
+		jobsMutex.lock();
+		if(jobs.isEmpty())
+		{
+			draining = false;
+			jobsMutex.unlock();
+			return;
+		}
+		Job job = jobs.dequeue();
+		jobsMutex.unlock();
+		if(saveImage(job.image, getImageName(job.fileName), getImagePath(job.fileName)).isEmpty())
+			emit failed(job.fileName);
+		else
+			emit written(job.fileName);
+	}
+}
@@ -0,0 +1,45 @@
+#ifndef IMAGEWRITER_H
+#define IMAGEWRITER_H
+
+#include <QObject>
+#include <QQueue>
+#include <QMutex>
+#include <QFuture>
+
+#include "general.h"
+
+// Background image writer: encoding and disk writes leave the GUI thread.
+// Jobs are written in order by one pool thread at a time.
+class ImageWriter : public QObject
+{
+	Q_OBJECT
+
+public:
+	ImageWriter(QObject *parent = 0);
+	// Pending images are still written
+	~ImageWriter();
+
+	// Takes image over (it's released, no pixel copy) and returns the file name
+	// it will be written to, format by extension or PHOTO_FORMAT for timestamped names.
+	// Caller must not write to other headers of the same data afterwards.
+	QString enqueue(cv::Mat& image, const QString& name = QString(), const QString& dir = PHOTO_PATH);
+
+signals:
+	void written(QString fileName);
+	void failed(QString fileName);
+
+private:
+	struct Job
+	{
+		cv::Mat image;
+		QString fileName;
+	};
+	void drain();
+
+	QQueue<Job> jobs;
+	QMutex jobsMutex;
+	bool draining;
+	QFuture<void> drainFuture;
+};
+
+#endif // IMAGEWRITER_H
@@ -9,18 +9,21 @@
 
 #include "opencv2/opencv.hpp"
 #include "ImageProcessor.h"
+#include "ImageWriter.h"
 
 class PhotoLabel : public QLabel
 {
 	Q_OBJECT
 
 public:
-	PhotoLabel(ImageProcessor *imageProcessor, QWidget * parent = 0, Qt::WindowFlags f = 0)
+	PhotoLabel(ImageProcessor *imageProcessor, ImageWriter *imageWriter, QWidget * parent = 0, Qt::WindowFlags f = 0)
 		: QLabel(parent, f),
 		drawRectMode(false),
 		drawMode(false)
 		{
 			this->imageProcessor = imageProcessor;
+			this->imageWriter = imageWriter;
+			connect(imageWriter, SIGNAL(written(QString)), this, SLOT(imageWritten(QString)));
 		}
 
 	void setCurrentMat(const cv::Mat& currentMat)
@@ -93,23 +96,26 @@ public slots: /* Actions */
 		startPoint = cv::Point(0, 0);
 		endPoint = cv::Point(0, 0);
 	}
+	// Written in background, saved() follows the write, failures are reported by the writer owner
 	void saveCurrentImage() {
-		QString name = saveImage(currentMat, currentImageName, currentImagePath);
-		if(name.isEmpty())
-			emit error("Can't save image.", QMessageBox::Critical);
-		else
-			emit saved();
+		cv::Mat image = currentMat.clone();
+		pendingSave = imageWriter->enqueue(image, currentImageName, currentImagePath);
 	}
 	void saveCurrentImageAs() {
-		QString fileName = QFileDialog::getSaveFileName(this, "Save image", currentImagePath, "Images (*.bmp)");
+		QString fileName = QFileDialog::getSaveFileName(this, "Save image", currentImagePath, "Images (*.png *.jpg *.bmp)");
 		if(fileName.isNull())
 			return;
 		QString name = getImageName(fileName);
 		QString path = getImagePath(fileName);
-		if(saveImage(currentMat, name, path).isEmpty())
-			emit error("Can't save image.", QMessageBox::Critical);
-		else
-			emit saved();
+		cv::Mat image = currentMat.clone();
+		pendingSave = imageWriter->enqueue(image, name, path);
+	}
+	// Signals: imageWriter::written
+	void imageWritten(QString fileName) {
+		if(fileName != pendingSave)
+			return;
+		pendingSave.clear();
+		emit saved();
 	}
 	void openImage() {
 		QString imageName = QFileDialog::getOpenFileName(this, "Open image", QString(), "Images (*.bmp *.jpg *.png)");
@@ -138,21 +144,12 @@ public slots: /* Actions */
 				emit processError();
 				return;
 			}
-			imageProcessor->setFrame(currentMat);
-			imageProcessor->setSkinColor(currentMat(skinRect).clone());
-			imageProcessor->setSkinColorRect(skinRect);
-			imageProcessor->setPhotoProcessingMode(true);
-			imageProcessor->setStop(false);
-			imageProcessor->setStartState(ImageProcessor::TRAIN_PIXEL_CLASSIFIER);
+			// Copied and set up in WORKER thread, the label keeps editing its image
+			imageProcessor->processPhoto(currentMat, skinRect);
 			prevMat = currentMat.clone();
-			QMetaObject::invokeMethod(imageProcessor,
-				"processImage",
-				Qt::QueuedConnection,
-				Q_ARG(ImageProcessor::States, ImageProcessor::TRAIN_PIXEL_CLASSIFIER));
 			emit processStarted();
 		} else {
-			imageProcessor->setPhotoProcessingMode(false);
-			imageProcessor->setStop(true);
+			imageProcessor->stopPhotoProcessing();
 			currentMat = imageProcessor->getBended();
 			applyCurrentPixmap();
 			setPointsToNull();
@@ -217,15 +214,14 @@ protected:
 			endPoint.x = event->x();
 			endPoint.y = event->y();
 			if(!imageProcessor->stopped())
-			{
-				imageProcessor->setSkinColor(currentMat(cv::Rect(startPoint, endPoint)).clone());
-				imageProcessor->setSkinColorRect(cv::Rect(startPoint, endPoint));
-			}
+				imageProcessor->setSkinSample(currentMat, cv::Rect(startPoint, endPoint));
 		}
 	}
 
 private:
 	ImageProcessor *imageProcessor;
+	ImageWriter *imageWriter;
+	QString pendingSave;
 
 	QPixmap currentPixmap;
 	cv::Mat prevMat;
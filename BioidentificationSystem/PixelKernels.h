@@ -0,0 +1,119 @@
+#ifndef PIXELKERNELS_H
+#define PIXELKERNELS_H
+
+#include "general.h"
+
+// Frames come as CV_8UC3 BGR (cameras, cv::imread) or CV_8UC4 BGRA (QImage2Mat of RGB32,
+// service clients), gray CV_8UC1 is read as B = G = R. Kernels are templated on the channel
+// count so inner loops walk raw row pointers with a constant stride; callers assert an 8-bit
+// 1, 3 or 4 channel layout and switch on channels() once per frame.
+template<int CN>
+struct BgrPixel
+{
+	static uchar b(const uchar *p)
+		{ return p[0]; }
+	static uchar g(const uchar *p)
+		{ return p[1]; }
+	static uchar r(const uchar *p)
+		{ return p[2]; }
+};
+
+template<>
+struct BgrPixel<1>
+{
+	static uchar b(const uchar *p)
+		{ return p[0]; }
+	static uchar g(const uchar *p)
+		{ return p[0]; }
+	static uchar r(const uchar *p)
+		{ return p[0]; }
+};
+
+// Bin of a 3 x bits per channel colour table, B highest
+template<int CN, int BITS>
+inline int colorIndex(const uchar *p)
+{
+	const int shift = 8 - BITS;
+	return ((BgrPixel<CN>::b(p) >> shift) << (2 * BITS)) | ((BgrPixel<CN>::g(p) >> shift) << BITS) | (BgrPixel<CN>::r(p) >> shift);
+}
+
+// skin = 255 where skinTable accepts the pixel, rows [begin, end)
+template<int CN>
+void classifySkinRows(const cv::Mat& frame, const uchar *skinTable, cv::Mat& skin, int begin, int end)
+{
+	for(int i = begin; i < end; i++)
+	{
+		const uchar *p = frame.ptr<uchar>(i);
+		const uchar *rowEnd = p + frame.cols * CN;
+		uchar *s = skin.ptr<uchar>(i);
+		for(; p != rowEnd; p += CN, s++)
+			*s = skinTable[colorIndex<CN, SKIN_LUT_BITS>(p)] ? 255 : 0;
+	}
+}
+
+// hist[bin] += weight for every pixel of patch
+template<int CN>
+void accumulateColors(const cv::Mat& patch, float *hist, float weight)
+{
+	for(int i = 0; i < patch.rows; i++)
+	{
+		const uchar *p = patch.ptr<uchar>(i);
+		const uchar *rowEnd = p + patch.cols * CN;
+		for(; p != rowEnd; p += CN)
+			hist[colorIndex<CN, SKIN_LUT_BITS>(p)] += weight;
+	}
+}
+
+// Count, B, G, R sums per training bin
+template<int CN>
+void binColorSums(const cv::Mat& image, std::vector<cv::Vec4i>& histogram, int& used)
+{
+	for(int i = 0; i < image.rows; i++)
+	{
+		const uchar *p = image.ptr<uchar>(i);
+		const uchar *rowEnd = p + image.cols * CN;
+		for(; p != rowEnd; p += CN)
+		{
+			cv::Vec4i& bin = histogram[colorIndex<CN, TRAINING_BIN_BITS>(p)];
+			if(bin[0]++ == 0)
+				used++;
+			bin[1] += BgrPixel<CN>::b(p);
+			bin[2] += BgrPixel<CN>::g(p);
+			bin[3] += BgrPixel<CN>::r(p);
+		}
+	}
+}
+
+// Pixels under mask as a CV_8UC3 column
+template<int CN>
+cv::Mat maskedPixels(const cv::Mat& image, const cv::Mat& mask)
+{
+	cv::Mat pixels(cv::countNonZero(mask), 1, CV_8UC3);
+	cv::Vec3b *out = pixels.ptr<cv::Vec3b>();
+	for(int i = 0; i < image.rows; i++)
+	{
+		const uchar *p = image.ptr<uchar>(i);
+		const uchar *m = mask.ptr<uchar>(i);
+		for(int j = 0; j < image.cols; j++, p += CN)
+			if(m[j] > 0)
+				*out++ = cv::Vec3b(BgrPixel<CN>::b(p), BgrPixel<CN>::g(p), BgrPixel<CN>::r(p));
+	}
+	return pixels;
+}
+
+// Zeroes the outermost rows and columns
+template<int CN>
+void clearBorder(cv::Mat& img)
+{
+	memset(img.ptr<uchar>(0), 0, img.cols * CN);
+	memset(img.ptr<uchar>(img.rows - 1), 0, img.cols * CN);
+	for(int i = 1; i < img.rows - 1; i++)
+	{
+		uchar *row = img.ptr<uchar>(i);
+		uchar *last = row + (img.cols - 1) * CN;
+		for(int c = 0; c < CN; c++)
+			row[c] = last[c] = 0;
+	}
+}
+
+#endif // PIXELKERNELS_H
@@ -0,0 +1,112 @@
+#include <time.h>
+#include <QDir>
+#include <QFile>
+
+#include "Recognizer.h"
+#include "SkinColorModel.h"
+#include "PixelKernels.h"
+
+static float msSince(clock_t startTime)
+{
+	return 1000.f * (clock() - startTime) / CLOCKS_PER_SEC;
+}
+
+Recognizer::Recognizer(const QString& workDir, const Gallery *sharedGallery)
+	: workDir(workDir), gallery(sharedGallery)
+{
+	if(gallery == NULL) {
+		ownGallery.load(HANDS_COMPARE_DIR + GALLERY_DIR);
+		gallery = &ownGallery;
+	}
+	QDir dir(workDir);
+	dir.mkpath(".");
+	if(gallery->empty()) {
+		loadSequence(HANDS_COMPARE_DIR + ETALON_SEQ_NAME, etalon);
+		// StringCompare.exe reads it next to the hand
+		dir.remove(ETALON_SEQ_NAME);
+		if(!SEQ_COMPARE_IN_PROCESS)
+			QFile::copy(HANDS_COMPARE_DIR + ETALON_SEQ_NAME, dir.filePath(ETALON_SEQ_NAME));
+	}
+}
+
+std::vector<HandResult> Recognizer::recognize(const cv::Mat& frame, const cv::Mat& skinLut, RecognitionTimings& timings,
+	const HandFilter& filter)
+{
+	std::vector<HandResult> results;
+	clock_t allStartTime = clock();
+	clock_t startTime = clock();
+	// A tiled pass brings the edges along, its time counts as skin
+	cv::Mat skin, edges;
+	skinStage(frame, skinLut, filter.faces, CannyParams(), skin, &edges);
+	timings.skin = msSince(startTime);
+
+	HandCandidates candidates;
+	candidateStage(skin, filter, candidates);
+
+	if(edges.empty())
+	{
+		startTime = clock();
+		edges = cannyStage(frame, candidates.boxes, CannyParams(), CANNY_CONTOUR_MERGE_EPS);
+		timings.canny = msSince(startTime);
+	}
+
+	startTime = clock();
+	std::vector<cv::Mat> applicants;
+	for(size_t c = 0; c < candidates.size(); c++)
+	{
+		std::vector<cv::Point> contour = bendStage(candidates.contour(c), edges, CANNY_CONTOUR_MERGE_EPS);
+		HandResult result;
+		result.bbox = cv::boundingRect(cv::Mat(contour));
+		results.push_back(result);
+		applicants.push_back(handApplicant(contour, frame.size()));
+	}
+	timings.bend = msSince(startTime);
+
+	startTime = clock();
+	double threshold = HAND_THRESHOLD / 100.0;
+	for(size_t k = 0; k < applicants.size(); k++)
+	{
+		GalleryMatch match;
+		try {
+			match = identifyStage(applicants[k], *gallery, etalon, threshold, workDir, scratch);
+		} catch(std::exception&) {
+			// BmpToSeq.exe or StringCompare.exe failed, the hand stays unmatched
+		}
+		results[k].identity = match.identity;
+		results[k].dissimilarity = match.dissimilarity;
+		results[k].matched = results[k].dissimilarity <= threshold;
+		if(!results[k].matched)
+			results[k].identity.clear();
+	}
+	// Tool files of this frame, the etalon copy stays
+	QDir dir(workDir);
+	foreach(const QString& entry, dir.entryList(QDir::Files))
+		if(entry != ETALON_SEQ_NAME)
+			dir.remove(entry);
+	timings.match = msSince(startTime);
+	timings.total = msSince(allStartTime);
+	return results;
+}
+
+cv::Mat maskedSkin(const cv::Mat& image, const cv::Mat& mask)
+{
+	CV_Assert(image.depth() == CV_8U && (image.channels() == 1 || image.channels() == 3 || image.channels() == 4));
+	switch(image.channels())
+	{
+	case 1:
+		return maskedPixels<1>(image, mask);
+	case 4:
+		return maskedPixels<4>(image, mask);
+	default:
+		return maskedPixels<3>(image, mask);
+	}
+}
+
+cv::Mat trainSkinLut(const std::vector<ColorBin>& bins, int paramS)
+{
+	std::vector<Pixel> pixels = buildTrainingSet(bins);
+	PixelClassifier classifier;
+	if(pixels.empty() || !classifier.train(pixels, paramS, 1, 0.001))
+		return cv::Mat();
+	return SkinColorModel::buildLut(classifier);
+}
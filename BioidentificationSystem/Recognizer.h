@@ -0,0 +1,58 @@
+#ifndef RECOGNIZER_H
+#define RECOGNIZER_H
+
+#include "general.h"
+#include "Gallery.h"
+#include "TrainingSet.h"
+#include "HandStages.h"
+
+struct HandResult
+{
+	HandResult()
+		: dissimilarity(DBL_MAX), matched(false) {}
+	QString identity; // Empty if nothing is close enough
+	double dissimilarity;
+	cv::Rect bbox;
+	bool matched; // dissimilarity <= HAND_THRESHOLD
+};
+
+// ms per stage
+struct RecognitionTimings
+{
+	RecognitionTimings()
+		: skin(0), canny(0), bend(0), match(0), total(0) {}
+	float skin;
+	float canny;
+	float bend;
+	float match;
+	float total;
+};
+
+// Photo processing pipeline without the state machine, for headless use: the HandStages of
+// ImageProcessor from skin classification to gallery (or etalon) matching.
+// Not thread safe, one per thread: it owns a BmpToSeq dir with a copy of etalon.seq, the gallery
+// scratch and, unless a shared gallery is given, a gallery view. Recognizers search a shared
+// gallery at the same time.
+class Recognizer
+{
+public:
+	Recognizer(const QString& workDir, const Gallery *sharedGallery = NULL);
+
+	// Any size candidates of a photo unless the filter gives the faces of the frame
+	std::vector<HandResult> recognize(const cv::Mat& frame, const cv::Mat& skinLut, RecognitionTimings& timings,
+		const HandFilter& filter = HandFilter());
+
+private:
+	QString workDir;
+	Gallery ownGallery;
+	const Gallery *gallery;
+	GalleryScratch scratch;
+	ShapeSequence etalon;
+};
+
+// Skin pixels of image under mask (CV_8UC1, skin > 0) as a training patch
+cv::Mat maskedSkin(const cv::Mat& image, const cv::Mat& mask);
+// Trained classifier LUT for binColors of a skin sample, empty if training failed
+cv::Mat trainSkinLut(const std::vector<ColorBin>& bins, int paramS = KERNEL_PARAM_S);
+
+#endif // RECOGNIZER_H
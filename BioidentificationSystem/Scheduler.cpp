@@ -0,0 +1,68 @@
+#include <QThread>
+#include <QThreadPool>
+#include <QThreadStorage>
+
+#include "Scheduler.h"
+
+#ifdef Q_OS_WIN
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+static bool pinning = false;
+static QAtomicInt pinnedWorkers;
+static QThreadStorage<bool*> workerPinned;
+
+void configureScheduler(int threads, bool pinWorkers)
+{
+	if(threads <= 0)
+		threads = QThread::idealThreadCount();
+	QThreadPool::globalInstance()->setMaxThreadCount(std::max(1, threads));
+	cv::setNumThreads(0);
+	pinning = pinWorkers;
+}
+
+int schedulerThreads()
+{
+	return QThreadPool::globalInstance()->maxThreadCount();
+}
+
+#ifdef Q_OS_WIN
+// index-th core: node index % nodes, then the next free core of that node
+static DWORD_PTR workerMask(int index)
+{
+	ULONG highestNode = 0;
+	if(!GetNumaHighestNodeNumber(&highestNode))
+		highestNode = 0;
+	int nodes = (int)highestNode + 1;
+	ULONGLONG nodeMask = 0;
+	if(!GetNumaNodeProcessorMask((UCHAR)(index % nodes), &nodeMask) || nodeMask == 0)
+	{
+		DWORD_PTR processMask, systemMask;
+		GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask);
+		nodeMask = processMask;
+	}
+	int cores = 0;
+	for(int bit = 0; bit < (int)(8 * sizeof(DWORD_PTR)); bit++)
+		if(nodeMask & ((ULONGLONG)1 << bit))
+			cores++;
+	int core = (index / nodes) % cores;
+	for(int bit = 0; bit < (int)(8 * sizeof(DWORD_PTR)); bit++)
+		if((nodeMask & ((ULONGLONG)1 << bit)) && core-- == 0)
+			return (DWORD_PTR)1 << bit;
+	return 0;
+}
+#endif
+
+void pinWorker()
+{
+	if(!pinning || workerPinned.hasLocalData())
+		return;
+	// Threads that start blocking work run chunks too and get a core the same way
+	workerPinned.setLocalData(new bool(true));
+#ifdef Q_OS_WIN
+	DWORD_PTR mask = workerMask(pinnedWorkers.fetchAndAddOrdered(1));
+	if(mask != 0)
+		SetThreadAffinityMask(GetCurrentThread(), mask);
+#endif
+}
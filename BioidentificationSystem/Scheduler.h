@@ -0,0 +1,62 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <QtConcurrentMap>
+
+#include "general.h"
+
+// Every parallel stage runs on QThreadPool::globalInstance(): pixel classification rows,
+// classifier tables, contour bending, batch images, streams. Its size is set here at start,
+// OpenCV's own threading is turned off so the two pools don't oversubscribe the cores.
+// threads 0 - QThread::idealThreadCount(). With pinWorkers every pool thread is bound to one
+// core on its first parallel chunk, threads spread over NUMA nodes round robin.
+void configureScheduler(int threads = SCHEDULER_THREADS, bool pinWorkers = false);
+int schedulerThreads();
+// Places the calling pool thread once if pinning is on
+void pinWorker();
+
+template<class Body>
+struct ParallelChunk
+{
+	ParallelChunk(const Body& body)
+		: body(body) {}
+	void operator()(cv::Range& range) const
+		{ pinWorker(); body(range); }
+	const Body& body;
+};
+
+template<class T>
+struct ParallelMethod
+{
+	ParallelMethod(T *object, void (T::*method)(const cv::Range&))
+		: object(object), method(method) {}
+	void operator()(const cv::Range& range) const
+		{ (object->*method)(range); }
+	T *object;
+	void (T::*method)(const cv::Range&);
+};
+
+// body(cv::Range) over [begin, end) in chunks of grain. Idle threads take the next chunk,
+// the calling thread works too, so it's safe from pool threads as well.
+template<class Body>
+void parallelFor(int begin, int end, const Body& body, int grain = SCHEDULER_GRAIN)
+{
+	if(end - begin <= grain || schedulerThreads() <= 1)
+	{
+		if(end > begin)
+			body(cv::Range(begin, end));
+		return;
+	}
+	std::vector<cv::Range> chunks;
+	for(int k = begin; k < end; k += grain)
+		chunks.push_back(cv::Range(k, std::min(k + grain, end)));
+	QtConcurrent::blockingMap(chunks, ParallelChunk<Body>(body));
+}
+
+template<class T>
+void parallelFor(int begin, int end, T *object, void (T::*method)(const cv::Range&), int grain = SCHEDULER_GRAIN)
+{
+	parallelFor(begin, end, ParallelMethod<T>(object, method), grain);
+}
+
+#endif // SCHEDULER_H
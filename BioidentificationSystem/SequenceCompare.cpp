@@ -0,0 +1,381 @@
+#include <QFile>
+#include <QDir>
+#include <QTextStream>
+#include <limits.h>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define SEQ_COMPARE_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define SEQ_COMPARE_NEON
+#endif
+
+#include "SequenceCompare.h"
+
+bool loadSequence(const QString& fileName, ShapeSequence& seq)
+{
+	// Not in text mode, source keeps the line ends
+	QFile file(fileName);
+	if(!file.open(QFile::ReadOnly))
+		return false;
+	return parseSequence(file.readAll(), seq);
+}
+
+bool parseSequence(const QByteArray& data, ShapeSequence& seq)
+{
+	std::vector<std::vector<double> > rows;
+	QList<QByteArray> lines = data.split('\n');
+	foreach(const QByteArray& line, lines)
+	{
+		QList<QByteArray> values = line.simplified().split(' ');
+		if(values.size() == 1 && values[0].isEmpty())
+			continue;
+		std::vector<double> row;
+		row.reserve(values.size());
+		foreach(const QByteArray& value, values)
+		{
+			bool ok;
+			row.push_back(value.toDouble(&ok));
+			if(!ok)
+				return false;
+		}
+		rows.push_back(row);
+	}
+	// Optional element count header
+	if(rows.size() > 1 && rows[0].size() == 1 && rows[1].size() != 1)
+		rows.erase(rows.begin());
+
+	seq = ShapeSequence();
+	seq.source = data;
+	if(rows.empty())
+		return true;
+	seq.length = (int)rows.size();
+	seq.dims = (int)rows[0].size();
+	seq.features.resize(seq.length * seq.dims);
+	for(int k = 0; k < seq.length; k++)
+	{
+		if((int)rows[k].size() != seq.dims)
+			return false;
+		for(int d = 0; d < seq.dims; d++)
+			seq.features[d * seq.length + k] = rows[k][d];
+	}
+	return true;
+}
+
+bool saveSequence(const QString& fileName, const ShapeSequence& seq)
+{
+	QFile file(fileName);
+	if(!seq.source.isEmpty())
+		return file.open(QFile::WriteOnly | QFile::Truncate) && file.write(seq.source) == seq.source.size();
+	if(!file.open(QFile::WriteOnly | QFile::Truncate | QFile::Text))
+		return false;
+	QTextStream out(&file);
+	out.setRealNumberPrecision(17);
+	out << seq.length << "\n";
+	for(int k = 0; k < seq.length; k++)
+	{
+		for(int d = 0; d < seq.dims; d++)
+			out << (d == 0 ? "" : " ") << seq.at(k, d);
+		out << "\n";
+	}
+	out.flush();
+	return out.status() == QTextStream::Ok;
+}
+
+// Fixed point limits: |feature| <= 16 and dims * (n + m) <= 16 * 8192 keep every DP value
+// below FIXED_INFINITY, larger inputs go to the double path
+static const qint32 FIXED_INFINITY = INT_MAX / 2;
+static const int FIXED_FEATURE_LIMIT = 16 << SEQ_FIXED_BITS;
+static const int FIXED_MAX_CELLS = 16 * 8192;
+
+// False if a feature is beyond FIXED_FEATURE_LIMIT, fixed is incomplete then
+static bool quantizeSequence(const ShapeSequence& seq, std::vector<qint32>& fixed)
+{
+	const double scale = 1 << SEQ_FIXED_BITS;
+	fixed.resize(seq.features.size());
+	for(size_t k = 0; k < seq.features.size(); k++)
+	{
+		double value = floor(seq.features[k] * scale + 0.5);
+		if(fabs(value) > FIXED_FEATURE_LIMIT)
+			return false;
+		fixed[k] = (qint32)value;
+	}
+	return true;
+}
+
+SequenceComparator::SequenceComparator(double mulct, double band, bool fixedPoint)
+	: mulct(mulct), band(band), fixedPoint(fixedPoint) {}
+
+double SequenceComparator::compare(const ShapeSequence& a, const ShapeSequence& b, double threshold)
+{
+	const int n = a.length;
+	const int m = b.length;
+	if(n == 0 || m == 0)
+		return (n == m) ? 0 : mulct * (n + m) / std::max(n, m);
+	if(a.dims != b.dims)
+		return DBL_MAX;
+	if(fixedPoint && a.dims * (n + m) <= FIXED_MAX_CELLS && quantizeSequence(a, fixedA) && quantizeSequence(b, fixedB))
+		return compareFixed(a, b, threshold);
+	const double norm = std::max(n, m);
+	const int radius = std::max(std::abs(n - m), (int)ceil(band * norm));
+	if((int)prev.size() < m + 1) {
+		prev.resize(m + 1);
+		cur.resize(m + 1);
+		diag.resize(m + 1);
+	}
+
+	for(int j = 0; j <= m; j++)
+		prev[j] = j * mulct;
+	int lo = 1, hi = m;
+	for(int i = 1; i <= n; i++)
+	{
+		// Band around the scaled diagonal
+		const int center = (int)((double)i * m / n + 0.5);
+		lo = std::max(1, center - radius);
+		hi = std::min(m, center + radius);
+		cur[lo - 1] = (lo == 1) ? i * mulct : DBL_MAX;
+
+		// Match/substitution and deletion don't depend on the current row, vectorized
+		int j = lo;
+#ifdef SEQ_COMPARE_SSE2
+		const __m128d signMask = _mm_set1_pd(-0.0);
+		const __m128d penalty = _mm_set1_pd(mulct);
+		for(; j + 1 <= hi; j += 2)
+		{
+			__m128d cost = _mm_setzero_pd();
+			for(int d = 0; d < a.dims; d++)
+			{
+				__m128d diff = _mm_sub_pd(_mm_set1_pd(a.at(i - 1, d)), _mm_loadu_pd(&b.features[d * m + j - 1]));
+				cost = _mm_add_pd(cost, _mm_andnot_pd(signMask, diff));
+			}
+			__m128d match = _mm_add_pd(_mm_loadu_pd(&prev[j - 1]), cost);
+			__m128d deletion = _mm_add_pd(_mm_loadu_pd(&prev[j]), penalty);
+			_mm_storeu_pd(&diag[j], _mm_min_pd(match, deletion));
+		}
+#endif
+		for(; j <= hi; j++)
+		{
+			double cost = 0;
+			for(int d = 0; d < a.dims; d++)
+				cost += fabs(a.at(i - 1, d) - b.at(j - 1, d));
+			diag[j] = std::min(prev[j - 1] + cost, prev[j] + mulct);
+		}
+
+		// Insertion runs along the row
+		double rowMin = DBL_MAX;
+		for(j = lo; j <= hi; j++)
+		{
+			cur[j] = std::min(diag[j], cur[j - 1] + mulct);
+			rowMin = std::min(rowMin, cur[j]);
+		}
+		// Costs only grow, every path crosses this row
+		if(rowMin / norm > threshold)
+			return rowMin / norm;
+
+		if(i < n) {
+			const int nextHi = std::min(m, (int)((double)(i + 1) * m / n + 0.5) + radius);
+			for(j = hi + 1; j <= nextHi; j++)
+				cur[j] = DBL_MAX;
+		}
+		prev.swap(cur);
+	}
+	return prev[m] / norm;
+}
+
+// Same DP as compare() on fixedA and fixedB, the quantized features. Threshold is turned
+// into an integer bound once, so the accept decision itself needs no floating point.
+double SequenceComparator::compareFixed(const ShapeSequence& a, const ShapeSequence& b, double threshold)
+{
+	const int n = a.length;
+	const int m = b.length;
+	const qint32 penalty = (qint32)floor(mulct * (1 << SEQ_FIXED_BITS) + 0.5);
+	const double scale = (double)std::max(n, m) * (1 << SEQ_FIXED_BITS);
+	const qint32 bound = (threshold * scale < FIXED_INFINITY) ? (qint32)floor(threshold * scale) : FIXED_INFINITY;
+	const int radius = std::max(std::abs(n - m), (int)ceil(band * std::max(n, m)));
+	if((int)fixedPrev.size() < m + 1) {
+		fixedPrev.resize(m + 1);
+		fixedCur.resize(m + 1);
+		fixedDiag.resize(m + 1);
+	}
+
+	for(int j = 0; j <= m; j++)
+		fixedPrev[j] = j * penalty;
+	for(int i = 1; i <= n; i++)
+	{
+		const int center = (int)((double)i * m / n + 0.5);
+		const int lo = std::max(1, center - radius);
+		const int hi = std::min(m, center + radius);
+		const qint32* rowA = &fixedA[i - 1];
+		fixedCur[lo - 1] = (lo == 1) ? i * penalty : FIXED_INFINITY;
+
+		int j = lo;
+#if defined(SEQ_COMPARE_SSE2)
+		const __m128i penaltyV = _mm_set1_epi32(penalty);
+		for(; j + 3 <= hi; j += 4)
+		{
+			__m128i cost = _mm_setzero_si128();
+			for(int d = 0; d < a.dims; d++)
+			{
+				__m128i diff = _mm_sub_epi32(_mm_set1_epi32(rowA[d * n]), _mm_loadu_si128((const __m128i*)&fixedB[d * m + j - 1]));
+				__m128i sign = _mm_srai_epi32(diff, 31);
+				cost = _mm_add_epi32(cost, _mm_sub_epi32(_mm_xor_si128(diff, sign), sign));
+			}
+			__m128i match = _mm_add_epi32(_mm_loadu_si128((const __m128i*)&fixedPrev[j - 1]), cost);
+			__m128i deletion = _mm_add_epi32(_mm_loadu_si128((const __m128i*)&fixedPrev[j]), penaltyV);
+			// No 32-bit min before SSE4.1
+			__m128i less = _mm_cmplt_epi32(match, deletion);
+			_mm_storeu_si128((__m128i*)&fixedDiag[j], _mm_or_si128(_mm_and_si128(less, match), _mm_andnot_si128(less, deletion)));
+		}
+#elif defined(SEQ_COMPARE_NEON)
+		const int32x4_t penaltyV = vdupq_n_s32(penalty);
+		for(; j + 3 <= hi; j += 4)
+		{
+			int32x4_t cost = vdupq_n_s32(0);
+			for(int d = 0; d < a.dims; d++)
+				cost = vaddq_s32(cost, vabdq_s32(vdupq_n_s32(rowA[d * n]), vld1q_s32(&fixedB[d * m + j - 1])));
+			int32x4_t match = vaddq_s32(vld1q_s32(&fixedPrev[j - 1]), cost);
+			int32x4_t deletion = vaddq_s32(vld1q_s32(&fixedPrev[j]), penaltyV);
+			vst1q_s32(&fixedDiag[j], vminq_s32(match, deletion));
+		}
+#endif
+		for(; j <= hi; j++)
+		{
+			qint32 cost = 0;
+			for(int d = 0; d < a.dims; d++)
+				cost += std::abs(rowA[d * n] - fixedB[d * m + j - 1]);
+			fixedDiag[j] = std::min(fixedPrev[j - 1] + cost, fixedPrev[j] + penalty);
+		}
+
+		qint32 rowMin = FIXED_INFINITY;
+		for(j = lo; j <= hi; j++)
+		{
+			fixedCur[j] = std::min(fixedDiag[j], fixedCur[j - 1] + penalty);
+			rowMin = std::min(rowMin, fixedCur[j]);
+		}
+		if(rowMin > bound)
+			return rowMin / scale;
+
+		if(i < n) {
+			const int nextHi = std::min(m, (int)((double)(i + 1) * m / n + 0.5) + radius);
+			for(j = hi + 1; j <= nextHi; j++)
+				fixedCur[j] = FIXED_INFINITY;
+		}
+		fixedPrev.swap(fixedCur);
+	}
+	return fixedPrev[m] / scale;
+}
+
+int validateSequenceCompare(const QString& corpusDir, QStringList& report)
+{
+	QDir corpus(corpusDir);
+	if(!corpus.exists())
+		return -1;
+	QString tool = QDir(HANDS_COMPARE_DIR).absoluteFilePath("StringCompare.exe");
+	SequenceComparator comparator;
+	int mismatches = 0;
+	QStringList pairs = corpus.entryList(QDir::Dirs | QDir::NoDotAndDotDot, QDir::Name);
+	foreach(const QString& pair, pairs)
+	{
+		QDir pairDir(corpus.absoluteFilePath(pair));
+		ShapeSequence etalon, hand;
+		if(!loadSequence(pairDir.absoluteFilePath(ETALON_SEQ_NAME), etalon) ||
+			!loadSequence(pairDir.absoluteFilePath(HAND_SEQ_NAME), hand))
+		{
+			report << pair + ": can't read sequences";
+			mismatches++;
+			continue;
+		}
+		pairDir.remove(DISSIMILARITY_MEASURE);
+		QFile resultFile(pairDir.absoluteFilePath(DISSIMILARITY_MEASURE));
+		if(!runTool("\"" + QDir::toNativeSeparators(tool) + "\" " + ETALON_SEQ_NAME + " " + HAND_SEQ_NAME + " " + QString::number(MULCT), pairDir.absolutePath()) ||
+			!resultFile.open(QFile::ReadOnly | QFile::Text))
+		{
+			report << pair + ": StringCompare.exe failed";
+			mismatches++;
+			continue;
+		}
+		QString expected = QString(resultFile.readAll()).trimmed();
+		// Compare at the precision the tool prints
+		int dot = expected.indexOf('.');
+		int decimals = (dot < 0) ? 0 : expected.length() - dot - 1;
+		QString actual = QString::number(comparator.compare(etalon, hand), 'f', decimals);
+		if(actual != expected) {
+			report << pair + ": expected " + expected + ", got " + actual;
+			mismatches++;
+		}
+	}
+	report << QString("%1 pairs, %2 mismatches").arg(pairs.size()).arg(mismatches);
+	return mismatches;
+}
+
+// Smooth features peaking at amplitude, phase shifts one sequence against another
+static ShapeSequence syntheticSequence(int length, int dims, double amplitude, double phase)
+{
+	ShapeSequence seq;
+	seq.length = length;
+	seq.dims = dims;
+	seq.features.resize(length * dims);
+	for(int d = 0; d < dims; d++)
+		for(int k = 0; k < length; k++)
+			seq.features[d * length + k] = amplitude * cos(0.37 * k * (d + 1) + phase);
+	seq.features[0] = amplitude;
+	return seq;
+}
+
+int validateFixedCompare(const QString& corpusDir, QStringList& report)
+{
+	QDir corpus(corpusDir);
+	if(!corpus.exists())
+		return -1;
+	SequenceComparator reference(MULCT, SEQ_COMPARE_BAND, false);
+	SequenceComparator fixed(MULCT, SEQ_COMPARE_BAND, true);
+	const double threshold = HAND_THRESHOLD / 100.0;
+	int compared = 0, flipped = 0;
+	double maxDeviation = 0, sumDeviation = 0;
+	QStringList pairs = corpus.entryList(QDir::Dirs | QDir::NoDotAndDotDot, QDir::Name);
+	foreach(const QString& pair, pairs)
+	{
+		QDir pairDir(corpus.absoluteFilePath(pair));
+		ShapeSequence etalon, hand;
+		if(!loadSequence(pairDir.absoluteFilePath(ETALON_SEQ_NAME), etalon) ||
+			!loadSequence(pairDir.absoluteFilePath(HAND_SEQ_NAME), hand))
+		{
+			report << pair + ": can't read sequences";
+			continue;
+		}
+		double expected = reference.compare(etalon, hand);
+		double actual = fixed.compare(etalon, hand);
+		double deviation = fabs(actual - expected);
+		compared++;
+		sumDeviation += deviation;
+		maxDeviation = std::max(maxDeviation, deviation);
+		if((actual <= threshold) != (expected <= threshold)) {
+			report << pair + QString(": decision flipped, double %1, fixed %2").arg(expected).arg(actual);
+			flipped++;
+		}
+	}
+	report << QString("%1 pairs, max deviation %2, mean deviation %3, %4 flipped decisions")
+		.arg(compared).arg(maxDeviation).arg(compared ? sumDeviation / compared : 0.0).arg(flipped);
+
+	// Features around the quantization limit: below it only rounding may differ, half a step per
+	// feature and per penalty along a path of at most n + m cells, beyond it the double path runs
+	const int dims = 4;
+	const double tolerance = (2.0 * dims + 1) / (1 << SEQ_FIXED_BITS);
+	const double limit = (double)FIXED_FEATURE_LIMIT / (1 << SEQ_FIXED_BITS);
+	const double amplitudes[] = { limit - 0.5, limit, limit + 0.5, 4 * limit };
+	int disagreements = 0;
+	for(int k = 0; k < 4; k++)
+	{
+		ShapeSequence a = syntheticSequence(32, dims, amplitudes[k], 0);
+		ShapeSequence b = syntheticSequence(28, dims, amplitudes[k], 0.2);
+		double expected = reference.compare(a, b);
+		double actual = fixed.compare(a, b);
+		if(fabs(actual - expected) > tolerance) {
+			report << QString("features up to %1: double %2, fixed %3").arg(amplitudes[k]).arg(expected).arg(actual);
+			disagreements++;
+		}
+	}
+	report << QString("%1 of 4 near limit pairs disagree").arg(disagreements);
+	return flipped + disagreements;
+}
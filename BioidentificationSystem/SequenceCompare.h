@@ -0,0 +1,80 @@
+#ifndef SEQUENCECOMPARE_H
+#define SEQUENCECOMPARE_H
+
+#include <float.h>
+
+#include "general.h"
+
+// Encoded hand shape as written by BmpToSeq: one element per line,
+// LEGANDRES-order feature vector per element. Features stored by dimension
+// (features[d * length + k]) so the DP kernel reads consecutive elements.
+struct ShapeSequence
+{
+	ShapeSequence()
+		: length(0), dims(0) {}
+	std::vector<double> features;
+	int length;
+	int dims;
+	QByteArray source; // Text it was parsed from, written back as is for the tools
+
+	bool empty() const
+		{ return length == 0; }
+	double at(int k, int d) const
+		{ return features[d * length + k]; }
+};
+
+bool loadSequence(const QString& fileName, ShapeSequence& seq);
+bool parseSequence(const QByteArray& data, ShapeSequence& seq);
+// The source bytes if the sequence has them, so StringCompare.exe reads what BmpToSeq.exe wrote;
+// otherwise element count header, then one element per line, as loadSequence reads it back
+bool saveSequence(const QString& fileName, const ShapeSequence& seq);
+
+// MULCT-penalized edit distance between sequences, as StringCompare.exe:
+// substitution costs L1 distance of element features, insertion/deletion costs mulct,
+// result is normalized by the longer sequence.
+// One comparator per thread, its DP rows are reused between calls.
+// The fixed point variant quantizes features to SEQ_FIXED_BITS fraction bits
+// and runs the DP on int32, for boards without a fast FPU; sequences with a feature
+// beyond its range are compared in double.
+class SequenceComparator
+{
+public:
+	SequenceComparator(double mulct = MULCT, double band = SEQ_COMPARE_BAND, bool fixedPoint = SEQ_COMPARE_FIXED);
+
+	// Stops as soon as the result can't be <= threshold and returns the partial
+	// lower bound (> threshold) then.
+	double compare(const ShapeSequence& a, const ShapeSequence& b, double threshold = DBL_MAX);
+
+	void setBand(double band)
+		{ this->band = band; }
+	void setFixedPoint(bool fixedPoint)
+		{ this->fixedPoint = fixedPoint; }
+
+private:
+	double compareFixed(const ShapeSequence& a, const ShapeSequence& b, double threshold);
+
+	double mulct;
+	double band; // Sakoe-Chiba radius as share of the longer sequence, 1 - full matrix
+	bool fixedPoint;
+	std::vector<double> prev;
+	std::vector<double> cur;
+	std::vector<double> diag;
+	std::vector<qint32> fixedA;
+	std::vector<qint32> fixedB;
+	std::vector<qint32> fixedPrev;
+	std::vector<qint32> fixedCur;
+	std::vector<qint32> fixedDiag;
+};
+
+// Runs StringCompare.exe for etalon.seq/hand.seq in every subdirectory of corpusDir
+// and checks the in-process result to the printed precision of DissimilarityMeasure.txt.
+// Returns number of mismatches, -1 if the corpus can't be read.
+int validateSequenceCompare(const QString& corpusDir, QStringList& report);
+
+// Fixed point against double comparison for etalon.seq/hand.seq in every subdirectory
+// of corpusDir: largest and mean deviation, decisions flipped at HAND_THRESHOLD; then
+// synthetic pairs with features around the quantization limit.
+// Returns flipped decisions plus disagreeing synthetic pairs, -1 if the corpus can't be read.
+int validateFixedCompare(const QString& corpusDir, QStringList& report);
+
+#endif // SEQUENCECOMPARE_H
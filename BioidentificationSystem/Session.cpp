@@ -0,0 +1,237 @@
+#include <QtConcurrentRun>
+
+#include "Session.h"
+
+static const quint32 SESSION_MAGIC = 0x53534850; // "PHSS"
+static const quint32 CHUNK_MAGIC = 0x4b4e4843; // "CHNK"
+static const quint32 SESSION_VERSION = 2;
+
+struct SessionHeader
+{
+	quint32 magic;
+	quint32 version;
+};
+
+struct ChunkHeader
+{
+	quint32 magic;
+	quint32 compressedSize;
+	quint32 records;
+};
+
+// Record: type (qint32), time (qint64), then
+// SESSION_FRAME: rows, cols, type (qint32), pixels rows x cols x elemSize
+// SESSION_PARAMETER: parameter, value (qint32)
+// SESSION_MODEL: face id (qint32), lookup table as SESSION_FRAME
+template<typename T>
+static void put(QByteArray& data, T value)
+{
+	data.append((const char*)&value, sizeof(value));
+}
+
+template<typename T>
+static bool get(const QByteArray& data, int& position, T& value)
+{
+	if(position + (int)sizeof(value) > data.size())
+		return false;
+	memcpy(&value, data.constData() + position, sizeof(value));
+	position += sizeof(value);
+	return true;
+}
+
+SessionRecorder::SessionRecorder()
+	: chunkRecords(0) {}
+
+SessionRecorder::~SessionRecorder()
+{
+	stop();
+}
+
+bool SessionRecorder::start(const QString& fileName)
+{
+	stop();
+	file.setFileName(fileName);
+	if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+		return false;
+	SessionHeader header = { SESSION_MAGIC, SESSION_VERSION };
+	file.write((const char*)&header, sizeof(header));
+	chunk.clear();
+	chunk.reserve(SESSION_CHUNK_SIZE + SESSION_CHUNK_SIZE / 4);
+	chunkRecords = 0;
+	clock.start();
+	return true;
+}
+
+void SessionRecorder::stop()
+{
+	if(!file.isOpen())
+		return;
+	flushChunk();
+	lastWrite.waitForFinished();
+	file.close();
+}
+
+void SessionRecorder::beginRecord(int type)
+{
+	put<qint32>(chunk, type);
+	put<qint64>(chunk, clock.elapsed());
+	chunkRecords++;
+}
+
+void SessionRecorder::putMat(const cv::Mat& mat)
+{
+	put<qint32>(chunk, mat.rows);
+	put<qint32>(chunk, mat.cols);
+	put<qint32>(chunk, mat.type());
+	int rowBytes = mat.cols * (int)mat.elemSize();
+	for(int i = 0; i < mat.rows; i++)
+		chunk.append((const char*)mat.ptr(i), rowBytes);
+}
+
+void SessionRecorder::frame(const cv::Mat& frame)
+{
+	if(!isRecording() || frame.empty())
+		return;
+	beginRecord(SESSION_FRAME);
+	putMat(frame);
+	if(chunk.size() >= SESSION_CHUNK_SIZE)
+		flushChunk();
+}
+
+void SessionRecorder::parameter(int parameter, int value)
+{
+	if(!isRecording())
+		return;
+	beginRecord(SESSION_PARAMETER);
+	put<qint32>(chunk, parameter);
+	put<qint32>(chunk, value);
+}
+
+void SessionRecorder::retrain()
+{
+	if(!isRecording())
+		return;
+	beginRecord(SESSION_RETRAIN);
+}
+
+void SessionRecorder::model(int faceId, const cv::Mat& lut)
+{
+	if(!isRecording() || lut.empty())
+		return;
+	beginRecord(SESSION_MODEL);
+	put<qint32>(chunk, faceId);
+	putMat(lut);
+}
+
+// One chunk in flight, so chunks reach the file in order
+void SessionRecorder::flushChunk()
+{
+	if(chunkRecords == 0)
+		return;
+	lastWrite.waitForFinished();
+	lastWrite = QtConcurrent::run(&SessionRecorder::writeChunk, &file, chunk, chunkRecords);
+	chunk = QByteArray();
+	chunk.reserve(SESSION_CHUNK_SIZE + SESSION_CHUNK_SIZE / 4);
+	chunkRecords = 0;
+}
+
+void SessionRecorder::writeChunk(QFile *file, QByteArray raw, quint32 records)
+{
+	QByteArray compressed = qCompress(raw, SESSION_COMPRESSION);
+	ChunkHeader header = { CHUNK_MAGIC, (quint32)compressed.size(), records };
+	file->write((const char*)&header, sizeof(header));
+	file->write(compressed);
+}
+
+SessionPlayer::SessionPlayer()
+	: position(0) {}
+
+SessionPlayer::~SessionPlayer()
+{
+	close();
+}
+
+bool SessionPlayer::open(const QString& fileName)
+{
+	close();
+	file.setFileName(fileName);
+	if(!file.open(QIODevice::ReadOnly))
+		return false;
+	SessionHeader header;
+	if(file.read((char*)&header, sizeof(header)) != sizeof(header) ||
+		header.magic != SESSION_MAGIC || header.version != SESSION_VERSION)
+	{
+		file.close();
+		return false;
+	}
+	chunk.clear();
+	position = 0;
+	nextChunk = QtConcurrent::run(&SessionPlayer::readChunk, &file);
+	return true;
+}
+
+void SessionPlayer::close()
+{
+	if(!file.isOpen())
+		return;
+	nextChunk.waitForFinished();
+	file.close();
+	chunk.clear();
+}
+
+// Empty at the end or on a torn chunk
+QByteArray SessionPlayer::readChunk(QFile *file)
+{
+	ChunkHeader header;
+	if(file->read((char*)&header, sizeof(header)) != sizeof(header) || header.magic != CHUNK_MAGIC)
+		return QByteArray();
+	QByteArray compressed = file->read(header.compressedSize);
+	if(compressed.size() != (int)header.compressedSize)
+		return QByteArray();
+	return qUncompress(compressed);
+}
+
+bool SessionPlayer::read(SessionRecord& record)
+{
+	if(!isOpen())
+		return false;
+	if(position >= chunk.size())
+	{
+		chunk = nextChunk.result();
+		position = 0;
+		if(chunk.isEmpty())
+			return false;
+		nextChunk = QtConcurrent::run(&SessionPlayer::readChunk, &file);
+	}
+	qint32 type;
+	if(!get(chunk, position, type) || !get(chunk, position, record.time))
+		return false;
+	record.type = type;
+	if(type == SESSION_MODEL)
+	{
+		qint32 faceId;
+		if(!get(chunk, position, faceId))
+			return false;
+		record.parameter = faceId;
+	}
+	if(type == SESSION_FRAME || type == SESSION_MODEL)
+	{
+		qint32 rows, cols, matType;
+		if(!get(chunk, position, rows) || !get(chunk, position, cols) || !get(chunk, position, matType))
+			return false;
+		// New buffer, the previous frame may still be in use
+		record.frame = cv::Mat(rows, cols, matType);
+		int bytes = (int)(record.frame.total() * record.frame.elemSize());
+		if(position + bytes > chunk.size())
+			return false;
+		memcpy(record.frame.data, chunk.constData() + position, bytes);
+		position += bytes;
+	} else if(type == SESSION_PARAMETER) {
+		qint32 parameter, value;
+		if(!get(chunk, position, parameter) || !get(chunk, position, value))
+			return false;
+		record.parameter = parameter;
+		record.value = value;
+	}
+	return true;
+}
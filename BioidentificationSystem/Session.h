@@ -0,0 +1,101 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <QFile>
+#include <QTime>
+#include <QFuture>
+
+#include "general.h"
+
+// Session file: header, then qCompress'ed chunks of timestamped records
+// (camera frames, parameter changes, retrain requests, deployed skin models) in recording order.
+
+enum SessionRecordType
+{
+	SESSION_FRAME,
+	SESSION_PARAMETER,
+	SESSION_RETRAIN,
+	SESSION_MODEL, // Skin model switched before the next frame, replayed instead of training
+};
+
+// Live parameters, values as the sliders set them
+enum SessionParameter
+{
+	SESSION_PARAM_S,
+	SESSION_LOW_THRESHOLD,
+	SESSION_RATIO,
+	SESSION_APERTURE,
+	SESSION_CANNY_CONTOUR_MERGE_EPS,
+	SESSION_HAND_THRESHOLD,
+	SESSION_TOP_HAND_THRES,
+	SESSION_APPROX_POLY,
+};
+
+struct SessionRecord
+{
+	SessionRecord()
+		: type(SESSION_FRAME), time(0), parameter(0), value(0) {}
+	int type;
+	qint64 time; // ms since recording start
+	int parameter; // Face id for SESSION_MODEL
+	int value;
+	cv::Mat frame; // Lookup table for SESSION_MODEL
+};
+
+// Records are buffered into SESSION_CHUNK_SIZE chunks, compressed and written
+// on the thread pool while the next chunk fills. Used from one thread.
+class SessionRecorder
+{
+public:
+	SessionRecorder();
+	~SessionRecorder();
+
+	bool start(const QString& fileName);
+	// Writes the last chunk
+	void stop();
+	bool isRecording() const
+		{ return file.isOpen(); }
+
+	void frame(const cv::Mat& frame);
+	void parameter(int parameter, int value);
+	void retrain();
+	void model(int faceId, const cv::Mat& lut);
+
+private:
+	void beginRecord(int type);
+	void putMat(const cv::Mat& mat);
+	void flushChunk();
+	static void writeChunk(QFile *file, QByteArray raw, quint32 records);
+
+	QFile file;
+	QByteArray chunk;
+	quint32 chunkRecords;
+	QTime clock;
+	QFuture<void> lastWrite;
+};
+
+// Reads records back in order, the next chunk is decompressed in background
+class SessionPlayer
+{
+public:
+	SessionPlayer();
+	~SessionPlayer();
+
+	bool open(const QString& fileName);
+	void close();
+	bool isOpen() const
+		{ return file.isOpen(); }
+
+	// false at the end of the session
+	bool read(SessionRecord& record);
+
+private:
+	static QByteArray readChunk(QFile *file);
+
+	QFile file;
+	QByteArray chunk;
+	int position;
+	QFuture<QByteArray> nextChunk;
+};
+
+#endif // SESSION_H
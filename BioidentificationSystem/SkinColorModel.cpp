@@ -0,0 +1,156 @@
+#include "SkinColorModel.h"
+#include "Scheduler.h"
+#include "PixelKernels.h"
+
+static const int LUT_SIZE = 1 << (3 * SKIN_LUT_BITS);
+
+static cv::Vec3b binCenter(int k)
+{
+	const int shift = 8 - SKIN_LUT_BITS;
+	const int mask = (1 << SKIN_LUT_BITS) - 1;
+	const int half = 1 << (shift - 1);
+	return cv::Vec3b((((k >> (2 * SKIN_LUT_BITS)) & mask) << shift) + half,
+		(((k >> SKIN_LUT_BITS) & mask) << shift) + half,
+		((k & mask) << shift) + half);
+}
+
+SkinColorModel::SkinColorModel()
+	: histogram(1, LUT_SIZE, CV_32FC1, cv::Scalar(0)),
+	histogramWeight(0),
+	observedPixels(0),
+	lut(1, LUT_SIZE, CV_8UC1, cv::Scalar(0)),
+	classifierCoverage(0),
+	trainedCoverage(0) {}
+
+void SkinColorModel::update(const cv::Mat& skinPatch)
+{
+	if(skinPatch.empty())
+		return;
+	CV_Assert(skinPatch.depth() == CV_8U && (skinPatch.channels() == 1 || skinPatch.channels() == 3 || skinPatch.channels() == 4));
+	// First patch fills the model, later ones replace SKIN_MODEL_FORGETTING of it
+	float alpha = (histogramWeight == 0) ? 1 : SKIN_MODEL_FORGETTING;
+	histogram *= (1 - alpha);
+	float *hist = histogram.ptr<float>();
+	const float pixelWeight = alpha / skinPatch.total();
+	switch(skinPatch.channels())
+	{
+	case 1:
+		accumulateColors<1>(skinPatch, hist, pixelWeight);
+		break;
+	case 4:
+		accumulateColors<4>(skinPatch, hist, pixelWeight);
+		break;
+	default:
+		accumulateColors<3>(skinPatch, hist, pixelWeight);
+	}
+	histogramWeight = 1;
+	observedPixels += skinPatch.total();
+	updateLut();
+}
+
+void SkinColorModel::resetHistogram()
+{
+	histogram.setTo(cv::Scalar(0));
+	histogramWeight = 0;
+	observedPixels = 0;
+	updateLut();
+}
+
+void SkinColorModel::setClassifierLut(const cv::Mat& lut)
+{
+	classifierLut = lut;
+	updateLut();
+	trainedCoverage = classifierCoverage;
+}
+
+std::vector<ColorBin> SkinColorModel::bins() const
+{
+	const float *hist = histogram.ptr<float>();
+	int used = 0;
+	for(int k = 0; k < LUT_SIZE; k++)
+		if(hist[k] > 0)
+			used++;
+	std::vector<ColorBin> result;
+	result.reserve(used);
+	for(int k = 0; k < LUT_SIZE; k++)
+	{
+		if(hist[k] <= 0)
+			continue;
+		cv::Vec3b bgr = binCenter(k);
+		result.push_back(ColorBin((float)(hist[k] * observedPixels), bgr[0], bgr[1], bgr[2]));
+	}
+	return result;
+}
+
+// Table entries of buildLut
+struct ClassifyBins
+{
+	ClassifyBins(PixelClassifier& classifier, uchar *table)
+		: classifier(classifier), table(table) {}
+	void operator()(const cv::Range& bins) const {
+		for(int k = bins.start; k < bins.end; k++)
+		{
+			cv::Vec3b bgr = binCenter(k);
+			table[k] = classifier.classify(Pixel(bgr[2], bgr[1], bgr[0])) ? 255 : 0;
+		}
+	}
+	PixelClassifier& classifier;
+	uchar *table;
+};
+
+// Rows of classifyImage
+template<int CN>
+struct ClassifyRows
+{
+	ClassifyRows(const cv::Mat& frame, const uchar *skinTable, cv::Mat& skin)
+		: frame(frame), skinTable(skinTable), skin(skin) {}
+	void operator()(const cv::Range& rows) const {
+		classifySkinRows<CN>(frame, skinTable, skin, rows.start, rows.end);
+	}
+	const cv::Mat& frame;
+	const uchar *skinTable;
+	cv::Mat& skin;
+};
+
+cv::Mat SkinColorModel::buildLut(PixelClassifier& classifier)
+{
+	cv::Mat table(1, LUT_SIZE, CV_8UC1);
+	parallelFor(0, LUT_SIZE, ClassifyBins(classifier, table.ptr<uchar>()), 1024);
+	return table;
+}
+
+// Incremental: only a pass over the table, no classifier evaluation
+void SkinColorModel::updateLut()
+{
+	const float *hist = histogram.ptr<float>();
+	const uchar *trained = classifierLut.empty() ? NULL : classifierLut.ptr<uchar>();
+	uchar *l = lut.ptr<uchar>();
+	float covered = 0;
+	for(int k = 0; k < LUT_SIZE; k++)
+	{
+		bool observed = hist[k] >= SKIN_MODEL_MIN_WEIGHT;
+		bool accepted = (trained != NULL) && trained[k];
+		if(accepted)
+			covered += hist[k];
+		l[k] = (observed || accepted) ? 255 : 0;
+	}
+	classifierCoverage = (histogramWeight > 0) ? covered / histogramWeight : 1;
+}
+
+cv::Mat SkinColorModel::classifyImage(const cv::Mat& frame, const cv::Mat& lut)
+{
+	CV_Assert(frame.depth() == CV_8U && (frame.channels() == 1 || frame.channels() == 3 || frame.channels() == 4));
+	cv::Mat skin(frame.rows, frame.cols, CV_8UC1);
+	switch(frame.channels())
+	{
+	case 1:
+		parallelFor(0, frame.rows, ClassifyRows<1>(frame, lut.ptr<uchar>(), skin));
+		break;
+	case 4:
+		parallelFor(0, frame.rows, ClassifyRows<4>(frame, lut.ptr<uchar>(), skin));
+		break;
+	default:
+		parallelFor(0, frame.rows, ClassifyRows<3>(frame, lut.ptr<uchar>(), skin));
+	}
+	return skin;
+}
@@ -0,0 +1,59 @@
+#ifndef SKINCOLORMODEL_H
+#define SKINCOLORMODEL_H
+
+#include "general.h"
+#include "PixelClassifier.h"
+#include "TrainingSet.h"
+
+// Skin colour histogram accumulated over face patches of recent frames with
+// exponential forgetting, and the lookup table used to classify frame pixels.
+// Lookup table = trained classifier's table OR colours currently observed in the histogram,
+// so small lighting drift is followed per frame without retraining.
+class SkinColorModel
+{
+public:
+	SkinColorModel();
+
+	void update(const cv::Mat& skinPatch);
+	void resetHistogram();
+
+	void setClassifierLut(const cv::Mat& lut);
+	bool hasClassifierLut() const
+		{ return !classifierLut.empty(); }
+	// Share of histogram weight the trained classifier accepts
+	float coverage() const
+		{ return classifierCoverage; }
+	// Observed skin moved away from what the classifier was trained on
+	bool drifted() const
+		{ return hasClassifierLut() && classifierCoverage < trainedCoverage * SKIN_MODEL_COVERAGE; }
+
+	bool classify(const cv::Vec3b& bgr) const
+		{ return lut.ptr<uchar>()[index(bgr)] != 0; }
+	const cv::Mat& getLut() const
+		{ return lut; }
+
+	// Histogram bins weighted in pixels: share of the histogram times the pixels observed
+	// since the last reset, as binColors weighs a single sample
+	std::vector<ColorBin> bins() const;
+
+	static cv::Mat buildLut(PixelClassifier& classifier);
+	// CV_8UC1 mask, 255 - skin by lut. Frame is 8-bit 1, 3 or 4 channel, CV_Assert otherwise
+	static cv::Mat classifyImage(const cv::Mat& frame, const cv::Mat& lut);
+	static int index(const cv::Vec3b& bgr) {
+		const int shift = 8 - SKIN_LUT_BITS;
+		return ((bgr[0] >> shift) << (2 * SKIN_LUT_BITS)) | ((bgr[1] >> shift) << SKIN_LUT_BITS) | (bgr[2] >> shift);
+	}
+
+private:
+	void updateLut();
+
+	cv::Mat histogram; // CV_32FC1, 1 x 2^(3*SKIN_LUT_BITS), sums to 1 once filled
+	float histogramWeight;
+	double observedPixels; // Of the patches since the last reset
+	cv::Mat classifierLut;
+	cv::Mat lut;
+	float classifierCoverage;
+	float trainedCoverage;
+};
+
+#endif // SKINCOLORMODEL_H
@@ -0,0 +1,42 @@
+#ifndef STAGECACHE_H
+#define STAGECACHE_H
+
+#include <vector>
+
+// Versions of pipeline inputs (frame, parameters, models) and, per stage, the versions
+// its output was computed from. A stage is re-run only when one of its declared inputs changed.
+class StageCache
+{
+public:
+	StageCache(int inputs, int stages)
+		: versions(inputs, 0), dependencies(stages), seen(stages), computedOnce(stages, false) {}
+
+	void depends(int stage, int input)
+		{ dependencies[stage].push_back(input); seen[stage].push_back(0); }
+	void touch(int input)
+		{ versions[input]++; }
+	void invalidate(int stage)
+		{ computedOnce[stage] = false; }
+
+	bool fresh(int stage) const {
+		if(!computedOnce[stage])
+			return false;
+		for(size_t k = 0; k < dependencies[stage].size(); k++)
+			if(seen[stage][k] != versions[dependencies[stage][k]])
+				return false;
+		return true;
+	}
+	void computed(int stage) {
+		for(size_t k = 0; k < dependencies[stage].size(); k++)
+			seen[stage][k] = versions[dependencies[stage][k]];
+		computedOnce[stage] = true;
+	}
+
+private:
+	std::vector<unsigned> versions;
+	std::vector<std::vector<int> > dependencies;
+	std::vector<std::vector<unsigned> > seen;
+	std::vector<bool> computedOnce;
+};
+
+#endif // STAGECACHE_H
@@ -0,0 +1,315 @@
+#include <time.h>
+#include <algorithm>
+#include <QtConcurrentRun>
+#include <QThreadPool>
+#include <QFile>
+#include <QTextStream>
+
+#include "StreamEngine.h"
+#include "Scheduler.h"
+
+static float msSince(clock_t startTime)
+{
+	return 1000.f * (clock() - startTime) / CLOCKS_PER_SEC;
+}
+
+Stream::Stream(int id, const QString& source, StreamShared *shared)
+	: lastLatency(0),
+	id(id),
+	source(source),
+	shared(shared),
+	readFrameFails(0),
+	readFailed(false),
+	nextFaceId(0),
+	framesSinceFullDetect(0),
+	recognizer(HANDS_COMPARE_DIR + STREAM_WORK_DIR + QString::number(id) + "/", &shared->gallery)
+{
+	stats.source = source;
+}
+
+Stream::~Stream()
+{
+	close();
+	foreach(QFuture<cv::Mat> training, trainings)
+		training.waitForFinished();
+}
+
+bool Stream::open()
+{
+	readFrameFails = 0;
+	readFailed = false;
+	if(source.startsWith(STREAM_RING_PREFIX))
+		return ring.attach(source.mid(STREAM_RING_PREFIX.length()));
+	bool isDevice;
+	int device = source.toInt(&isDevice);
+	return isDevice ? cap.open(device) : cap.open(source.toStdString());
+}
+
+void Stream::close()
+{
+	ring.detach();
+	if(cap.isOpened())
+		cap.release();
+}
+
+bool Stream::read()
+{
+	if(ring.isAttached()) {
+		readFailed = !ring.next(frame);
+		return !readFailed;
+	}
+	while(!cap.read(frame))
+		if(++readFrameFails == CRITICAL_READ_FRAME_FAILS) {
+			readFailed = true;
+			return false;
+		}
+	readFrameFails = 0;
+	return true;
+}
+
+// A face found by two overlapping ROIs would start a second track
+static bool alreadyDetected(const std::vector<cv::Rect>& detected, const cv::Rect& face)
+{
+	for(size_t k = 0; k < detected.size(); k++)
+	{
+		double intersection = (face & detected[k]).area();
+		if(intersection / (face.area() + detected[k].area() - intersection) >= FACE_TRACK_OVERLAP)
+			return true;
+	}
+	return false;
+}
+
+// Tracked faces are searched for only around their last places, with FACE_BATCHING in one pass
+// with the other streams' searches. The whole frame is scanned every FACE_FULL_DETECT_INTERVAL frames
+// and as soon as a tracked face isn't found around its place.
+void Stream::findFaces()
+{
+	cv::Mat frameGray;
+	toGray(frame, frameGray);
+	cv::equalizeHist(frameGray, frameGray);
+	std::vector<cv::Rect> tracked = visibleFaces(faces);
+	std::vector<cv::Rect> detected;
+	bool fullDetect = tracked.empty() || ++framesSinceFullDetect >= FACE_FULL_DETECT_INTERVAL;
+	for(size_t k = 0; k < tracked.size() && !fullDetect; k++)
+	{
+		int dx = cvRound(tracked[k].width * FACE_ROI_MARGIN);
+		int dy = cvRound(tracked[k].height * FACE_ROI_MARGIN);
+		cv::Rect roi = cv::Rect(tracked[k].x - dx, tracked[k].y - dy, tracked[k].width + 2*dx, tracked[k].height + 2*dy) &
+			cv::Rect(0, 0, frame.cols, frame.rows);
+		std::vector<cv::Rect> found;
+		if(FACE_BATCHING)
+			shared->faceBatcher.detect(frameGray, roi, found);
+		else
+			FaceDetector::detect(frameGray, roi, found);
+		for(size_t f = 0; f < found.size(); f++)
+			if(!alreadyDetected(detected, found[f]))
+				detected.push_back(found[f]);
+		fullDetect = found.empty();
+	}
+	if(fullDetect)
+	{
+		detected.clear();
+		FaceDetector::detect(frameGray, detected);
+		framesSinceFullDetect = 0;
+	}
+	trackFaces(faces, detected, nextFaceId);
+}
+
+// Finished trainings to their faces, faces lost meanwhile drop theirs
+void Stream::deployTrainings()
+{
+	QMap<int, QFuture<cv::Mat> >::iterator training = trainings.begin();
+	while(training != trainings.end())
+	{
+		if(!training.value().isFinished()) {
+			++training;
+			continue;
+		}
+		cv::Mat lut = training.value().result();
+		for(size_t k = 0; k < faces.size(); k++)
+		{
+			if(faces[k].id != training.key())
+				continue;
+			if(!lut.empty()) {
+				faces[k].skinModel.setClassifierLut(lut);
+				faces[k].trained = true;
+			}
+			faces[k].training = false;
+		}
+		training = trainings.erase(training);
+	}
+}
+
+void Stream::process()
+{
+	pinWorker();
+	if(!read())
+		return;
+	clock_t captured = clock();
+	findFaces();
+	for(size_t k = 0; k < faces.size(); k++)
+	{
+		if(faces[k].misses > 0)
+			continue;
+		cv::resize(frame(faces[k].rect), faces[k].face, cv::Size(FACE_WIDTH, FACE_HEIGHT));
+		sampleFaceSkin(faces[k]);
+	}
+
+	// Training runs next to the streams, a face keeps its old model meanwhile
+	deployTrainings();
+	for(size_t k = 0; k < faces.size(); k++)
+	{
+		FaceTrack& track = faces[k];
+		if(track.training || track.misses > 0 || (track.skinModel.hasClassifierLut() && !track.skinModel.drifted()))
+			continue;
+		trainings.insert(track.id, QtConcurrent::run(trainSkinLut, track.skinModel.bins(), KERNEL_PARAM_S));
+		track.training = true;
+	}
+
+	lastHands.clear();
+	cv::Mat lut = trackedSkinLut(faces);
+	if(!lut.empty())
+	{
+		RecognitionTimings timings;
+		lastHands = recognizer.recognize(frame, lut, timings, HandFilter(visibleFaces(faces)));
+	}
+	lastLatency = msSince(captured);
+}
+
+StreamEngine::StreamEngine(QObject *parent)
+	: QObject(parent),
+	running(0),
+	stopping(false)
+{
+	shared.gallery.load(HANDS_COMPARE_DIR + GALLERY_DIR);
+	// One pool thread stays free for classifier training and other pool jobs
+	maxRunning = std::max(1, QThreadPool::globalInstance()->maxThreadCount() - 1);
+	connect(&statsTimer, SIGNAL(timeout()), this, SLOT(updateStats()));
+}
+
+StreamEngine::~StreamEngine()
+{
+	stop();
+	for(size_t k = 0; k < streams.size(); k++)
+		delete streams[k];
+}
+
+int StreamEngine::addStream(const QString& source)
+{
+	int id = (int)streams.size();
+	Stream *stream = new Stream(id, source, &shared);
+	if(!stream->open())
+	{
+		delete stream;
+		return -1;
+	}
+	streams.push_back(stream);
+	QFutureWatcher<void> *watcher = new QFutureWatcher<void>(this);
+	connect(watcher, SIGNAL(finished()), this, SLOT(frameDone()));
+	watchers.push_back(watcher);
+	framesSinceStats.push_back(0);
+	return id;
+}
+
+void StreamEngine::start()
+{
+	stopping = false;
+	for(int k = 0; k < (int)streams.size(); k++)
+	{
+		streams[k]->ready.start();
+		readyStreams.enqueue(k);
+	}
+	shared.faceBatcher.setExpected(std::min(maxRunning, (int)streams.size()));
+	statsClock.start();
+	statsTimer.start(STREAM_STATS_INTERVAL);
+	schedule();
+}
+
+// Closes the streams, the engine can't be started again
+void StreamEngine::stop()
+{
+	if(stopping)
+		return;
+	stopping = true;
+	statsTimer.stop();
+	readyStreams.clear();
+	for(size_t k = 0; k < streams.size(); k++)
+		streams[k]->wake();
+	for(size_t k = 0; k < watchers.size(); k++)
+		watchers[k]->waitForFinished();
+	for(size_t k = 0; k < streams.size(); k++)
+		streams[k]->close();
+	running = 0;
+}
+
+void StreamEngine::schedule()
+{
+	while(!stopping && running < maxRunning && !readyStreams.isEmpty())
+	{
+		int k = readyStreams.dequeue();
+		Stream *stream = streams[k];
+		stream->stats.wait += STREAM_LATENCY_SMOOTHING * (stream->ready.elapsed() - stream->stats.wait);
+		running++;
+		watchers[k]->setFuture(QtConcurrent::run(stream, &Stream::process));
+	}
+}
+
+void StreamEngine::frameDone()
+{
+	if(stopping)
+		return;
+	QFutureWatcher<void> *watcher = static_cast<QFutureWatcher<void>*>(sender());
+	int k = (int)(std::find(watchers.begin(), watchers.end(), watcher) - watchers.begin());
+	Stream *stream = streams[k];
+	running--;
+	if(stream->failed()) {
+		stream->close();
+		emit streamFailed(k);
+	} else {
+		StreamStats& stats = stream->stats;
+		stats.hands = stream->lastHands;
+		stats.latency = (stats.frames == 0) ? stream->lastLatency :
+			stats.latency + STREAM_LATENCY_SMOOTHING * (stream->lastLatency - stats.latency);
+		stats.maxLatency = std::max(stats.maxLatency, (double)stream->lastLatency);
+		stats.frames++;
+		framesSinceStats[k]++;
+		// Back to the end of the queue: every ready stream gets a frame before this one's next
+		stream->ready.start();
+		readyStreams.enqueue(k);
+	}
+	schedule();
+}
+
+void StreamEngine::updateStats()
+{
+	int elapsed = statsClock.restart();
+	for(size_t k = 0; k < streams.size(); k++)
+	{
+		streams[k]->stats.fps = (elapsed > 0) ? framesSinceStats[k] * 1000.0 / elapsed : 0;
+		framesSinceStats[k] = 0;
+	}
+	writeReport();
+	emit statsUpdated();
+}
+
+void StreamEngine::writeReport()
+{
+	if(reportFile.isEmpty())
+		return;
+	QFile file(reportFile);
+	if(!file.open(QFile::WriteOnly | QFile::Text | QFile::Truncate))
+		return;
+	QTextStream out(&file);
+	for(size_t k = 0; k < streams.size(); k++)
+	{
+		const StreamStats& stats = streams[k]->stats;
+		out << k << " " << stats.source << (streams[k]->failed() ? " failed" : "")
+			<< QString(": %1 fps, latency %2 ms (max %3), wait %4 ms, %5 frames")
+				.arg(stats.fps, 0, 'f', 1).arg(stats.latency, 0, 'f', 1).arg(stats.maxLatency, 0, 'f', 1)
+				.arg(stats.wait, 0, 'f', 1).arg(stats.frames);
+		for(size_t h = 0; h < stats.hands.size(); h++)
+			if(stats.hands[h].matched)
+				out << ", " << stats.hands[h].identity << " " << QString::number(stats.hands[h].dissimilarity, 'f', 3);
+		out << "\n";
+	}
+}
@@ -0,0 +1,130 @@
+#ifndef STREAMENGINE_H
+#define STREAMENGINE_H
+
+#include <QObject>
+#include <QQueue>
+#include <QMap>
+#include <QTime>
+#include <QTimer>
+#include <QMutex>
+#include <QFuture>
+#include <QFutureWatcher>
+
+#include "general.h"
+#include "Recognizer.h"
+#include "FrameRing.h"
+#include "FaceDetector.h"
+
+struct StreamStats
+{
+	StreamStats()
+		: frames(0), fps(0), latency(0), maxLatency(0), wait(0) {}
+	QString source;
+	int frames;
+	double fps; // Over the last STREAM_STATS_INTERVAL
+	double latency; // ms from capture to result, smoothed
+	double maxLatency;
+	double wait; // ms a ready stream waited for the pool, smoothed
+	std::vector<HandResult> hands; // Of the last frame
+};
+
+// Shared by all streams of an engine
+struct StreamShared
+{
+	FaceBatcher faceBatcher; // Tracked faces of the streams in flight, with FACE_BATCHING
+	Gallery gallery; // Searched by all streams at once
+};
+
+// State of one camera: source, face tracks with their skin models, results. Only one frame
+// of a stream is in flight, so process() needs no locking except for the shared parts.
+// Faces and hands go through the same HandStages as in the camera pipeline.
+class Stream
+{
+public:
+	Stream(int id, const QString& source, StreamShared *shared);
+	~Stream();
+	bool open();
+	void close();
+	// Any thread: a stream waiting for a shared frame gives up
+	void wake()
+		{ ring.wake(); }
+	// One frame: read, track faces, follow their skin, recognize hands. Runs on the pool.
+	void process();
+	bool failed() const
+		{ return readFailed; }
+
+	StreamStats stats; // Updated by the engine between frames
+	QTime ready; // Since it was queued for the pool
+	// Of the last process()
+	std::vector<HandResult> lastHands;
+	float lastLatency;
+
+private:
+	bool read();
+	void findFaces();
+	void deployTrainings();
+
+	int id;
+	QString source;
+	StreamShared *shared;
+	cv::VideoCapture cap;
+	FrameRingReader ring;
+	int readFrameFails;
+	bool readFailed;
+
+	cv::Mat frame;
+	std::vector<FaceTrack> faces;
+	int nextFaceId;
+	int framesSinceFullDetect;
+	QMap<int, QFuture<cv::Mat> > trainings; // Classifier LUTs by face id
+	Recognizer recognizer;
+};
+
+// Many streams in one process: every stream keeps its own state, all of them share
+// the thread pool, the face cascades and the gallery. Ready streams are served first
+// come first served, a stream goes back to the end of the queue after each frame.
+class StreamEngine : public QObject
+{
+	Q_OBJECT
+
+public:
+	StreamEngine(QObject *parent = 0);
+	~StreamEngine();
+	// Before start(), returns the stream id or -1 if the source can't be opened
+	int addStream(const QString& source);
+	void start();
+	void stop();
+	int streamCount() const
+		{ return (int)streams.size(); }
+	const StreamStats& stats(int stream) const
+		{ return streams[stream]->stats; }
+	// Rewritten every STREAM_STATS_INTERVAL, empty - none
+	void setReportFile(const QString& fileName)
+		{ reportFile = fileName; }
+
+signals:
+	void statsUpdated();
+	void streamFailed(int stream);
+
+private slots:
+	void frameDone();
+	void updateStats();
+
+private:
+	void schedule();
+	void writeReport();
+
+	StreamShared shared;
+	std::vector<Stream*> streams;
+	std::vector<QFutureWatcher<void>*> watchers;
+	std::vector<int> framesSinceStats;
+	QQueue<int> readyStreams;
+	int running;
+	int maxRunning;
+	bool stopping;
+	QTimer statsTimer;
+	QTime statsClock;
+	QString reportFile;
+};
+
+#endif // STREAMENGINE_H
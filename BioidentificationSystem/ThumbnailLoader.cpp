@@ -0,0 +1,62 @@
+#include <QDir>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QCryptographicHash>
+#include <QtConcurrentRun>
+
+#include "ThumbnailLoader.h"
+
+ThumbnailLoader::ThumbnailLoader(QObject *parent)
+	: QObject(parent),
+	stopping(false) {}
+
+ThumbnailLoader::~ThumbnailLoader()
+{
+	stopping = true;
+	for(int k = 0; k < pending.size(); k++)
+		pending[k].waitForFinished();
+}
+
+void ThumbnailLoader::request(const QString& path)
+{
+	if(requested.contains(path))
+		return;
+	requested.insert(path);
+	for(int k = pending.size() - 1; k >= 0; k--)
+		if(pending[k].isFinished())
+			pending.removeAt(k);
+	pending.append(QtConcurrent::run(this, &ThumbnailLoader::load, path));
+}
+
+// Loads in flight still finish, their paths are looked up again by the receiver
+void ThumbnailLoader::reset()
+{
+	requested.clear();
+}
+
+QString ThumbnailLoader::cacheName(const QString& path)
+{
+	QFileInfo info(path);
+	QByteArray key = (info.absoluteFilePath() + "|" + QString::number(info.lastModified().toMSecsSinceEpoch())).toUtf8();
+	return THUMBNAIL_CACHE_DIR + QCryptographicHash::hash(key, QCryptographicHash::Md5).toHex() + ".png";
+}
+
+void ThumbnailLoader::load(const QString& path)
+{
+	if(stopping)
+		return;
+	QString cached = cacheName(path);
+	QImage thumbnail(cached);
+	if(thumbnail.isNull())
+	{
+		cv::Mat image = loadImage(path);
+		if(image.data != NULL)
+		{
+			thumbnail = Mat2QImage(buildThumbnail(image)).copy();
+			QDir().mkpath(THUMBNAIL_CACHE_DIR);
+			thumbnail.save(cached, "PNG");
+		}
+	}
+	if(!stopping)
+		emit loaded(path, thumbnail);
+}
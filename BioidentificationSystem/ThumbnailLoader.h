@@ -0,0 +1,39 @@
+#ifndef THUMBNAILLOADER_H
+#define THUMBNAILLOADER_H
+
+#include <QObject>
+#include <QImage>
+#include <QSet>
+#include <QList>
+#include <QFuture>
+
+#include "general.h"
+
+// Photo strip thumbnails, decoded and resized on the global thread pool.
+// Cached as PNG in THUMBNAIL_CACHE_DIR, keyed by photo path and modification time.
+class ThumbnailLoader : public QObject
+{
+	Q_OBJECT
+
+public:
+	ThumbnailLoader(QObject *parent = 0);
+	~ThumbnailLoader();
+
+	// Each path is loaded once until reset
+	void request(const QString& path);
+	void reset();
+
+signals:
+	// Queued to the receiver, null image if the photo can't be read
+	void loaded(QString path, QImage thumbnail);
+
+private:
+	void load(const QString& path);
+	static QString cacheName(const QString& path);
+
+	QSet<QString> requested;
+	QList<QFuture<void> > pending; // Finished ones are dropped on the next request
+	volatile bool stopping;
+};
+
+#endif // THUMBNAILLOADER_H
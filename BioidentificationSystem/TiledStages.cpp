@@ -0,0 +1,255 @@
+#include <time.h>
+#include <QFile>
+#include <QTextStream>
+#include <QThreadPool>
+
+#include "TiledStages.h"
+#include "SkinColorModel.h"
+#include "HandShape.h"
+#include "Recognizer.h"
+#include "Scheduler.h"
+#include "PixelKernels.h"
+
+static void classifyInto(const cv::Mat& frame, const uchar *skinTable, cv::Mat skin)
+{
+	CV_Assert(frame.depth() == CV_8U && (frame.channels() == 1 || frame.channels() == 3 || frame.channels() == 4));
+	switch(frame.channels())
+	{
+	case 1:
+		classifySkinRows<1>(frame, skinTable, skin, 0, frame.rows);
+		break;
+	case 4:
+		classifySkinRows<4>(frame, skinTable, skin, 0, frame.rows);
+		break;
+	default:
+		classifySkinRows<3>(frame, skinTable, skin, 0, frame.rows);
+	}
+}
+
+static void openSkin(cv::Mat& skin, int opening)
+{
+	if(opening > 0)
+		cv::morphologyEx(skin, skin, cv::MORPH_OPEN, cv::getStructuringElement(cv::MORPH_RECT, cv::Size(opening, opening)));
+}
+
+void fullFrameSkinAndEdges(const cv::Mat& frame, const cv::Mat& lut, int lowThreshold, int ratio, int aperture,
+	cv::Mat& skin, cv::Mat& edges, int opening)
+{
+	skin = SkinColorModel::classifyImage(frame, lut);
+	openSkin(skin, opening);
+	edges = handCannyEdges(frame, lowThreshold, ratio, aperture);
+}
+
+// Tiles of tiledSkinAndEdges, scratch is reused between the tiles of a chunk
+struct FusedTiles
+{
+	FusedTiles(const cv::Mat& frame, const uchar *skinTable, int lowThreshold, int ratio, int aperture, int opening,
+		int tileSize, cv::Mat& skin, cv::Mat& edges)
+		: frame(frame), skinTable(skinTable), lowThreshold(lowThreshold), ratio(ratio), aperture(aperture),
+		opening(opening), tileSize(tileSize), skin(skin), edges(edges) {}
+	void operator()(const cv::Range& tiles) const {
+		int tilesX = (frame.cols + tileSize - 1) / tileSize;
+		int halo = std::max(TILE_HALO, opening);
+		cv::Rect frameRect(0, 0, frame.cols, frame.rows);
+		cv::Mat gray, edgeTile, skinTile;
+		for(int t = tiles.start; t < tiles.end; t++)
+		{
+			cv::Rect core = cv::Rect((t % tilesX) * tileSize, (t / tilesX) * tileSize, tileSize, tileSize) & frameRect;
+			cv::Rect haloRect = cv::Rect(core.x - halo, core.y - halo, core.width + 2*halo, core.height + 2*halo) & frameRect;
+			cv::Rect inner(core.tl() - haloRect.tl(), core.size());
+			if(opening > 0) {
+				skinTile.create(haloRect.size(), CV_8UC1);
+				classifyInto(frame(haloRect), skinTable, skinTile);
+				openSkin(skinTile, opening);
+				skinTile(inner).copyTo(skin(core));
+			} else
+				classifyInto(frame(core), skinTable, skin(core));
+			toGray(frame(haloRect), gray);
+			cv::blur(gray, gray, cv::Size(3,3));
+			cv::Canny(gray, edgeTile, lowThreshold, lowThreshold*ratio, aperture);
+			edgeTile(inner).copyTo(edges(core));
+		}
+	}
+	const cv::Mat& frame;
+	const uchar *skinTable;
+	int lowThreshold, ratio, aperture, opening, tileSize;
+	cv::Mat& skin;
+	cv::Mat& edges;
+};
+
+void tiledSkinAndEdges(const cv::Mat& frame, const cv::Mat& lut, int lowThreshold, int ratio, int aperture,
+	cv::Mat& skin, cv::Mat& edges, int opening, int tileSize)
+{
+	skin.create(frame.size(), CV_8UC1);
+	edges.create(frame.size(), CV_8UC1);
+	int tiles = ((frame.cols + tileSize - 1) / tileSize) * ((frame.rows + tileSize - 1) / tileSize);
+	parallelFor(0, tiles, FusedTiles(frame, lut.ptr<uchar>(), lowThreshold, ratio, aperture, opening, tileSize, skin, edges), 1);
+}
+
+// Skin test set model if there is one, the table lookups cost the same either way
+static cv::Mat benchmarkLut()
+{
+	cv::Mat lut = cv::Mat::zeros(1, 1 << (3 * SKIN_LUT_BITS), CV_8UC1);
+	cv::Mat testImage, testMask;
+	if(loadSkinTest(testImage, testMask))
+	{
+		cv::Mat trained = trainSkinLut(binColors(maskedSkin(testImage, testMask)));
+		if(!trained.empty())
+			lut = trained;
+	}
+	return lut;
+}
+
+int benchmarkTiles(const QString& imageName, int iterations)
+{
+	cv::Mat frame = loadImage(imageName);
+	if(frame.data == NULL || frame.type() != CV_8UC3)
+		return -1;
+	iterations = std::max(1, iterations);
+	cv::Mat lut = benchmarkLut();
+
+	// Full frame Canny has no parallel version: both are compared on one thread,
+	// the tiled one is timed on the whole pool afterwards
+	int threads = schedulerThreads();
+	QThreadPool::globalInstance()->setMaxThreadCount(1);
+	cv::Mat fullSkin, fullEdges, tiledSkin, tiledEdges;
+	clock_t startTime = clock();
+	for(int k = 0; k < iterations; k++)
+		fullFrameSkinAndEdges(frame, lut, LOW_THRESHOLD, RATIO, APERTURE, fullSkin, fullEdges);
+	float fullMs = 1000.f * (clock() - startTime) / CLOCKS_PER_SEC / iterations;
+	startTime = clock();
+	for(int k = 0; k < iterations; k++)
+		tiledSkinAndEdges(frame, lut, LOW_THRESHOLD, RATIO, APERTURE, tiledSkin, tiledEdges);
+	float tiledMs = 1000.f * (clock() - startTime) / CLOCKS_PER_SEC / iterations;
+	QThreadPool::globalInstance()->setMaxThreadCount(threads);
+	startTime = clock();
+	for(int k = 0; k < iterations; k++)
+		tiledSkinAndEdges(frame, lut, LOW_THRESHOLD, RATIO, APERTURE, tiledSkin, tiledEdges);
+	float parallelMs = 1000.f * (clock() - startTime) / CLOCKS_PER_SEC / iterations;
+
+	cv::Mat difference;
+	cv::compare(fullSkin, tiledSkin, difference, cv::CMP_NE);
+	int skinMismatches = cv::countNonZero(difference);
+	cv::compare(fullEdges, tiledEdges, difference, cv::CMP_NE);
+	int edgeMismatches = cv::countNonZero(difference);
+
+	QFile reportFile(TILE_BENCH_REPORT);
+	if(reportFile.open(QFile::WriteOnly | QFile::Text))
+	{
+		QTextStream out(&reportFile);
+		out << imageName << " " << frame.cols << "x" << frame.rows << ", " << iterations << " iterations, "
+			<< "tile " << TILE_SIZE << " halo " << TILE_HALO << "\n";
+		out << "full frame, 1 thread: " << QString::number(fullMs, 'f', 2) << " ms\n";
+		out << "tiled, 1 thread: " << QString::number(tiledMs, 'f', 2) << " ms\n";
+		out << "tiled, " << threads << " threads: " << QString::number(parallelMs, 'f', 2) << " ms\n";
+		out << "skin mismatches: " << skinMismatches << ", edge mismatches: " << edgeMismatches
+			<< " of " << cv::countNonZero(fullEdges) << " edge pixels\n";
+	}
+	return edgeMismatches + skinMismatches;
+}
+
+int benchmarkGatedCanny(const QString& imageName, int iterations)
+{
+	cv::Mat frame = loadImage(imageName);
+	if(frame.data == NULL || frame.type() != CV_8UC3)
+		return -1;
+	iterations = std::max(1, iterations);
+	// Gates around the skin components, as for photos; the whole frame as one gate if there are none
+	cv::Mat skin = SkinColorModel::classifyImage(frame, benchmarkLut());
+	HandCandidates candidates;
+	candidateStage(skin, HandFilter(), candidates);
+	std::vector<cv::Rect> gates = cannyGates(candidates.boxes, CANNY_CONTOUR_MERGE_EPS, frame.size());
+	if(gates.empty())
+		gates.push_back(cv::Rect(frame.cols / 4, frame.rows / 4, frame.cols / 2, frame.rows / 2));
+
+	cv::Mat fullEdges, gatedEdges;
+	clock_t startTime = clock();
+	for(int k = 0; k < iterations; k++)
+		fullEdges = handCannyEdges(frame, LOW_THRESHOLD, RATIO, APERTURE);
+	float fullMs = 1000.f * (clock() - startTime) / CLOCKS_PER_SEC / iterations;
+	startTime = clock();
+	for(int k = 0; k < iterations; k++)
+		gatedEdges = gatedCannyEdges(frame, gates, LOW_THRESHOLD, RATIO, APERTURE);
+	float gatedMs = 1000.f * (clock() - startTime) / CLOCKS_PER_SEC / iterations;
+
+	cv::Mat gateMask = cv::Mat::zeros(frame.size(), CV_8UC1);
+	for(size_t k = 0; k < gates.size(); k++)
+		gateMask(gates[k]).setTo(cv::Scalar(255));
+	cv::Mat difference;
+	cv::compare(fullEdges, gatedEdges, difference, cv::CMP_NE);
+	difference &= gateMask;
+	int edgeMismatches = cv::countNonZero(difference);
+
+	QFile reportFile(GATED_BENCH_REPORT);
+	if(reportFile.open(QFile::WriteOnly | QFile::Text))
+	{
+		QTextStream out(&reportFile);
+		out << imageName << " " << frame.cols << "x" << frame.rows << ", " << iterations << " iterations, "
+			<< gates.size() << " gates over " << cv::countNonZero(gateMask) << " pixels\n";
+		out << "full frame: " << QString::number(fullMs, 'f', 2) << " ms\n";
+		out << "gated: " << QString::number(gatedMs, 'f', 2) << " ms\n";
+		out << "edge mismatches inside the gates: " << edgeMismatches << "\n";
+	}
+	return edgeMismatches;
+}
+
+int benchmarkBending(const QString& videoName, int frames)
+{
+	cv::VideoCapture capture(videoName.toStdString());
+	if(!capture.isOpened())
+		return -1;
+	cv::Mat lut = benchmarkLut();
+	std::vector<BentContour> previous;
+	int read = 0, contours = 0, incremental = 0, points = 0, pointMismatches = 0, contourMismatches = 0;
+	clock_t fullTicks = 0, incrementalTicks = 0;
+	cv::Mat frame;
+	while(read < frames && capture.read(frame))
+	{
+		read++;
+		HandCandidates candidates;
+		candidateStage(SkinColorModel::classifyImage(frame, lut), HandFilter(), candidates);
+		cv::Mat edges = handCannyEdges(frame, LOW_THRESHOLD, RATIO, APERTURE);
+		std::vector<BentContour> current;
+		for(size_t c = 0; c < candidates.size(); c++)
+		{
+			std::vector<cv::Point> contour = candidates.contour(c);
+			clock_t startTime = clock();
+			std::vector<cv::Point> full = bendContour(contour, edges, CANNY_CONTOUR_MERGE_EPS);
+			fullTicks += clock() - startTime;
+			contours++;
+			std::vector<cv::Point> merged = full;
+			const BentContour *bend = matchingBend(previous, contour);
+			if(bend != NULL)
+			{
+				startTime = clock();
+				merged = bendContourIncremental(contour, edges, CANNY_CONTOUR_MERGE_EPS, *bend);
+				incrementalTicks += clock() - startTime;
+				incremental++;
+				points += (int)contour.size();
+				int differing = 0;
+				for(size_t k = 0; k < full.size(); k++)
+					if(full[k] != merged[k])
+						differing++;
+				pointMismatches += differing;
+				if(differing > 0)
+					contourMismatches++;
+			}
+			current.push_back(bentContour(contour, merged));
+		}
+		previous.swap(current);
+	}
+
+	QFile reportFile(BENDING_BENCH_REPORT);
+	if(reportFile.open(QFile::WriteOnly | QFile::Text))
+	{
+		QTextStream out(&reportFile);
+		out << videoName << ", " << read << " frames, " << contours << " contours, "
+			<< incremental << " with a previous bending\n";
+		out << "full bending: " << QString::number(1000.f * fullTicks / CLOCKS_PER_SEC, 'f', 2) << " ms\n";
+		out << "incremental bending: " << QString::number(1000.f * incrementalTicks / CLOCKS_PER_SEC, 'f', 2)
+			<< " ms for the contours with a previous bending\n";
+		out << "differing contours: " << contourMismatches << ", differing points: " << pointMismatches
+			<< " of " << points << "\n";
+	}
+	return pointMismatches;
+}
@@ -0,0 +1,28 @@
+#ifndef TILEDSTAGES_H
+#define TILEDSTAGES_H
+
+#include "general.h"
+
+// Skin mask (LUT classification, optional opening) and Canny edges of a frame.
+// The full frame version runs each stage over the whole frame, the tiled one runs all of them
+// per TILE_SIZE tile with a TILE_HALO border, so intermediates stay in cache, and tiles
+// are the parallel work units. Hysteresis is tile local: an edge chain whose strong part
+// lies beyond the halo can differ at a tile seam.
+void fullFrameSkinAndEdges(const cv::Mat& frame, const cv::Mat& lut, int lowThreshold, int ratio, int aperture,
+	cv::Mat& skin, cv::Mat& edges, int opening = TILE_SKIN_OPENING);
+void tiledSkinAndEdges(const cv::Mat& frame, const cv::Mat& lut, int lowThreshold, int ratio, int aperture,
+	cv::Mat& skin, cv::Mat& edges, int opening = TILE_SKIN_OPENING, int tileSize = TILE_SIZE);
+
+// Times both on one thread and the tiled one on the whole pool, writes TILE_BENCH_REPORT.
+// Returns the mismatching pixels, -1 if the image can't be read.
+int benchmarkTiles(const QString& imageName, int iterations);
+// Times full frame and gated Canny (GATED_CANNY) around the image's skin components, writes
+// GATED_BENCH_REPORT. Returns the mismatching edge pixels inside the gates, -1 if the image can't be read.
+int benchmarkGatedCanny(const QString& imageName, int iterations);
+// Bends the skin components of up to frames video frames both fully and incrementally
+// (INCREMENTAL_BENDING), carrying the incremental result to the next frame as the pipeline does.
+// Writes times and differing points to BENDING_BENCH_REPORT. Returns the contour points where
+// the two differ, -1 if the video can't be opened.
+int benchmarkBending(const QString& videoName, int frames);
+
+#endif // TILEDSTAGES_H
@@ -0,0 +1,176 @@
+#include <algorithm>
+#include <cmath>
+
+#include "TrainingSet.h"
+#include "PixelKernels.h"
+#include "SkinColorModel.h"
+
+static const int STRATUM_BITS = 2;
+
+static bool heavierBin(const ColorBin& a, const ColorBin& b)
+{
+	return a.weight > b.weight;
+}
+
+static int stratumOf(const ColorBin& bin)
+{
+	const int shift = 8 - STRATUM_BITS;
+	return ((bin.b >> shift) << (2 * STRATUM_BITS)) | ((bin.g >> shift) << STRATUM_BITS) | (bin.r >> shift);
+}
+
+std::vector<ColorBin> binColors(const cv::Mat& skinColor)
+{
+	CV_Assert(skinColor.depth() == CV_8U && (skinColor.channels() == 1 || skinColor.channels() == 3 || skinColor.channels() == 4));
+	std::vector<cv::Vec4i> histogram(1 << (3 * TRAINING_BIN_BITS), cv::Vec4i(0, 0, 0, 0)); // Count, B, G, R sums
+	int used = 0;
+	switch(skinColor.channels())
+	{
+	case 1:
+		binColorSums<1>(skinColor, histogram, used);
+		break;
+	case 4:
+		binColorSums<4>(skinColor, histogram, used);
+		break;
+	default:
+		binColorSums<3>(skinColor, histogram, used);
+	}
+	std::vector<ColorBin> bins;
+	bins.reserve(used);
+	for(size_t k = 0; k < histogram.size(); k++)
+	{
+		const cv::Vec4i& bin = histogram[k];
+		if(bin[0] == 0)
+			continue;
+		bins.push_back(ColorBin((float)bin[0], bin[1] / bin[0], bin[2] / bin[0], bin[3] / bin[0]));
+	}
+	return bins;
+}
+
+static bool heavierEntry(const std::pair<double, size_t>& a, const std::pair<double, size_t>& b)
+{
+	return a.first > b.first;
+}
+
+// Splits budget between entries proportionally to weights, entry k gets at most caps[k].
+// Every entry with weight gets one first (heaviest first if budget is short), the rest goes
+// by largest remainder; what capped entries can't take is split again between the others.
+// The sum never exceeds budget.
+static std::vector<int> apportion(const std::vector<double>& weights, const std::vector<int>& caps, int budget)
+{
+	std::vector<int> counts(weights.size(), 0);
+	std::vector<std::pair<double, size_t> > order;
+	for(size_t k = 0; k < weights.size(); k++)
+		if(weights[k] > 0 && caps[k] > 0)
+			order.push_back(std::make_pair(weights[k], k));
+	std::sort(order.begin(), order.end(), heavierEntry);
+	for(size_t k = 0; k < order.size() && budget > 0; k++, budget--)
+		counts[order[k].second] = 1;
+
+	while(budget > 0)
+	{
+		double open = 0;
+		for(size_t k = 0; k < weights.size(); k++)
+			if(weights[k] > 0 && counts[k] < caps[k])
+				open += weights[k];
+		if(open == 0)
+			break;
+		std::vector<std::pair<double, size_t> > remainders;
+		int given = 0;
+		for(size_t k = 0; k < weights.size(); k++)
+		{
+			if(weights[k] <= 0 || counts[k] >= caps[k])
+				continue;
+			double share = budget * weights[k] / open;
+			int whole = std::min((int)share, caps[k] - counts[k]);
+			counts[k] += whole;
+			given += whole;
+			if(counts[k] < caps[k])
+				remainders.push_back(std::make_pair(share - (int)share, k));
+		}
+		budget -= given;
+		std::sort(remainders.begin(), remainders.end(), heavierEntry);
+		for(size_t k = 0; k < remainders.size() && budget > 0; k++, budget--)
+			counts[remainders[k].second]++;
+	}
+	return counts;
+}
+
+std::vector<Pixel> buildTrainingSet(const std::vector<ColorBin>& bins, int maxSamples)
+{
+	std::vector<Pixel> pixels;
+	double total = 0;
+	for(size_t k = 0; k < bins.size(); k++)
+		total += bins[k].weight;
+	// Never more samples than the skin sample had pixels
+	const int samples = std::min(maxSamples, (int)std::ceil(total));
+	if(bins.empty() || samples <= 0)
+		return pixels;
+
+	std::vector<ColorBin> chosen;
+	const int distinct = std::min(samples, TRAINING_BINS_MAX);
+	if((int)bins.size() <= distinct)
+		chosen = bins;
+	else
+	{
+		// Stratified subsampling: split bins by coarse cell, heaviest bins first inside a cell
+		std::vector<std::vector<ColorBin> > strata(1 << (3 * STRATUM_BITS));
+		std::vector<double> weights(strata.size(), 0);
+		for(size_t k = 0; k < bins.size(); k++)
+		{
+			int s = stratumOf(bins[k]);
+			strata[s].push_back(bins[k]);
+			weights[s] += bins[k].weight;
+		}
+		std::vector<int> sizes(strata.size());
+		for(size_t s = 0; s < strata.size(); s++)
+			sizes[s] = (int)strata[s].size();
+		std::vector<int> quotas = apportion(weights, sizes, distinct);
+		chosen.reserve(distinct);
+		for(size_t s = 0; s < strata.size(); s++)
+		{
+			if(quotas[s] == 0)
+				continue;
+			std::partial_sort(strata[s].begin(), strata[s].begin() + quotas[s], strata[s].end(), heavierBin);
+			chosen.insert(chosen.end(), strata[s].begin(), strata[s].begin() + quotas[s]);
+		}
+	}
+
+	// Pixel has no weight, so a bin's weight is kept as the number of its copies
+	std::vector<double> weights(chosen.size());
+	for(size_t k = 0; k < chosen.size(); k++)
+		weights[k] = chosen[k].weight;
+	std::vector<int> copies = apportion(weights, std::vector<int>(chosen.size(), samples), samples);
+	pixels.reserve(samples);
+	for(size_t k = 0; k < chosen.size(); k++)
+		pixels.insert(pixels.end(), copies[k], Pixel(chosen[k].r, chosen[k].g, chosen[k].b));
+	return pixels;
+}
+
+std::vector<Pixel> buildTrainingSet(const cv::Mat& skinColor, int maxSamples)
+{
+	return buildTrainingSet(binColors(skinColor), maxSamples);
+}
+
+bool loadSkinTest(cv::Mat& image, cv::Mat& mask)
+{
+	image = loadImage(SKIN_TEST_DIR + SKIN_TEST_IMAGE);
+	mask = loadImage(SKIN_TEST_DIR + SKIN_TEST_MASK);
+	if(image.data == NULL || mask.data == NULL || image.size() != mask.size())
+	{
+		image.release();
+		mask.release();
+		return false;
+	}
+	cv::cvtColor(mask, mask, cv::COLOR_BGR2GRAY);
+	return true;
+}
+
+double lutAccuracy(const cv::Mat& lut, const cv::Mat& image, const cv::Mat& mask)
+{
+	if(lut.empty() || image.empty() || mask.size() != image.size() || mask.type() != CV_8UC1)
+		return -1;
+	cv::Mat skin = SkinColorModel::classifyImage(image, lut);
+	cv::Mat wrong;
+	cv::compare(skin, mask > 0, wrong, cv::CMP_NE);
+	return 1.0 - (double)cv::countNonZero(wrong) / image.total();
+}
@@ -0,0 +1,43 @@
+#ifndef TRAININGSET_H
+#define TRAININGSET_H
+
+#include "general.h"
+#include "PixelClassifier.h"
+
+struct ColorBin
+{
+	ColorBin()
+		: weight(0), b(0), g(0), r(0) {}
+	ColorBin(float weight, int b, int g, int r)
+		: weight(weight), b(b), g(g), r(r) {}
+	float weight;
+	int b, g, r; // Mean colour of the bin
+};
+
+struct TrainingResult
+{
+	TrainingResult()
+		: faceId(-1), samples(0), time(0), accuracy(-1) {}
+	int faceId; // FaceTrack the model belongs to, -1 for photo processing
+	cv::Mat lut; // SkinColorModel::buildLut of the trained classifier, empty if training failed
+	int samples;
+	float time;
+	double accuracy; // Of the deployed lookup table on held-out SKIN_TEST_DIR set, -1 if there is none
+};
+
+// Skin sample -> weighted unique colours (histogram binning, TRAINING_BIN_BITS per channel)
+std::vector<ColorBin> binColors(const cv::Mat& skinColor);
+
+// At most maxSamples pixels. Up to TRAINING_BINS_MAX bins are kept, stratified by coarse colour
+// cell, every cell gets a share proportional to its weight and passes on what it can't use.
+// Each kept bin is repeated in proportion to its weight.
+std::vector<Pixel> buildTrainingSet(const std::vector<ColorBin>& bins, int maxSamples = TRAINING_SAMPLES_MAX);
+std::vector<Pixel> buildTrainingSet(const cv::Mat& skinColor, int maxSamples = TRAINING_SAMPLES_MAX);
+
+// Held-out SKIN_TEST_DIR image and its CV_8UC1 mask, false if they are missing or don't match
+bool loadSkinTest(cv::Mat& image, cv::Mat& mask);
+// Share of pixels the lookup table classifies as the mask says, mask: CV_8UC1, skin > 0.
+// Returns -1 on bad input.
+double lutAccuracy(const cv::Mat& lut, const cv::Mat& image, const cv::Mat& mask);
+
+#endif // TRAININGSET_H
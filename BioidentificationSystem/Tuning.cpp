@@ -0,0 +1,268 @@
+#include <time.h>
+#include <QDir>
+#include <QFile>
+#include <QTextStream>
+#include <QtConcurrentMap>
+
+#include "Tuning.h"
+#include "Components.h"
+#include "HandShape.h"
+#include "SkinColorModel.h"
+#include "TrainingSet.h"
+
+// Search space
+static const int TUNE_PARAM_S[] = { 50, 100, 150, 200 };
+static const int TUNE_LOW_THRESHOLD[] = { 20, 30, 40 };
+static const int TUNE_RATIO[] = { 2, 3 };
+static const int TUNE_MERGE_EPS[] = { 3, 5, 7 };
+static const int TUNE_HAND_THRESHOLD_MIN = 10;
+static const int TUNE_HAND_THRESHOLD_MAX = 50;
+static const int TUNE_HAND_THRESHOLD_STEP = 2;
+
+#define TUNE_COUNT(values) (int)(sizeof(values) / sizeof(values[0]))
+
+bool Tuner::load(const QString& dir, QStringList& report)
+{
+	images.clear();
+	if(!loadSequence(HANDS_COMPARE_DIR + ETALON_SEQ_NAME, etalon))
+	{
+		report << "Can't read " + HANDS_COMPARE_DIR + ETALON_SEQ_NAME;
+		return false;
+	}
+	QDir dataDir(dir);
+	QFile labels(dataDir.filePath(TUNING_LABELS));
+	if(!labels.open(QFile::ReadOnly | QFile::Text))
+	{
+		report << "Can't read " + labels.fileName();
+		return false;
+	}
+	QTextStream in(&labels);
+	while(!in.atEnd())
+	{
+		QStringList fields = in.readLine().split(' ', QString::SkipEmptyParts);
+		if(fields.isEmpty() || fields[0].startsWith('#'))
+			continue;
+		TuningImage image;
+		image.fileName = dataDir.filePath(fields[0]);
+		image.image = loadImage(image.fileName);
+		cv::Rect skinRect;
+		if(fields.size() == 6)
+			skinRect = cv::Rect(fields[2].toInt(), fields[3].toInt(), fields[4].toInt(), fields[5].toInt());
+		if(image.image.data == NULL || skinRect.area() == 0 ||
+			(skinRect & cv::Rect(0, 0, image.image.cols, image.image.rows)) != skinRect)
+		{
+			report << fields[0] + ": bad image or label";
+			continue;
+		}
+		image.skinPatch = image.image(skinRect).clone();
+		image.genuine = fields[1].toInt() != 0;
+		image.workDir = HANDS_COMPARE_DIR + TUNING_WORK_DIR + QString::number(images.size()) + "/";
+		// The tool reads the etalon next to each hand
+		QDir workDir(image.workDir);
+		workDir.mkpath(".");
+		workDir.remove(ETALON_SEQ_NAME);
+		if(!SEQ_COMPARE_IN_PROCESS && !QFile::copy(HANDS_COMPARE_DIR + ETALON_SEQ_NAME, workDir.filePath(ETALON_SEQ_NAME)))
+		{
+			report << "Can't copy " + HANDS_COMPARE_DIR + ETALON_SEQ_NAME + " to " + image.workDir;
+			return false;
+		}
+		image.etalon = &etalon;
+		image.params = NULL;
+		image.dissimilarity = DBL_MAX;
+		image.latency = 0;
+		images.push_back(image);
+	}
+	return !images.empty();
+}
+
+std::vector<TuningParams> Tuner::grid() const
+{
+	std::vector<TuningParams> configs;
+	TuningParams params;
+	for(int s = 0; s < TUNE_COUNT(TUNE_PARAM_S); s++)
+	for(int l = 0; l < TUNE_COUNT(TUNE_LOW_THRESHOLD); l++)
+	for(int r = 0; r < TUNE_COUNT(TUNE_RATIO); r++)
+	for(int e = 0; e < TUNE_COUNT(TUNE_MERGE_EPS); e++)
+	for(int t = TUNE_HAND_THRESHOLD_MIN; t <= TUNE_HAND_THRESHOLD_MAX; t += TUNE_HAND_THRESHOLD_STEP)
+	{
+		params.paramS = TUNE_PARAM_S[s];
+		params.lowThreshold = TUNE_LOW_THRESHOLD[l];
+		params.ratio = TUNE_RATIO[r];
+		params.cannyContourMergeEps = TUNE_MERGE_EPS[e];
+		params.handThreshold = t;
+		configs.push_back(params);
+	}
+	return configs;
+}
+
+std::vector<TuningParams> Tuner::random(int count, unsigned seed) const
+{
+	std::vector<TuningParams> configs;
+	cv::RNG rng(seed);
+	int thresholds = (TUNE_HAND_THRESHOLD_MAX - TUNE_HAND_THRESHOLD_MIN) / TUNE_HAND_THRESHOLD_STEP + 1;
+	for(int k = 0; k < count; k++)
+	{
+		TuningParams params;
+		params.paramS = TUNE_PARAM_S[rng.uniform(0, TUNE_COUNT(TUNE_PARAM_S))];
+		params.lowThreshold = TUNE_LOW_THRESHOLD[rng.uniform(0, TUNE_COUNT(TUNE_LOW_THRESHOLD))];
+		params.ratio = TUNE_RATIO[rng.uniform(0, TUNE_COUNT(TUNE_RATIO))];
+		params.cannyContourMergeEps = TUNE_MERGE_EPS[rng.uniform(0, TUNE_COUNT(TUNE_MERGE_EPS))];
+		params.handThreshold = TUNE_HAND_THRESHOLD_MIN + rng.uniform(0, thresholds) * TUNE_HAND_THRESHOLD_STEP;
+		configs.push_back(params);
+	}
+	return configs;
+}
+
+static QString cannyKey(const TuningParams& params)
+{
+	return QString("%1:%2").arg(params.lowThreshold).arg(params.ratio);
+}
+
+// Everything HAND_THRESHOLD is applied to
+static QString matchKey(const TuningParams& params)
+{
+	return QString("%1:%2:%3:%4").arg(params.paramS).arg(params.lowThreshold).arg(params.ratio).arg(params.cannyContourMergeEps);
+}
+
+// Photo processing pipeline for image.params, stages missing from the memo are computed
+void Tuner::evaluate(TuningImage& image)
+{
+	const TuningParams& params = *image.params;
+	QString key = matchKey(params);
+	if(!image.match.contains(key))
+	{
+		// TRAIN_PIXEL_CLASSIFIER + PIXEL_RECOGNITION
+		if(!image.skin.contains(params.paramS))
+		{
+			TuningStage stage;
+			clock_t startTime = clock();
+			std::vector<Pixel> pixels = buildTrainingSet(binColors(image.skinPatch));
+			PixelClassifier classifier;
+			if(classifier.train(pixels, params.paramS, 1, 0.001))
+				stage.output = SkinColorModel::classifyImage(image.image, SkinColorModel::buildLut(classifier));
+			stage.time = ((double)(clock()-startTime))/CLOCKS_PER_SEC;
+			image.skin.insert(params.paramS, stage);
+		}
+		// CANNY
+		QString edgesKey = cannyKey(params);
+		if(!image.canny.contains(edgesKey))
+		{
+			TuningStage stage;
+			clock_t startTime = clock();
+			stage.output = handCannyEdges(image.image, params.lowThreshold, params.ratio, APERTURE);
+			stage.time = ((double)(clock()-startTime))/CLOCKS_PER_SEC;
+			image.canny.insert(edgesKey, stage);
+		}
+		const TuningStage& skin = image.skin[params.paramS];
+		const TuningStage& canny = image.canny[edgesKey];
+
+		// BEND + HAND_RECOGNITION: best match of all candidates
+		TuningStage stage;
+		clock_t startTime = clock();
+		if(!skin.output.empty())
+		{
+			cv::Mat labels;
+			std::vector<ComponentStats> components;
+			labelComponents(skin.output, labels, components);
+			SequenceComparator comparator;
+			for(size_t k = 0; k < components.size(); k++)
+			{
+				if(components[k].bbox.width <= MIN_WH || components[k].bbox.height <= MIN_WH)
+					continue;
+				std::vector<cv::Point> contour = componentContour(labels, (int)k + 1, components[k].bbox);
+				contour = bendContour(contour, canny.output, params.cannyContourMergeEps);
+				try {
+					ShapeSequence hand = encodeHand(handApplicant(contour, image.image.size()), image.workDir);
+					double dissimilarity = SEQ_COMPARE_IN_PROCESS ? comparator.compare(*image.etalon, hand, stage.dissimilarity) :
+						stringCompare(image.workDir);
+					stage.dissimilarity = std::min(stage.dissimilarity, dissimilarity);
+				} catch(std::exception&) {
+					continue;
+				}
+			}
+		}
+		stage.time = ((double)(clock()-startTime))/CLOCKS_PER_SEC + skin.time + canny.time;
+		image.match.insert(key, stage);
+	}
+	const TuningStage& match = image.match[key];
+	image.dissimilarity = match.dissimilarity;
+	image.latency = match.time;
+}
+
+static bool byAccuracy(const TuningResult& a, const TuningResult& b)
+{
+	if(a.accuracy != b.accuracy)
+		return a.accuracy > b.accuracy;
+	return a.latency < b.latency;
+}
+
+std::vector<TuningResult> Tuner::run(const std::vector<TuningParams>& configs)
+{
+	std::vector<TuningResult> results;
+	for(size_t c = 0; c < configs.size(); c++)
+	{
+		for(size_t k = 0; k < images.size(); k++)
+			images[k].params = &configs[c];
+		QtConcurrent::blockingMap(images, &Tuner::evaluate);
+		TuningResult result;
+		result.params = configs[c];
+		int correct = 0;
+		for(size_t k = 0; k < images.size(); k++)
+		{
+			bool accepted = images[k].dissimilarity <= configs[c].handThreshold / 100.0;
+			if(accepted == images[k].genuine)
+				correct++;
+			result.latency += images[k].latency;
+		}
+		result.accuracy = (double)correct / images.size();
+		result.latency /= images.size();
+		results.push_back(result);
+	}
+	QDir(HANDS_COMPARE_DIR).rmdir(TUNING_WORK_DIR);
+
+	// Sorted by accuracy, a result is on the front if it's faster than everything before it
+	std::sort(results.begin(), results.end(), byAccuracy);
+	double fastest = DBL_MAX;
+	for(size_t k = 0; k < results.size(); k++)
+		if(results[k].latency < fastest)
+		{
+			results[k].pareto = true;
+			fastest = results[k].latency;
+		}
+	return results;
+}
+
+int tune(const QString& dir, int randomCount, unsigned seed)
+{
+	QStringList report;
+	Tuner tuner;
+	int status = 1;
+	if(tuner.load(dir, report))
+	{
+		std::vector<TuningParams> configs = (randomCount > 0) ? tuner.random(randomCount, seed) : tuner.grid();
+		std::vector<TuningResult> results = tuner.run(configs);
+		if(randomCount > 0)
+			report << QString("%1 random configurations, seed %2").arg(randomCount).arg(seed);
+		report << QString("Hands compared by %1").arg(SEQ_COMPARE_IN_PROCESS ? "in-process comparator" : "StringCompare.exe");
+		report << "Pareto front (accuracy, latency s, S, low threshold, ratio, merge eps, hand threshold):";
+		for(size_t pass = 0; pass < 2; pass++)
+		{
+			if(pass == 1)
+				report << "" << "All configurations:";
+			foreach(const TuningResult& result, results)
+				if(pass == 1 || result.pareto)
+					report << QString("%1 %2 %3 %4 %5 %6 %7").arg(result.accuracy, 0, 'f', 3).arg(result.latency, 0, 'f', 4)
+						.arg(result.params.paramS).arg(result.params.lowThreshold).arg(result.params.ratio)
+						.arg(result.params.cannyContourMergeEps).arg(result.params.handThreshold);
+		}
+		status = 0;
+	}
+	QFile reportFile(TUNING_REPORT);
+	if(reportFile.open(QFile::WriteOnly | QFile::Text))
+	{
+		QTextStream out(&reportFile);
+		foreach(const QString& line, report)
+			out << line << "\n";
+	}
+	return status;
+}
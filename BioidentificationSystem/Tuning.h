@@ -0,0 +1,83 @@
+#ifndef TUNING_H
+#define TUNING_H
+
+#include <QHash>
+
+#include "general.h"
+#include "SequenceCompare.h"
+
+// Slider parameters of the photo processing pipeline
+struct TuningParams
+{
+	TuningParams()
+		: paramS(KERNEL_PARAM_S), lowThreshold(LOW_THRESHOLD), ratio(RATIO),
+		cannyContourMergeEps(CANNY_CONTOUR_MERGE_EPS), handThreshold(HAND_THRESHOLD) {}
+	int paramS;
+	int lowThreshold;
+	int ratio;
+	int cannyContourMergeEps;
+	int handThreshold; // Percent, as the slider
+};
+
+struct TuningResult
+{
+	TuningResult()
+		: accuracy(0), latency(0), pareto(false) {}
+	TuningParams params;
+	double accuracy; // Share of images whose genuine/impostor label is matched
+	double latency; // Mean uncached pipeline time per image, s
+	bool pareto; // Not dominated in accuracy and latency
+};
+
+// Stage output with the time it took to compute
+struct TuningStage
+{
+	TuningStage()
+		: time(0), dissimilarity(DBL_MAX) {}
+	cv::Mat output;
+	double time;
+	double dissimilarity;
+};
+
+// Labelled image of the tuning set, with its stage outputs memoized by the parameters they depend on:
+// skin mask by S, Canny by thresholds, dissimilarity by everything up to bending.
+struct TuningImage
+{
+	QString fileName;
+	cv::Mat image;
+	cv::Mat skinPatch; // Skin sample, as drawn for photo processing
+	bool genuine; // Shows the enrolled (etalon) hand
+	QString workDir;
+	const ShapeSequence *etalon;
+	const TuningParams *params;
+	QHash<int, TuningStage> skin;
+	QHash<QString, TuningStage> canny;
+	QHash<QString, TuningStage> match;
+	double dissimilarity; // For *params
+	double latency;
+};
+
+// Grid or random search over the pipeline parameters on a labelled image set.
+// <dir>/TUNING_LABELS: "<image> <genuine 0|1> <x> <y> <width> <height>" per line, the rect is the skin sample.
+// Images are processed in parallel, HAND_THRESHOLD is applied to the memoized dissimilarities.
+// Hands are compared the way production does: StringCompare.exe unless SEQ_COMPARE_IN_PROCESS.
+class Tuner
+{
+public:
+	bool load(const QString& dir, QStringList& report);
+	std::vector<TuningParams> grid() const;
+	std::vector<TuningParams> random(int count, unsigned seed) const;
+	// Results with the accuracy/latency Pareto front marked
+	std::vector<TuningResult> run(const std::vector<TuningParams>& configs);
+
+private:
+	static void evaluate(TuningImage& image);
+
+	std::vector<TuningImage> images;
+	ShapeSequence etalon;
+};
+
+// --tune <dir> [random count [seed]]: writes TUNING_REPORT, 0 on success
+int tune(const QString& dir, int randomCount, unsigned seed = TUNING_SEED);
+
+#endif // TUNING_H
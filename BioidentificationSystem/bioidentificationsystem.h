@@ -6,12 +6,17 @@
 #include <QDir>
 #include <QMessageBox>
 #include <QFileDialog>
+#include <QInputDialog>
 #include <QList>
+#include <QSet>
+#include <QScrollBar>
+#include <QTimer>
 
 #include "ui_bioidentificationsystem.h"
 #include "Settings.h"
 #include "ImageProcessor.h"
 #include "PhotoLabel.h"
+#include "ThumbnailLoader.h"
 
 class BioidentificationSystem : public QMainWindow
 {
@@ -22,9 +27,12 @@ public:
 		: QMainWindow(parent, flags) {
 			ui.setupUi(this);
 			imageProcessor = new ImageProcessor();
+			thumbnailLoader = new ThumbnailLoader(this);
+			imageWriter = new ImageWriter(this);
 			initPhotoLabel();
 			loadThumbnails();
 			setIcons();
+			initStatusBar();
 			startWorkerThread();
 			initConnections();
 	}
@@ -36,6 +44,55 @@ public:
 	}
 
 private slots:
+	// Signals: thumbnailLoader::loaded
+	void thumbnailLoaded(QString path, QImage thumbnail) {
+		if(!iconsToLoad.remove(path) || thumbnail.isNull())
+			return;
+		QListWidgetItem *item = photoItem(path);
+		if(item != NULL)
+			item->setIcon(QIcon(QPixmap::fromImage(thumbnail)));
+	}
+	// Signals: ui.photoWidget scroll bars
+	void requestVisibleThumbnails() {
+		QRect viewport = ui.photoWidget->viewport()->rect();
+		for(int k = 0; k < ui.photoWidget->count(); k++) {
+			QListWidgetItem *item = ui.photoWidget->item(k);
+			QString path = item->data(Qt::UserRole).toString() + item->text();
+			if(iconsToLoad.contains(path) && ui.photoWidget->visualItemRect(item).intersects(viewport))
+				thumbnailLoader->request(path);
+		}
+	}
+	void attachFrameRing() {
+		QString name = QInputDialog::getText(this, "Shared frames", "Frame ring name:", QLineEdit::Normal, FRAME_RING_NAME);
+		if(name.isEmpty())
+			return;
+		QMetaObject::invokeMethod(imageProcessor,
+			"attachFrameRing",
+			Qt::QueuedConnection,
+			Q_ARG(QString, name));
+	}
+	// Camera button also ends shared frames: the worker may be blocked waiting for the next one
+	void wakeFrameRing() {
+		imageProcessor->wakeFrameRing();
+	}
+	void replaySession() {
+		QString fileName = QFileDialog::getOpenFileName(this, "Replay session", SESSION_PATH, "Sessions (*" + SESSION_EXTENSION + ")");
+		if(fileName.isNull())
+			return;
+		QMetaObject::invokeMethod(imageProcessor,
+			"replaySession",
+			Qt::QueuedConnection,
+			Q_ARG(QString, fileName));
+	}
+	void enrollDirectory() {
+		QString dir = QFileDialog::getExistingDirectory(this, "Enroll hand photos");
+		if(dir.isNull())
+			return;
+		QMetaObject::invokeMethod(imageProcessor,
+			"enrollDirectory",
+			Qt::QueuedConnection,
+			Q_ARG(QString, dir));
+	}
 	// Signals: imageProcessor::opened, 
 	void cameraOpened() {
 		/* ToolBar panel */
@@ -122,8 +179,9 @@ private slots:
 		case ImageProcessor::PIXEL_RECOGNITION:
 			{
 				cv::Mat colorizedFrame = imageProcessor->getColorizedFrame();
-				cv::Rect faceRect = imageProcessor->getFaceRect();
-				cv::rectangle(colorizedFrame, faceRect, cv::Scalar(255, 0, 0));
+				std::vector<cv::Rect> faceRects = imageProcessor->getFaceRects();
+				foreach(const cv::Rect& faceRect, faceRects)
+					cv::rectangle(colorizedFrame, faceRect, cv::Scalar(255, 0, 0));
 				ui.labelSkin->setPixmap(QPixmap::fromImage(Mat2QImage(colorizedFrame)));
 			}
 			break;
@@ -162,13 +220,14 @@ private slots:
 		else
 			frame = imageProcessor->getBended();
 
-		QString name = saveImage(frame);
-		if(name.isNull())
-		{
-			displayError("Can't save image.", QMessageBox::Critical);
+		if(frame.data == NULL)
 			return;
-		}
-		showThumbnail(Mat2QImage(buildThumbnail(frame)), name);
+		QImage thumbnail = Mat2QImage(buildThumbnail(frame));
+		showThumbnail(thumbnail, imageWriter->enqueue(frame));
+	}
+	// Signals: imageWriter::failed
+	void photoFailed(QString fileName) {
+		displayError("Can't save " + fileName + ".", QMessageBox::Critical);
 	}
 	// Signals: photoLabel::error, imageProcessor::error
 	void displayError(QString err, QMessageBox::Icon level) {
@@ -240,15 +299,38 @@ private:
 	QAction *takePhoto;
 	QAction *showSettings;
 	QAction *reTrain;
+	QAction *enroll;
+	QAction *record;
+	QAction *replay;
+	QAction *attach;
+
+	/* QStatusBar */
+	QLabel *trainingStateLabel;
 
 	ImageProcessor *imageProcessor;
 	QThread *workerThread;
 
+	/* Photo strip */
+	ThumbnailLoader *thumbnailLoader;
+	ImageWriter *imageWriter;
+	QSet<QString> iconsToLoad; // Photo paths, items are looked up when the icon comes
+
+	// Item of the photo strip showing path, NULL if it's gone
+	QListWidgetItem* photoItem(const QString& path) {
+		for(int k = 0; k < ui.photoWidget->count(); k++) {
+			QListWidgetItem *item = ui.photoWidget->item(k);
+			if(item->data(Qt::UserRole).toString() + item->text() == path)
+				return item;
+		}
+		return NULL;
+	}
+
 	QListWidgetItem* showThumbnail(const QImage &thumbnail, const QString& path) {
 		QListWidgetItem *item = new QListWidgetItem();
 		QString name = getImageName(path);
 		QString imgPath = getImagePath(path);
-		item->setIcon(QIcon(QPixmap::fromImage(thumbnail)));
+		if(!thumbnail.isNull())
+			item->setIcon(QIcon(QPixmap::fromImage(thumbnail)));
 		item->setText(name);
 		item->setData(Qt::UserRole, QVariant(imgPath));
 		ui.photoWidget->insertItem(0, item);
@@ -269,7 +351,7 @@ private:
 	}
 
 	void initPhotoLabel() {
-		mainImageLabel = new PhotoLabel(imageProcessor, ui.tabPhoto);
+		mainImageLabel = new PhotoLabel(imageProcessor, imageWriter, ui.tabPhoto);
 		mainImageLabel->setObjectName(QString::fromUtf8("mainImageLabel"));
 		mainImageLabel->setFrameShape(QFrame::Box);
 		mainImageLabel->setFrameShadow(QFrame::Sunken);
@@ -277,19 +359,21 @@ private:
 		ui.gridLayout_2->addWidget(mainImageLabel, 1, 1, 1, 1);
 	}
 
+	// Items only, icons are loaded in background as they scroll into view
 	void loadThumbnails()
 	{
 		ui.photoWidget->clear();
+		iconsToLoad.clear();
+		thumbnailLoader->reset();
 		QDir dir(PHOTO_PATH);
 		QStringList photos = dir.entryList(IMAGE_FORMAT, QDir::Files | QDir::Readable, QDir::Name);
 		QString photo;
-		foreach(photo, photos)
-		{
-			cv::Mat thumbnail = loadImage(PHOTO_PATH + photo);
-			if(thumbnail.data == NULL)
-				continue;
-			showThumbnail(Mat2QImage(thumbnail), PHOTO_PATH + photo);
+		foreach(photo, photos) {
+			showThumbnail(QImage(), PHOTO_PATH + photo);
+			iconsToLoad.insert(PHOTO_PATH + photo);
 		}
+		// After the layout is done
+		QTimer::singleShot(0, this, SLOT(requestVisibleThumbnails()));
 	}
 
 	void setIcons() {
@@ -303,9 +387,23 @@ private:
 		takePhoto->setEnabled(false);
 		ui.mainToolBar->addSeparator();
 		reTrain = ui.mainToolBar->addAction(QIcon(":/icons/ico/retrain_24x24.ico"), "Retrain");
+		record = ui.mainToolBar->addAction("Record");
+		record->setCheckable(true);
+		record->setToolTip("Record frames and parameter changes of the running pipeline");
+		replay = ui.mainToolBar->addAction("Replay");
+		replay->setToolTip("Replay a recorded session through the pipeline");
+		attach = ui.mainToolBar->addAction("Attach");
+		attach->setToolTip("Process frames a local producer publishes in shared memory");
+		enroll = ui.mainToolBar->addAction("Enroll");
+		enroll->setToolTip("Enroll a directory of hand photos into the gallery");
 		showSettings = ui.mainToolBar->addAction(QIcon(":/icons/ico/settings_24x24.ico"), "Settings");
 	}
 
+	void initStatusBar() {
+		trainingStateLabel = new QLabel(ui.statusBar);
+		ui.statusBar->addPermanentWidget(trainingStateLabel);
+	}
+
 	void startWorkerThread() {
 		workerThread = new QThread();
 		workerThread->setObjectName("WORKER");
@@ -322,8 +420,19 @@ private:
 		connect(imageProcessor, SIGNAL(photoModeChanged()), this, SLOT(clearLabels()));
 		connect(takePhoto, SIGNAL(triggered()), imageProcessor, SLOT(takePhoto()));
 		connect(reTrain, SIGNAL(triggered()), imageProcessor, SLOT(setPixelClassifierTrained()));
+		connect(record, SIGNAL(toggled(bool)), imageProcessor, SLOT(setRecording(bool)));
+		connect(replay, SIGNAL(triggered()), this, SLOT(replaySession()));
+		connect(attach, SIGNAL(triggered()), this, SLOT(attachFrameRing()));
+		connect(changeCameraState, SIGNAL(toggled(bool)), this, SLOT(wakeFrameRing()));
+		connect(enroll, SIGNAL(triggered()), this, SLOT(enrollDirectory()));
 		connect(showSettings, SIGNAL(triggered()), &settingsForm, SLOT(open()));
 		connect(ui.photoWidget, SIGNAL(itemDoubleClicked(QListWidgetItem*)), this, SLOT(showPhoto(QListWidgetItem*)));
+		connect(ui.photoWidget->verticalScrollBar(), SIGNAL(valueChanged(int)), this, SLOT(requestVisibleThumbnails()));
+		connect(ui.photoWidget->verticalScrollBar(), SIGNAL(rangeChanged(int, int)), this, SLOT(requestVisibleThumbnails()));
+		connect(ui.photoWidget->horizontalScrollBar(), SIGNAL(valueChanged(int)), this, SLOT(requestVisibleThumbnails()));
+		connect(ui.photoWidget->horizontalScrollBar(), SIGNAL(rangeChanged(int, int)), this, SLOT(requestVisibleThumbnails()));
+		connect(thumbnailLoader, SIGNAL(loaded(QString, QImage)), this, SLOT(thumbnailLoaded(QString, QImage)));
+		connect(imageWriter, SIGNAL(failed(QString)), this, SLOT(photoFailed(QString)));
 
 		connect(ui.toolButtonDrawRect, SIGNAL(toggled(bool)), mainImageLabel, SLOT(setDrawRectMode(bool)));
 		connect(ui.toolButtonDrawRect, SIGNAL(toggled(bool)), this, SLOT(uncheckDraw(bool)));
@@ -382,6 +491,7 @@ private:
 
 		connect(imageProcessor, SIGNAL(stateCompleted(ImageProcessor::States)), this, SLOT(displayVideoFrame(ImageProcessor::States)));
 		connect(imageProcessor, SIGNAL(postMessage(QString)), ui.statusBar, SLOT(showMessage(QString)));
+		connect(imageProcessor, SIGNAL(trainingStateChanged(QString)), trainingStateLabel, SLOT(setText(QString)));
 		connect(imageProcessor, SIGNAL(error(QString, QMessageBox::Icon)), this, SLOT(displayError(QString, QMessageBox::Icon)));
 	}
 };
@@ -1,62 +1,19 @@
 #include <QVector>
 #include <QRgb>
 #include <QDir>
+#include <QFileInfo>
 #include <QTime>
+#include <QMutex>
 
 #include <windows.h>
 #include <time.h>
-#include <gdiplus.h>
-using namespace Gdiplus;
 
 #include "general.h"
+#include "SequenceCompare.h"
+#include "PixelKernels.h"
+#include "BitMask.h"
 FILE *logFile;
 
-int GetEncoderClsid(const WCHAR* format, CLSID* pClsid) {
-	UINT  num = 0;          // number of image encoders
-	UINT  size = 0;         // size of the image encoder array in bytes
-
-	ImageCodecInfo* pImageCodecInfo = NULL;
-
-	GetImageEncodersSize(&num, &size);
-	if(size == 0)
-		return -1;  // Failure
-
-	pImageCodecInfo = (ImageCodecInfo*)(malloc(size));
-	if(pImageCodecInfo == NULL)
-		return -1;  // Failure
-
-	GetImageEncoders(num, size, pImageCodecInfo);
-
-	for(UINT j = 0; j < num; ++j)
-	{
-		if( wcscmp(pImageCodecInfo[j].MimeType, format) == 0 )
-		{
-			*pClsid = pImageCodecInfo[j].Clsid;
-			free(pImageCodecInfo);
-			return j;  // Success
-		}
-	}
-	free(pImageCodecInfo);
-	return -1;  // Failure
-}
-
-void saveBMP(QImage& img, QString path = "hand.bmp") {
-	GdiplusStartupInput gdiplusStartupInput;
-	ULONG_PTR gdiplusToken;
-	GdiplusStartup(&gdiplusToken, &gdiplusStartupInput, NULL);
-
-	Bitmap *image = new Bitmap(img.width(), img.height(), img.bytesPerLine(), PixelFormat1bppIndexed, (BYTE*)img.bits());
-
-	CLSID myClsId;
-	int retVal = GetEncoderClsid(L"image/bmp", &myClsId);
-
-	Status s = image->Save(path.toStdWString().c_str(), &myClsId, NULL);
-	
-	delete image;
-
-	GdiplusShutdown(gdiplusToken);
-}
-
 QImage Mat2QImage(const cv::Mat &frame)
 {
 	// 8-bits unsigned, NO. OF CHANNELS=1
@@ -82,6 +39,12 @@ QImage Mat2QImage(const cv::Mat &frame)
 		QImage img(qImageBuffer, frame.cols, frame.rows, frame.step, QImage::Format_RGB888);
 		return img.rgbSwapped();
 	}
+	// 8-bits unsigned, NO. OF CHANNELS=4, BGRA is RGB32 memory order, copied as the 3 channel one
+	if(frame.type()==CV_8UC4)
+	{
+		const uchar *qImageBuffer = (const uchar*)frame.data;
+		return QImage(qImageBuffer, frame.cols, frame.rows, frame.step, QImage::Format_RGB32).copy();
+	}
 	else
 	{
 		qDebug() << "ERROR: Mat could not be converted to QImage.";
@@ -116,17 +79,53 @@ cv::Mat QImage2Mat(const QImage& image)
 	}
 }
 
+// Timestamped names handed out in the same millisecond get a counter suffix
+static QMutex stampMutex;
+static qint64 lastStamp = 0;
+static int stampCounter = 0;
+
+QString imageFileName(const QString& name, const QString& dir)
+{
+	if(name.isEmpty())
+	{
+		QMutexLocker locker(&stampMutex);
+		qint64 stamp = QDateTime::currentMSecsSinceEpoch();
+		// Queued photos aren't on disk yet, so the counter is what keeps them apart
+		stampCounter = (stamp == lastStamp) ? stampCounter + 1 : 0;
+		lastStamp = stamp;
+		forever
+		{
+			QString fileName = dir + QString::number(stamp);
+			if(stampCounter > 0)
+				fileName += "_" + QString::number(stampCounter);
+			fileName += "." + PHOTO_FORMAT;
+			// Written before, e.g. by another run within this millisecond
+			if(!QFile::exists(fileName))
+				return fileName;
+			stampCounter++;
+		}
+	}
+	if(QFileInfo(name).suffix().isEmpty())
+		return dir + name + "." + PHOTO_FORMAT;
+	return dir + name;
+}
+
 QString saveImage(const cv::Mat& image, const QString& name, const QString& dir)
 {
 	QDir dirObj;
 	if(!dirObj.exists(dir) && !dirObj.mkdir(dir))
 		return QString();
-	QString fname = dir;
-	if(name.isEmpty())
-		fname += QString::number(QDateTime::currentMSecsSinceEpoch()) + ".bmp";
-	else
-		fname += name;
-	if(!cv::imwrite((fname).toStdString(), image))
+	QString fname = imageFileName(name, dir);
+	QString suffix = QFileInfo(fname).suffix().toLower();
+	std::vector<int> params;
+	if(suffix == "png") {
+		params.push_back(CV_IMWRITE_PNG_COMPRESSION);
+		params.push_back(PHOTO_PNG_COMPRESSION);
+	} else if(suffix == "jpg" || suffix == "jpeg") {
+		params.push_back(CV_IMWRITE_JPEG_QUALITY);
+		params.push_back(PHOTO_JPEG_QUALITY);
+	}
+	if(!cv::imwrite((fname).toStdString(), image, params))
 		return QString();
 	return fname;
 }
@@ -145,6 +144,22 @@ cv::Mat buildThumbnail(const cv::Mat& image)
 	return thumbnail;
 }
 
+void toGray(const cv::Mat& image, cv::Mat& gray)
+{
+	CV_Assert(image.depth() == CV_8U && (image.channels() == 1 || image.channels() == 3 || image.channels() == 4));
+	switch(image.channels())
+	{
+	case 1:
+		image.copyTo(gray);
+		break;
+	case 4:
+		cv::cvtColor(image, gray, cv::COLOR_BGRA2GRAY);
+		break;
+	default:
+		cv::cvtColor(image, gray, cv::COLOR_BGR2GRAY);
+	}
+}
+
 QString getImageName(const QString& path)
 {
 	QStringList pathList = path.split('/', QString::SkipEmptyParts);
@@ -159,74 +174,124 @@ QString getImagePath(const QString& path)
 	return pathList.join("/") + "/";
 }
 
-QString handRecCommands(const cv::Mat &candidate)
+// Absolute path of a tool in HANDS_COMPARE_DIR, so it runs from any working dir
+static QString toolPath(const QString& tool)
 {
-	QImage img = Mat2QImage(candidate);
-	img = img.convertToFormat(QImage::Format_Mono, Qt::MonoOnly);
-
-	QDir dir;
-	if(!dir.exists(HANDS_COMPARE_DIR) || !dir.setCurrent(HANDS_COMPARE_DIR))
-		throw std::exception((QString("Dir ") + HANDS_COMPARE_DIR + " doesn't exist or can't be changed.").toAscii().data());
+	return "\"" + QDir::toNativeSeparators(QDir(HANDS_COMPARE_DIR).absoluteFilePath(tool)) + "\"";
+}
 
-	/*if(saveImage(img, HANDS_BMP_NAME, "./").isEmpty())
-		throw std::exception((QString("Saving ") + HANDS_BMP_NAME + " error.").toAscii().data());*/
-	saveBMP(img);
-	QStringList delEntries = dir.entryList(QStringList() << SEQ_FILTER);
-	foreach(const QString& entry, delEntries)
-		dir.remove(entry);
+// Writes candidate as hand.bmp and encodes it to hand.seq in workDir
+static void bmpToSeq(const BitMask& candidate, const QDir& workDir)
+{
+	if(!workDir.exists())
+		throw std::exception((QString("Dir ") + workDir.path() + " doesn't exist.").toAscii().data());
+	if(!candidate.saveBmp(workDir.absoluteFilePath(HANDS_BMP_NAME)))
+		throw std::exception((QString("Saving ") + HANDS_BMP_NAME + " error.").toAscii().data());
+	QDir(workDir).remove(HAND_SEQ_NAME);
 
-	clock_t handRecStartTime = clock();
-	STARTUPINFOW si;
-	PROCESS_INFORMATION pi;
 	// Command 1
-	ZeroMemory(&si, sizeof(si));
-	si.cb = sizeof(si);
-	ZeroMemory(&pi, sizeof(pi));
-	if(CreateProcessW(L"C:\\windows\\system32\\cmd.exe", const_cast<LPWSTR>((QString("/C BmpToSeq.exe ") + QString::number(REGULARIZATION) + " " + QString::number(APPROXIMATION) + " " + QString::number(MERGING) + " " + QString::number(LEGANDRES) + " " + HANDS_BMP_NAME + " hand.seq").toStdWString().data()), NULL, NULL, FALSE, CREATE_NO_WINDOW, NULL, NULL, &si, &pi))
-	{
-		WaitForSingleObject(pi.hProcess, INFINITE);
-		CloseHandle(pi.hProcess);
-		CloseHandle(pi.hThread);
-	} else
+	if(!runTool(toolPath("BmpToSeq.exe") + " " + QString::number(REGULARIZATION) + " " + QString::number(APPROXIMATION) + " " + QString::number(MERGING) + " " + QString::number(LEGANDRES) + " " + HANDS_BMP_NAME + " " + HAND_SEQ_NAME, workDir.absolutePath()))
 		throw std::exception((QString("BmpToSeq.exe ") + HANDS_BMP_NAME + " failed.").toAscii().data());
+}
 
-	// Command 3
-	ZeroMemory(&si, sizeof(si));
-	si.cb = sizeof(si);
-	ZeroMemory(&pi, sizeof(pi));
-	if(CreateProcessW(L"C:\\windows\\system32\\cmd.exe", const_cast<LPWSTR>((QString("/C StringCompare.exe etalon.seq hand.seq ") + QString::number(MULCT)).toStdWString().data()), NULL, NULL, FALSE, CREATE_NO_WINDOW, NULL, NULL, &si, &pi))
-	{
-		WaitForSingleObject(pi.hProcess, INFINITE);
-		CloseHandle(pi.hProcess);
-		CloseHandle(pi.hThread);
-	} else
+ShapeSequence encodeHand(const cv::Mat &candidate, const QString& workDir)
+{
+	return encodeHand(BitMask(candidate), workDir);
+}
+
+ShapeSequence encodeHand(const BitMask &candidate, const QString& workDir)
+{
+	QDir dir(workDir);
+	bmpToSeq(candidate, dir);
+	ShapeSequence hand;
+	if(!loadSequence(dir.filePath(HAND_SEQ_NAME), hand))
+		throw std::exception((QString("Reading ") + HAND_SEQ_NAME + " failed.").toAscii().data());
+	return hand;
+}
+
+// StringCompare.exe on etalon.seq and hand.seq in dir, its DissimilarityMeasure.txt
+static QString runStringCompare(const QDir& dir)
+{
+	QDir(dir).remove(DISSIMILARITY_MEASURE);
+	if(!runTool(toolPath("StringCompare.exe") + " " + ETALON_SEQ_NAME + " " + HAND_SEQ_NAME + " " + QString::number(MULCT), dir.absolutePath()))
 		throw std::exception("StringCompare.exe error.");
-	if(DEBUG) {
-		writeTime("HAND_REC_COMMANDS", ((float)(clock()-handRecStartTime))/CLOCKS_PER_SEC);
-	}
 
 	// Read result
-	QFile resultFile(DISSIMILARITY_MEASURE);
+	QFile resultFile(dir.filePath(DISSIMILARITY_MEASURE));
 	if(!resultFile.open(QFile::ReadOnly | QFile::Text))
 		throw std::exception((QString("Open file ") + DISSIMILARITY_MEASURE + " failed.").toAscii().data());
 	QByteArray byteArray = resultFile.readAll();
 	if(byteArray.isEmpty())
 		throw std::exception((QString("Empty file ") + DISSIMILARITY_MEASURE).toAscii().data());
-	QString result(byteArray);
-	dir.setCurrent("..");
+	return QString(byteArray);
+}
+
+double stringCompare(const QString& workDir)
+{
+	bool ok;
+	double dissimilarity = runStringCompare(QDir(workDir)).trimmed().toDouble(&ok);
+	if(!ok)
+		throw std::exception((QString("Bad ") + DISSIMILARITY_MEASURE + " in " + workDir).toAscii().data());
+	return dissimilarity;
+}
+
+QString handRecCommands(const cv::Mat &candidate)
+{
+	QDir dir(HANDS_COMPARE_DIR);
+	clock_t handRecStartTime = clock();
+	bmpToSeq(BitMask(candidate), dir);
+
+	if(SEQ_COMPARE_IN_PROCESS)
+	{
+		ShapeSequence etalon, hand;
+		if(!loadSequence(dir.filePath(ETALON_SEQ_NAME), etalon) || !loadSequence(dir.filePath(HAND_SEQ_NAME), hand))
+			throw std::exception((QString("Reading ") + ETALON_SEQ_NAME + " or " + HAND_SEQ_NAME + " failed.").toAscii().data());
+		SequenceComparator comparator;
+		QString result = QString::number(comparator.compare(etalon, hand));
+		if(DEBUG) {
+			writeTime("HAND_REC_COMMANDS", ((float)(clock()-handRecStartTime))/CLOCKS_PER_SEC);
+		}
+		return result;
+	}
+
+	// Command 3
+	QString result = runStringCompare(dir);
+	if(DEBUG) {
+		writeTime("HAND_REC_COMMANDS", ((float)(clock()-handRecStartTime))/CLOCKS_PER_SEC);
+	}
 	return result;
 }
 
+bool runTool(const QString& command, const QString& workingDir)
+{
+	STARTUPINFOW si;
+	PROCESS_INFORMATION pi;
+	ZeroMemory(&si, sizeof(si));
+	si.cb = sizeof(si);
+	ZeroMemory(&pi, sizeof(pi));
+	std::wstring commandLine = (QString("/C ") + command).toStdWString();
+	std::wstring currentDir = QDir::toNativeSeparators(workingDir).toStdWString();
+	if(!CreateProcessW(L"C:\\windows\\system32\\cmd.exe", const_cast<LPWSTR>(commandLine.data()), NULL, NULL, FALSE, CREATE_NO_WINDOW, NULL, workingDir.isEmpty() ? NULL : currentDir.c_str(), &si, &pi))
+		return false;
+	WaitForSingleObject(pi.hProcess, INFINITE);
+	CloseHandle(pi.hProcess);
+	CloseHandle(pi.hThread);
+	return true;
+}
+
 void onePixelBorder(cv::Mat& img) {
-	// Top border, Bottom border
-	for(int j = 0; j < img.cols; j++) {
-		img.at<cv::Vec3b>(0, j) = cv::Vec3b(0, 0, 0);
-		img.at<cv::Vec3b>(img.rows - 1, j) = cv::Vec3b(0, 0, 0);
-	}
-	// Left border, Right border
-	for(int i = 0; i < img.rows; i++) {
-		img.at<cv::Vec3b>(i, 0) = cv::Vec3b(0, 0, 0);
-		img.at<cv::Vec3b>(i, img.cols - 1) = cv::Vec3b(0, 0, 0);
+	if(img.empty())
+		return;
+	CV_Assert(img.depth() == CV_8U && (img.channels() == 1 || img.channels() == 3 || img.channels() == 4));
+	switch(img.channels()) {
+	case 1:
+		clearBorder<1>(img);
+		break;
+	case 4:
+		clearBorder<4>(img);
+		break;
+	default:
+		clearBorder<3>(img);
 	}
 }
 
@@ -240,4 +305,9 @@ void writeNewLine()
 {
 	if(logFile)
 		fwrite("\n", sizeof(char), 1, logFile);
-}
\ No newline at end of file
+}
+
+cv::Rect faceSkinRect()
+{
+	return cv::Rect(cv::Point(FACE_WIDTH*0.3, FACE_HEIGHT*0.5), cv::Point(FACE_WIDTH*0.7, FACE_HEIGHT*0.64));
+}
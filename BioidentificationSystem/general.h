@@ -7,6 +7,8 @@
 #include <QDebug>
 
 typedef std::vector<cv::Point> vecOfPoints;
+struct ShapeSequence;
+class BitMask;
 
 // General 
 extern bool ADVANCED_OUTPUT;
@@ -15,7 +17,8 @@ extern bool SHOW_CONTOURS;
 const bool DEBUG = false;
 
 const int CRITICAL_READ_FRAME_FAILS = 24;
-const int OPENMP_THREADS = 2;
+const int SCHEDULER_THREADS = 0; // Global pool size, 0 - ideal thread count; --threads overrides
+const int SCHEDULER_GRAIN = 32; // Rows or table entries per parallel chunk
 
 // Mean 3 frames
 const int THRES_CADDR = 3;
@@ -25,6 +28,18 @@ const int APERTURE_FILTER = 10;
 
 // Pixel classifier
 const int KERNEL_PARAM_S = 100;
+const int TRAINING_BIN_BITS = 5; // Per channel, colours in one bin are duplicates
+const int TRAINING_SAMPLES_MAX = 1024;
+const int TRAINING_BINS_MAX = 512; // Distinct colours, the rest of the samples repeat them by weight
+const QString SKIN_TEST_DIR = "skintest/"; // Held-out image and its skin mask
+const QString SKIN_TEST_IMAGE = "image.bmp";
+const QString SKIN_TEST_MASK = "mask.bmp";
+
+// Adaptive skin model
+const int SKIN_LUT_BITS = 5; // Per channel
+const float SKIN_MODEL_FORGETTING = 0.05f; // Share of the model replaced by each face patch
+const float SKIN_MODEL_MIN_WEIGHT = 0.002f; // Observed colours above it are skin
+const float SKIN_MODEL_COVERAGE = 0.8f; // Retrain when classifier covers less than this share of what it covered after training
 
 // Canny
 const int LOW_THRESHOLD = 30;
@@ -36,19 +51,54 @@ const int DILATION = 0;
 const int EROSION = 0;
 const int OPENING = 0;
 const int CANNY_CONTOUR_MERGE_EPS = 5;
+const bool GATED_CANNY = false; // Canny only around hand candidates, the only place bending reads it; check with --bench-gated
+const int CANNY_GATE_HALO = 16; // Initial border computed beyond a gate, doubled while a hysteresis chain crosses it
+const bool INCREMENTAL_BENDING = false; // Reuse previous frame's bending on unchanged contour segments, once validated with --bench-bending
+const double INCREMENTAL_BEND_OVERLAP = 0.5; // Min bounding box intersection over union with the previous candidate
+const double INCREMENTAL_BEND_MIN_REUSE = 0.5; // Share of reusable points, full bending below it
+
+// Tiled processing
+const bool TILED_PROCESSING = false; // Skin classification and Canny fused per tile, once validated with --bench-tiles
+const int TILE_SIZE = 112; // With its halo, a tile's intermediates fit a 256 KB L2
+const int TILE_HALO = 8; // Reach of the blur, Sobel of APERTURE 7 and non-maximum suppression
+const int TILE_SKIN_OPENING = 0; // Kernel of the skin mask opening, 0 - none
+const QString TILE_BENCH_REPORT = "Tiles.txt";
+const QString GATED_BENCH_REPORT = "GatedCanny.txt";
+const QString BENDING_BENCH_REPORT = "Bending.txt";
 
 // Hand recognition
 const QString HANDS_COMPARE_DIR = "handscompare/";
 const QString HANDS_BMP_NAME = "hand.bmp";
 const QString STANDARD_HAND_BMP_NAME = "etalon.bmp";
 const QString SKL_FILTER = "*.skl";
-const QString SEQ_FILTER = "hand.seq";
 const QString DISSIMILARITY_MEASURE = "DissimilarityMeasure.txt";
 const int REGULARIZATION = 3;
 const double APPROXIMATION = 0.03;
 const double MERGING = 0.08;
 const int LEGANDRES = 4;
 const double MULCT = 0.2;
+const double SEQ_COMPARE_BAND = 1.0; // Sakoe-Chiba band of the in-process comparison, 1 - exact
+const bool SEQ_COMPARE_IN_PROCESS = false; // Replaces StringCompare.exe once validated on the corpus
+const bool SEQ_COMPARE_FIXED = false; // Integer DP for low-power boards, check --validate-fixed first
+const int SEQ_FIXED_BITS = 8; // Fraction bits of quantized features
+const QString ETALON_SEQ_NAME = "etalon.seq";
+const QString GALLERY_DIR = "gallery/"; // In HANDS_COMPARE_DIR, <identity>.seq with <identity>.bmp mask are imported
+const QString GALLERY_DB_NAME = "gallery.db";
+const QString GALLERY_INDEX_NAME = "gallery.idx";
+const QString GALLERY_TABLE_NAME = "gallery.dsc"; // Descriptors of the records as one table
+const QString GALLERY_FLANN_NAME = "gallery.flann"; // Saved descriptor k-NN index
+const int GALLERY_THUMB_SIZE = 64;
+const int GALLERY_KNN = 32; // Candidates kept by the descriptor index
+const QString GALLERY_MATCH_DIR = "match/"; // In HANDS_COMPARE_DIR, StringCompare.exe files of gallery matching
+const QString ENROLLMENT_WORK_DIR = "enroll/"; // In HANDS_COMPARE_DIR, a subdir per photo while encoding
+const QString ENROLLMENT_REPORT = "Enrollment.txt";
+const QString TUNING_LABELS = "labels.txt"; // In the tuning set dir
+const QString TUNING_WORK_DIR = "tune/"; // In HANDS_COMPARE_DIR, a subdir per image
+const QString TUNING_REPORT = "Tuning.txt";
+const unsigned TUNING_SEED = 12345; // Random search, --tune <dir> <count> <seed> overrides
+const QString HAND_SEQ_NAME = "hand.seq";
+const QString SEQ_VALIDATION_REPORT = "SequenceValidation.txt";
+const QString FIXED_VALIDATION_REPORT = "FixedValidation.txt";
 const int HAND_THRESHOLD = 28;
 const int APPROX_POLY = 0;
 const int MIN_WH = 50;
@@ -56,29 +106,81 @@ const int TOP_HAND_THRES = 2;
 
 // Photo
 const QString PHOTO_PATH = "photo/";
-const QStringList IMAGE_FORMAT("*.bmp");
+const QStringList IMAGE_FORMAT = QStringList() << "*.bmp" << "*.png" << "*.jpg" << "*.jpeg";
+const QString PHOTO_FORMAT = "png"; // png, bmp - lossless, jpg
+const int PHOTO_PNG_COMPRESSION = 3; // 0-9, higher is smaller and slower
+const int PHOTO_JPEG_QUALITY = 95;
 const int THUMBNAIL_WIDTH = 106;
 const int THUMBNAIL_HEIGHT = 80;
+const QString THUMBNAIL_CACHE_DIR = "thumbnails/";
+
+// Session recording
+const QString SESSION_PATH = "sessions/";
+const QString SESSION_EXTENSION = ".session";
+const int SESSION_CHUNK_SIZE = 16 * 1024 * 1024; // Raw bytes per compressed chunk
+const int SESSION_COMPRESSION = 1; // qCompress level, fast
+
+// Identification service
+const QString SERVICE_NAME = "palm-detector"; // QLocalServer name
+const int SERVICE_MAX_PENDING = 8; // Requests in flight over all connections, reading stops beyond
+const int SERVICE_MAX_PAYLOAD = 64 * 1024 * 1024;
+const QString SERVICE_WORK_DIR = "service/"; // In HANDS_COMPARE_DIR, a subdir per worker thread
+const int SERVICE_TIMEOUT = 30000; // ms, client side
+
+// Shared frame ring
+const QString FRAME_RING_NAME = "palm-detector-frames";
+const int FRAME_RING_SLOTS = 4; // A reader's frame stays valid while the producer writes the others
+const int FRAME_RING_READERS = 8; // At most 32, one bit each
+const int FRAME_RING_READER_TIMEOUT = 5000; // ms without a heartbeat before a reader's bit is reclaimed
+
+// Multi-stream
+const QString STREAM_RING_PREFIX = "ring:"; // Stream source naming a frame ring, a device number or a video file otherwise
+const QString STREAM_WORK_DIR = "streams/"; // In HANDS_COMPARE_DIR, a subdir per stream
+const QString STREAM_REPORT = "Streams.txt";
+const int STREAM_STATS_INTERVAL = 1000; // ms
+const double STREAM_LATENCY_SMOOTHING = 0.1; // Weight of the newest frame in the mean latency
 
 // Find face
 const QString FACE_CASCADE_NAME = "haarcascades/haarcascade_frontalface_alt.xml";
 const int FACE_WIDTH = 150;
 const int FACE_HEIGHT = 150;
+const double FACE_TRACK_OVERLAP = 0.3; // Min intersection over union to continue a track
+const int FACE_TRACK_MISSES = 15; // Frames a lost face keeps its skin model
+const double FACE_ROI_MARGIN = 0.5; // Search area of a tracked face grows by this share of it on each side
+const int FACE_FULL_DETECT_INTERVAL = 10; // Frames between whole frame detections of a tracked stream
+const bool FACE_BATCHING = false; // Tracked face searches of the streams in flight share a pass, once measured with --bench-faces
+const int FACE_BATCH_WAIT = 2; // ms a ROI detection waits for others to share a pass with
+const int FACE_BATCH_MOSAIC_WIDTH = 1024;
+const int FACE_BATCH_GAP = 8; // Pixels between mosaic tiles
+const QString FACE_BATCH_REPORT = "FaceBatching.txt";
 
 QImage Mat2QImage(const cv::Mat& frame);
 cv::Mat QImage2Mat(const QImage& image);
 
+// Timestamped name in PHOTO_FORMAT if name is empty, PHOTO_FORMAT extension is added if name has none
+QString imageFileName(const QString& name = QString(), const QString& dir = PHOTO_PATH);
 QString saveImage(const cv::Mat& image, const QString& name = QString(), const QString& dir = PHOTO_PATH);
 cv::Mat loadImage(const QString& imageName);
 
 cv::Mat buildThumbnail(const cv::Mat& image);
+// Gray of a 8-bit BGR, BGRA or gray image, the last one is copied
+void toGray(const cv::Mat& image, cv::Mat& gray);
 
 QString getImageName(const QString& path);
 QString getImagePath(const QString& path);
 
 QString handRecCommands(const cv::Mat &spot);
+// BmpToSeq.exe run in workDir, thread safe for distinct dirs
+ShapeSequence encodeHand(const cv::Mat &candidate, const QString& workDir = HANDS_COMPARE_DIR);
+ShapeSequence encodeHand(const BitMask &candidate, const QString& workDir = HANDS_COMPARE_DIR);
+// StringCompare.exe on etalon.seq and hand.seq already in workDir, thread safe for distinct dirs.
+// Production comparison while SEQ_COMPARE_IN_PROCESS is off.
+double stringCompare(const QString& workDir = HANDS_COMPARE_DIR);
+bool runTool(const QString& command, const QString& workingDir = QString());
 
 void onePixelBorder(cv::Mat& img);
+// Skin sample area of a FACE_WIDTH x FACE_HEIGHT face
+cv::Rect faceSkinRect();
 
 // LOG
 const char* const logFileName = "log.txt";
@@ -1,9 +1,169 @@
 #include "bioidentificationsystem.h"
+#include "SequenceCompare.h"
+#include "Tuning.h"
+#include "IdentificationService.h"
+#include "FrameRing.h"
+#include "StreamEngine.h"
+#include "Scheduler.h"
+#include "TiledStages.h"
 #include <QtGui/QApplication>
+#include <QTextStream>
+
+// --validate-seq <corpus dir>: in-process comparison against StringCompare.exe
+static int validateSequences(const QString& corpusDir)
+{
+	QStringList report;
+	int mismatches = validateSequenceCompare(corpusDir, report);
+	if(mismatches < 0)
+		report << "Corpus " + corpusDir + " doesn't exist.";
+	QFile reportFile(SEQ_VALIDATION_REPORT);
+	if(reportFile.open(QFile::WriteOnly | QFile::Text))
+	{
+		QTextStream out(&reportFile);
+		foreach(const QString& line, report)
+			out << line << "\n";
+	}
+	return (mismatches == 0) ? 0 : 1;
+}
+
+// --validate-fixed <corpus dir>: deviation of the fixed point comparison from the double one
+static int validateFixed(const QString& corpusDir)
+{
+	QStringList report;
+	int flipped = validateFixedCompare(corpusDir, report);
+	if(flipped < 0)
+		report << "Corpus " + corpusDir + " doesn't exist.";
+	QFile reportFile(FIXED_VALIDATION_REPORT);
+	if(reportFile.open(QFile::WriteOnly | QFile::Text))
+	{
+		QTextStream out(&reportFile);
+		foreach(const QString& line, report)
+			out << line << "\n";
+	}
+	return (flipped == 0) ? 0 : 1;
+}
+
+// --query <image path> [service name]: local client of a running --serve
+static int query(const QString& imagePath, const QString& name)
+{
+	QTextStream out(stdout);
+	ServiceResponse response;
+	if(!queryService(imagePath, response, name))
+	{
+		out << "No response from " << name << "\n";
+		return 2;
+	}
+	out << "status " << response.status << " queue " << response.queueMs << " ms total " << response.timings.total << " ms"
+		<< " (skin " << response.timings.skin << ", canny " << response.timings.canny
+		<< ", bend " << response.timings.bend << ", match " << response.timings.match << ")\n";
+	for(size_t k = 0; k < response.hands.size(); k++)
+	{
+		const HandResult& hand = response.hands[k];
+		out << "hand " << hand.bbox.x << " " << hand.bbox.y << " " << hand.bbox.width << " " << hand.bbox.height
+			<< " dissimilarity " << hand.dissimilarity << " " << (hand.matched ? hand.identity : QString("-")) << "\n";
+	}
+	return (response.status == STATUS_OK) ? 0 : 1;
+}
+
+// --publish [device] [ring name]: camera frames into shared memory for local recognizers (Attach)
+static int publish(int device, const QString& name)
+{
+	cv::VideoCapture cap;
+	cv::Mat frame;
+	if(!cap.open(device) || !cap.read(frame) || frame.empty())
+	{
+		QTextStream(stderr) << "Can't read camera " << device << "\n";
+		return 1;
+	}
+	FrameRingWriter ring;
+	if(!ring.create(name, (int)(frame.total() * frame.elemSize())))
+	{
+		QTextStream(stderr) << "Can't create " << name << ": " << ring.errorString() << "\n";
+		return 1;
+	}
+	int readFrameFails = 0;
+	while(readFrameFails < CRITICAL_READ_FRAME_FAILS)
+	{
+		if(!cap.read(frame)) {
+			readFrameFails++;
+			continue;
+		}
+		readFrameFails = 0;
+		ring.write(frame);
+	}
+	return 0;
+}
 
 int main(int argc, char *argv[])
 {
 	QApplication a(argc, argv);
+	QStringList args = a.arguments();
+	// --threads <n>: global pool size for every mode, --pin-threads: one core per pool thread
+	int threadsArg = args.indexOf("--threads");
+	configureScheduler((threadsArg >= 0 && threadsArg + 1 < args.size()) ? args[threadsArg + 1].toInt() : SCHEDULER_THREADS,
+		args.contains("--pin-threads"));
+	int validate = args.indexOf("--validate-seq");
+	if(validate >= 0 && validate + 1 < args.size())
+		return validateSequences(args[validate + 1]);
+	int validateFixedArg = args.indexOf("--validate-fixed");
+	if(validateFixedArg >= 0 && validateFixedArg + 1 < args.size())
+		return validateFixed(args[validateFixedArg + 1]);
+	// --bench-tiles <image> [iterations]: tiled against full frame stages, results in TILE_BENCH_REPORT
+	int benchArg = args.indexOf("--bench-tiles");
+	if(benchArg >= 0 && benchArg + 1 < args.size())
+		return (benchmarkTiles(args[benchArg + 1], (benchArg + 2 < args.size()) ? args[benchArg + 2].toInt() : 20) < 0) ? 1 : 0;
+	// --bench-gated <image> [iterations]: gated against full frame Canny, results in GATED_BENCH_REPORT
+	int gatedArg = args.indexOf("--bench-gated");
+	if(gatedArg >= 0 && gatedArg + 1 < args.size())
+		return (benchmarkGatedCanny(args[gatedArg + 1], (gatedArg + 2 < args.size()) ? args[gatedArg + 2].toInt() : 20) != 0) ? 1 : 0;
+	// --bench-faces <video> [frames [batch]]: batched against separate face ROI passes, results in FACE_BATCH_REPORT
+	int facesArg = args.indexOf("--bench-faces");
+	if(facesArg >= 0 && facesArg + 1 < args.size())
+		return (benchmarkFaceBatching(args[facesArg + 1], (facesArg + 2 < args.size()) ? args[facesArg + 2].toInt() : 100,
+			(facesArg + 3 < args.size()) ? args[facesArg + 3].toInt() : 4) < 0) ? 1 : 0;
+	// --bench-bending <video> [frames]: incremental against full bending, results in BENDING_BENCH_REPORT
+	int bendingArg = args.indexOf("--bench-bending");
+	if(bendingArg >= 0 && bendingArg + 1 < args.size())
+		return (benchmarkBending(args[bendingArg + 1], (bendingArg + 2 < args.size()) ? args[bendingArg + 2].toInt() : 100) != 0) ? 1 : 0;
+	// --tune <labelled set dir> [random configuration count [seed]]
+	int tuneArg = args.indexOf("--tune");
+	if(tuneArg >= 0 && tuneArg + 1 < args.size())
+		return tune(args[tuneArg + 1], (tuneArg + 2 < args.size()) ? args[tuneArg + 2].toInt() : 0,
+			(tuneArg + 3 < args.size()) ? args[tuneArg + 3].toUInt() : TUNING_SEED);
+	// --serve [service name]: headless identification service
+	int serveArg = args.indexOf("--serve");
+	if(serveArg >= 0)
+	{
+		IdentificationService service;
+		QString name = (serveArg + 1 < args.size()) ? args[serveArg + 1] : SERVICE_NAME;
+		if(!service.listen(name))
+		{
+			QTextStream(stderr) << "Can't listen on " << name << ": " << service.errorString() << "\n";
+			return 1;
+		}
+		return a.exec();
+	}
+	int publishArg = args.indexOf("--publish");
+	if(publishArg >= 0)
+		return publish((publishArg + 1 < args.size()) ? args[publishArg + 1].toInt() : 0,
+			(publishArg + 2 < args.size()) ? args[publishArg + 2] : FRAME_RING_NAME);
+	// --streams <device | video file | ring:name>...: headless multi-camera recognition, stats in STREAM_REPORT
+	int streamsArg = args.indexOf("--streams");
+	if(streamsArg >= 0)
+	{
+		StreamEngine engine;
+		engine.setReportFile(STREAM_REPORT);
+		for(int k = streamsArg + 1; k < args.size() && !args[k].startsWith("--"); k++)
+			if(engine.addStream(args[k]) < 0)
+				QTextStream(stderr) << "Can't open stream " << args[k] << "\n";
+		if(engine.streamCount() == 0)
+			return 1;
+		engine.start();
+		return a.exec();
+	}
+	int queryArg = args.indexOf("--query");
+	if(queryArg >= 0 && queryArg + 1 < args.size())
+		return query(args[queryArg + 1], (queryArg + 2 < args.size()) ? args[queryArg + 2] : SERVICE_NAME);
 	BioidentificationSystem w;
 	w.show();
 	return a.exec();